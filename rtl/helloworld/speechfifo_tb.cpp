@@ -163,6 +163,9 @@ int	main(int argc, char **argv) {
 
 		tfp->close();
 
+		// Stop the UART's I/O thread, once it has sent everything
+		delete uart;
+
 		//
 		// *IF* we ever get here, then at least explain to the user
 		// why we stopped.
@@ -45,6 +45,7 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "uartsim.h"
 
@@ -101,9 +102,32 @@ UARTSIM::UARTSIM(const int port) {
 	m_tx_baudcounter = 0;
 	m_rx_state = RXIDLE;
 	m_tx_state = TXIDLE;
+
+	m_fromio = new UARTQ;
+	m_toio   = new UARTQ;
+	memset(m_fromio, 0, sizeof(UARTQ));
+	memset(m_toio,   0, sizeof(UARTQ));
+	m_stop = false;
+	if (pthread_create(&m_thread, NULL, iothread, this) != 0) {
+		fprintf(stderr, "ERR: Could not start the UART I/O thread\n");
+		exit(EXIT_FAILURE);
+	}
+	m_running = true;
+}
+
+UARTSIM::~UARTSIM(void) {
+	kill();
+	delete m_fromio;
+	delete m_toio;
 }
 
 void	UARTSIM::kill(void) {
+	if (m_running) {
+		__atomic_store_n(&m_stop, true, __ATOMIC_RELEASE);
+		pthread_join(m_thread, NULL);
+		m_running = false;
+	}
+
 	fflush(stdout);
 
 	// Quickly double check that we aren't about to close stdin/stdout
@@ -135,10 +159,14 @@ void	UARTSIM::check_for_new_connections(void) {
 	if ((m_conrd < 0)&&(m_conwr<0)&&(m_skt>=0)) {
 		// Can we accept a connection?
 		struct	pollfd	pb;
+		struct	timespec	waitfor;
 
 		pb.fd = m_skt;
 		pb.events = POLLIN;
-		poll(&pb, 1, 0);
+		waitfor.tv_sec  = 0;
+		waitfor.tv_nsec = UARTIOWAIT_NS;
+		if (ppoll(&pb, 1, &waitfor, NULL) <= 0)
+			return;
 
 		if (pb.revents & POLLIN) {
 			m_conrd = accept(m_skt, 0, 0);
@@ -152,11 +180,108 @@ void	UARTSIM::check_for_new_connections(void) {
 
 }
 
-int	UARTSIM::rawtick(const int i_tx, const bool network) {
-	int	o_rx = 1, nr = 0;
+void	*UARTSIM::iothread(void *uart) {
+	UARTSIM	*u = (UARTSIM *)uart;
+
+	u->iorun(u->m_skt >= 0);
+	return NULL;
+}
+
+void	UARTSIM::iorun(const bool network) {
+	while(!__atomic_load_n(&m_stop, __ATOMIC_ACQUIRE)) {
+		if ((network)&&(m_conrd < 0))
+			check_for_new_connections();
+		else
+			poll_io(network);
+		drain(network);
+	}
+
+	// Write out whatever the simulation left behind
+	drain(network);
+}
+
+void	UARTSIM::poll_io(const bool network) {
+	struct	pollfd	pb;
+	struct	timespec	waitfor;
+	char	buf[256];
+	int	nr, ln = sizeof(buf);
+
+	waitfor.tv_sec  = 0;
+	waitfor.tv_nsec = UARTIOWAIT_NS;
+
+	if ((unsigned)ln > uartq_free(m_fromio))
+		ln = uartq_free(m_fromio);
+	if ((m_conrd < 0)||(ln == 0)) {
+		// Nothing to read, or no room to read it into
+		nanosleep(&waitfor, NULL);
+		return;
+	}
+
+	pb.fd = m_conrd;
+	pb.events = POLLIN;
+	if (ppoll(&pb, 1, &waitfor, NULL) < 0) {
+		perror("Polling error:");
+		return;
+	}
+
+	if ((pb.revents & (POLLIN|POLLHUP|POLLERR)) == 0)
+		return;
 
 	if (network)
-		check_for_new_connections();
+		nr = recv(m_conrd, buf, ln, MSG_DONTWAIT);
+	else
+		nr = read(m_conrd, buf, ln);
+	if (nr > 0) {
+		uartq_write(m_fromio, buf, nr);
+	} else if ((network)&&(nr == 0)) {
+		close(m_conrd);
+		m_conrd = m_conwr = -1;
+		// printf("Closing network connection\n");
+	} else if (nr < 0) {
+		if (!network) {
+			fprintf(stderr, "ERR while attempting to read in--closing input port\n");
+			perror("UARTSIM::read() ");
+			m_conrd = -1;
+		} else {
+			perror("O/S Read err:");
+			close(m_conrd);
+			m_conrd = m_conwr = -1;
+		}
+	} else // End of file on a non-network input
+		m_conrd = -1;
+}
+
+void	UARTSIM::drain(const bool network) {
+	int	ln, nw = 0;
+
+	ln = uartq_read(m_toio, m_iobuf, UARTQLN);
+	if ((ln == 0)||(m_conwr < 0))
+		return;
+
+	while(nw < ln) {
+		int	w;
+
+		if (network)
+			w = send(m_conwr, &m_iobuf[nw], ln-nw, 0);
+		else
+			w = write(m_conwr, &m_iobuf[nw], ln-nw);
+		if ((w <= 0)&&(network)) {
+			close(m_conwr);
+			m_conrd = m_conwr = -1;
+			fprintf(stderr, "Failed write, connection closed\n");
+			return;
+		} else if (w <= 0) {
+			fprintf(stderr, "ERR while attempting to write out--closing output port\n");
+			perror("UARTSIM::write() ");
+			m_conrd = m_conwr = -1;
+			return;
+		}
+		nw += w;
+	}
+}
+
+int	UARTSIM::rawtick(const int i_tx) {
+	int	o_rx = 1;
 
 	if ((!i_tx)&&(m_last_tx))
 		m_rx_changectr = 0;
@@ -174,18 +299,13 @@ int	UARTSIM::rawtick(const int i_tx, const bool network) {
 	} else if (m_rx_baudcounter <= 0) {
 		if (m_rx_busy >= (1<<(m_nbits+m_nparity+m_nstop-1))) {
 			m_rx_state = RXIDLE;
-			if (m_conwr >= 0) {
+			if (m_running) {
 				char	buf[1];
 				buf[0] = (m_rx_data >> (32-m_nbits-m_nstop-m_nparity))&0x0ff;
-				if ((network)&&(1 != send(m_conwr, buf, 1, 0))) {
-					close(m_conwr);
-					m_conrd = m_conwr = -1;
-					fprintf(stderr, "Failed write, connection closed\n");
-				} else if ((!network)&&(1 != write(m_conwr, buf, 1))) {
-					fprintf(stderr, "ERR while attempting to write out--closing output port\n");
-					perror("UARTSIM::write() ");
-					m_conrd = m_conwr = -1;
-				}
+				// Should the I/O thread fall this far behind,
+				// wait for it rather than drop anything
+				while(uartq_write(m_toio, buf, 1) != 1)
+					sched_yield();
 			}
 		} else {
 			m_rx_busy = (m_rx_busy << 1)|1;
@@ -205,60 +325,34 @@ int	UARTSIM::rawtick(const int i_tx, const bool network) {
 	} else
 		m_rx_baudcounter--;
 
-	if ((m_tx_state == TXIDLE)&&((network)||(m_conrd >= 0))) {
-		struct	pollfd	pb;
-		pb.fd = m_conrd;
-		pb.events = POLLIN;
-		if (poll(&pb, 1, 0) < 0)
-			perror("Polling error:");
+	if (m_tx_state == TXIDLE) {
+		char	buf[1];
 
-		if (pb.revents & POLLIN) {
-			char	buf[1];
-
-			if (network)
-				nr = recv(m_conrd, buf, 1, MSG_DONTWAIT);
-			else
-				nr = read(m_conrd, buf, 1);
-			if (1 == nr) {
-				m_tx_data = (-1<<(m_nbits+m_nparity+1))
-					// << nstart_bits
-					|((buf[0]<<1)&0x01fe);
-				if (m_nparity) {
-					int	p;
-
-					// If m_nparity is set, we need to then
-					// create the parity bit.
-					if (m_fixdp)
-						p = m_evenp;
-					else {
-						p = (m_tx_data >> 1)&0x0ff;
-						p = p ^ (p>>4);
-						p = p ^ (p>>2);
-						p = p ^ (p>>1);
-						p &= 1;
-						p ^= m_evenp;
-					}
-					m_tx_data |= (p<<(m_nbits+m_nparity));
-				}
-				m_tx_busy = (1<<(m_nbits+m_nparity+m_nstop+1))-1;
-				m_tx_state = TXDATA;
-				o_rx = 0;
-				m_tx_baudcounter = m_baud_counts-1;
-			} else if ((network)&&(nr == 0)) {
-				close(m_conrd);
-				m_conrd = m_conwr = -1;
-				// printf("Closing network connection\n");
-			} else if (nr < 0) {
-				if (!network) {
-					fprintf(stderr, "ERR while attempting to read in--closing input port\n");
-					perror("UARTSIM::read() ");
-					m_conrd = -1;
-				} else {
-					perror("O/S Read err:");
-					close(m_conrd);
-					m_conrd = m_conwr = -1;
+		if (1 == uartq_read(m_fromio, buf, 1)) {
+			m_tx_data = (-1<<(m_nbits+m_nparity+1))
+				// << nstart_bits
+				|((buf[0]<<1)&0x01fe);
+			if (m_nparity) {
+				int	p;
+
+				// If m_nparity is set, we need to then
+				// create the parity bit.
+				if (m_fixdp)
+					p = m_evenp;
+				else {
+					p = (m_tx_data >> 1)&0x0ff;
+					p = p ^ (p>>4);
+					p = p ^ (p>>2);
+					p = p ^ (p>>1);
+					p &= 1;
+					p ^= m_evenp;
 				}
+				m_tx_data |= (p<<(m_nbits+m_nparity));
 			}
+			m_tx_busy = (1<<(m_nbits+m_nparity+m_nstop+1))-1;
+			m_tx_state = TXDATA;
+			o_rx = 0;
+			m_tx_baudcounter = m_baud_counts-1;
 		}
 	} else if (m_tx_baudcounter <= 0) {
 		m_tx_data >>= 1;
@@ -275,11 +369,3 @@ int	UARTSIM::rawtick(const int i_tx, const bool network) {
 
 	return o_rx;
 }
-
-int	UARTSIM::nettick(const int i_tx) {
-	return rawtick(i_tx, true);
-}
-
-int	UARTSIM::fdtick(const int i_tx) {
-	return rawtick(i_tx, false);
-}
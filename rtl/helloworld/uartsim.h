@@ -9,6 +9,11 @@
 //	This file provides the description of the interface between the UARTSIM
 //	and the rest of the world.  See below for more detailed descriptions.
 //
+//	The socket (or file) work all takes place within a separate I/O thread,
+//	which trades characters with the simulation through a pair of single
+//	producer, single consumer rings.  Nothing called from the simulation's
+//	tick ever needs to make a system call.
+//
 // Creator:	Dan Gisselquist, Ph.D.
 //		Gisselquist Technology, LLC
 //
@@ -50,18 +55,90 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
 
 #define	TXIDLE	0
 #define	TXDATA	1
 #define	RXIDLE	0
 #define	RXDATA	1
 
+// The size of each ring, which must be a power of two, and how long (in
+// nanoseconds) the I/O thread waits for input before checking for output
+#define	UARTQLN		65536
+#define	UARTIOWAIT_NS	100000
+
+// A ring with one writer and one reader.  The writer is the only one to ever
+// adjust m_tail, and the reader the only one to ever adjust m_head, so no
+// locks are needed.
+typedef	struct	{
+	unsigned	m_head;
+	char		m_hpad[60];
+	unsigned	m_tail;
+	char		m_tpad[60];
+	char		m_data[UARTQLN];
+} UARTQ;
+
+// Returns the number of characters that may be written into the ring
+static inline	unsigned	uartq_free(UARTQ *q) {
+	return UARTQLN - (q->m_tail - __atomic_load_n(&q->m_head,
+						__ATOMIC_ACQUIRE));
+}
+
+// Writes up to len characters into the ring, returning the number written
+static inline	int	uartq_write(UARTQ *q, const char *buf, int len) {
+	unsigned	tail = q->m_tail, first, ln, avail;
+
+	avail = uartq_free(q);
+	if ((unsigned)len > avail)
+		len = avail;
+
+	first = tail & (UARTQLN-1);
+	ln = ((unsigned)len > UARTQLN - first) ? UARTQLN - first : len;
+	memcpy(&q->m_data[first], buf, ln);
+	memcpy(q->m_data, &buf[ln], len-ln);
+
+	__atomic_store_n(&q->m_tail, tail+len, __ATOMIC_RELEASE);
+	return len;
+}
+
+// Reads up to len characters from the ring, returning the number read
+static inline	int	uartq_read(UARTQ *q, char *buf, int len) {
+	unsigned	head = q->m_head, tail, first, ln;
+
+	tail = __atomic_load_n(&q->m_tail, __ATOMIC_ACQUIRE);
+	if ((unsigned)len > tail - head)
+		len = tail - head;
+
+	first = head & (UARTQLN-1);
+	ln = ((unsigned)len > UARTQLN - first) ? UARTQLN - first : len;
+	memcpy(buf, &q->m_data[first], ln);
+	memcpy(&buf[ln], q->m_data, len-ln);
+
+	__atomic_store_n(&q->m_head, head+len, __ATOMIC_RELEASE);
+	return len;
+}
+
 class	UARTSIM	{
-	// The file descriptors:
+	// The file descriptors, all owned by the I/O thread:
 	//	m_skt   is the socket/port we are listening on
 	//	m_conrd is the file descriptor to read from
 	//	m_conwr is the file descriptor to write to
 	int	m_skt, m_conrd, m_conwr;
+
+	// Characters from the network (or file) headed into the design, and
+	// characters from the design headed out
+	UARTQ	*m_fromio, *m_toio;
+	char	m_iobuf[UARTQLN];
+	pthread_t	m_thread;
+	bool	m_running, m_stop;
+
+	static	void	*iothread(void *uart);
+	void	iorun(const bool network);
+	// Reads anything available into m_fromio, waiting up to UARTIOWAIT_NS
+	void	poll_io(const bool network);
+	// Writes everything in m_toio
+	void	drain(const bool network);
 	//
 	// The m_setup register is the 29'bit control register used within
 	// the core.
@@ -80,20 +157,18 @@ class	UARTSIM	{
 	void	setup_listener(const int port);
 
 	// Call check_for_new_connections() to see if we can accept a new
-	// network socket connection to our device
+	// network socket connection to our device.  Only the I/O thread
+	// calls this.
 	void	check_for_new_connections(void);
 
-	// nettick() gets called if we are connected to a network, and
-	int	nettick(const int i_tx);
-	int	fdtick(const int i_tx);
-	int	rawtick(const int i_tx, const bool network);
+	int	rawtick(const int i_tx);
 
-	// We'll use the file descriptor for the listener socket to determine
-	// whether we are connected to the network or not.  If not connected
-	// to the network, then we assume m_conrd and m_conwr refer to 
-	// your more traditional file descriptors, and use them as such.
+	// The I/O thread uses the file descriptor for the listener socket to
+	// determine whether we are connected to the network or not.  If not
+	// connected to the network, then we assume m_conrd and m_conwr refer
+	// to your more traditional file descriptors, and use them as such.
 	int	tick(const int i_tx) {
-		return rawtick(i_tx, (m_skt >= 0));
+		return rawtick(i_tx);
 	}
 
 public:
@@ -102,9 +177,12 @@ public:
 	// localhost to listen in on.  Once started, connections may be made
 	// to this port to get the output from the port.
 	UARTSIM(const int port);
+	// Stops the I/O thread, as kill() does, before releasing its rings
+	~UARTSIM(void);
 
-	// kill() closes any active connection and the socket.  Once killed,
-	// no further output will be sent to the port.
+	// kill() stops the I/O thread, once it has written everything it has
+	// been given, and then closes any active connection and the socket.
+	// Once killed, no further output will be sent to the port.
 	void	kill(void);
 
 	// setup() busts out the bits from isetup to the various internal
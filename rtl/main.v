@@ -113,6 +113,11 @@
 module	main(i_clk, i_reset,
 		// GPIO ports
 		i_gpio, o_gpio,
+`ifdef	VERILATOR
+		// Simulation only: a byte-wide path around the wbu UART
+		i_wbu_sim_bypass, i_wbu_sim_stb, i_wbu_sim_data,
+		o_wbu_sim_stb, o_wbu_sim_data, i_wbu_sim_busy,
+`endif
 		// UART/host to wishbone interface
 		i_wbu_uart_rx, o_wbu_uart_tx,
 		// Network receive delay controller
@@ -158,6 +163,13 @@ module	main(i_clk, i_reset,
 	output	wire	[(NGPO-2):0]	o_gpio;
 	input	wire		i_wbu_uart_rx;
 	output	wire		o_wbu_uart_tx;
+`ifdef	VERILATOR
+	input	wire		i_wbu_sim_bypass, i_wbu_sim_stb;
+	input	wire	[7:0]	i_wbu_sim_data;
+	output	wire		o_wbu_sim_stb;
+	output	wire	[7:0]	o_wbu_sim_data;
+	input	wire		i_wbu_sim_busy;
+`endif
 	input	wire	[15:0]	i_net1dly_data;
 	output	reg	[15:0]	o_net1dly_data;
 		// Extra clocks
@@ -446,7 +458,7 @@ module	main(i_clk, i_reset,
 	assign	        spio_sel = ((wb_sio_sel)&&(wb_addr[ 3: 0] ==  4'h9));  // 0x000024
 	assign	    systimer_sel = ((wb_sio_sel)&&(wb_addr[ 3: 0] ==  4'ha));  // 0x000028
 	assign	     version_sel = ((wb_sio_sel)&&(wb_addr[ 3: 0] ==  4'hb));  // 0x00002c
-	assign	    flashcfg_sel = ((wb_addr[22:18] &  5'h1f) ==  5'h01); // 0x100000
+	assign	    flashcfg_sel = ((wb_addr[22:18] &  5'h1f) ==  5'h01); // 0x100000 - 0x10000f
 	assign	   enetscope_sel = ((wb_addr[22:18] &  5'h1f) ==  5'h02); // 0x200000 - 0x200007
 	assign	    flashdbg_sel = ((wb_addr[22:18] &  5'h1f) ==  5'h03); // 0x300000 - 0x300007
 	assign	        uart_sel = ((wb_addr[22:18] &  5'h1f) ==  5'h04); // 0x400000 - 0x40000f
@@ -844,9 +856,10 @@ module	main(i_clk, i_reset,
 
 `ifdef	FLASHCFG_ACCESS
 	// The Flash control interface result comes back together with the
-	// flash interface itself.  Hence, we always return zero here.
+	// flash interface itself.  Hence, we always return zero here, and
+	// stall whenever the flash does.
 	assign	flashcfg_ack   = 1'b0;
-	assign	flashcfg_stall = 1'b0;
+	assign	flashcfg_stall = flash_stall;
 	assign	flashcfg_data  = flash_data;
 `else	// FLASHCFG_ACCESS
 
@@ -860,17 +873,37 @@ module	main(i_clk, i_reset,
 `ifdef	WBUBUS_MASTER
 	localparam	DBGBUSBITS = $clog2(BUSUART);
 	// The Host USB interface, to be used by the WB-UART bus
+	wire		wbu_uart_rx_stb, wbu_uart_tx_busy, wbu_bypass;
+	wire	[7:0]	wbu_uart_rx_data;
+
 	rxuartlite	#(.TIMER_BITS(DBGBUSBITS),
 				.CLOCKS_PER_BAUD(BUSUART[DBGBUSBITS-1:0]))
 		rcv(i_clk, i_wbu_uart_rx,
-				wbu_rx_stb, wbu_rx_data);
+				wbu_uart_rx_stb, wbu_uart_rx_data);
 	txuartlite	#(.TIMING_BITS(DBGBUSBITS[4:0]),
 				.CLOCKS_PER_BAUD(BUSUART[DBGBUSBITS-1:0]))
 		txv(i_clk,
-				wbu_tx_stb,
+				(wbu_tx_stb)&&(!wbu_bypass),
 				wbu_tx_data,
 				o_wbu_uart_tx,
-				wbu_tx_busy);
+				wbu_uart_tx_busy);
+
+`ifdef	VERILATOR
+	// When bypassed, the simulation trades whole bytes with the bus,
+	// rather than bits with the UARTs.  A byte is accepted on any clock
+	// where o_wbu_sim_stb is set and i_wbu_sim_busy is not.
+	assign	wbu_bypass  = i_wbu_sim_bypass;
+	assign	wbu_rx_stb  = (wbu_bypass) ? i_wbu_sim_stb  : wbu_uart_rx_stb;
+	assign	wbu_rx_data = (wbu_bypass) ? i_wbu_sim_data : wbu_uart_rx_data;
+	assign	wbu_tx_busy = (wbu_bypass) ? i_wbu_sim_busy : wbu_uart_tx_busy;
+	assign	o_wbu_sim_stb  = (wbu_bypass)&&(wbu_tx_stb);
+	assign	o_wbu_sim_data = wbu_tx_data;
+`else
+	assign	wbu_bypass  = 1'b0;
+	assign	wbu_rx_stb  = wbu_uart_rx_stb;
+	assign	wbu_rx_data = wbu_uart_rx_data;
+	assign	wbu_tx_busy = wbu_uart_tx_busy;
+`endif
 
 `ifdef	INCLUDE_ZIPCPU
 `else
@@ -896,6 +929,10 @@ module	main(i_clk, i_reset,
 	assign	wbu_sel = 4'hf;
 	assign	wbu_addr = wbu_tmp_addr[(23-1):0];
 `else	// WBUBUS_MASTER
+`ifdef	VERILATOR
+	assign	o_wbu_sim_stb  = 1'b0;
+	assign	o_wbu_sim_data = 8'h0;
+`endif
 
 	// In the case that nothing drives the wbu bus ...
 	assign	wbu_cyc = 1'b0;
@@ -991,7 +1028,7 @@ module	main(i_clk, i_reset,
 	assign	buildtime_ack = wb_stb && buildtime_sel;
 	assign	buildtime_stall = 1'b0;
 `ifdef	FLASH_ACCESS
-	qflexpress #(.LGFLASHSZ(24), .OPT_CLKDIV(1),
+	qflashcrc #(.LGFLASHSZ(24), .OPT_CLKDIV(1),
 		.NDUMMY(2), .RDDELAY(0),
 		.OPT_ENDIANSWAP(!OPT_BIGENDIAN),
 		.OPT_STARTUP_FILE("micron.hex"),
@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename:	qflashcrc.v
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	Wraps the qflexpress flash controller, adding a small engine
+//		that can calculate a CRC32 across a range of the flash.
+//	This allows the host to verify what it has written to the flash
+//	by comparing a single CRC, rather than reading every word back across
+//	the debugging bus.
+//
+//	The engine's registers share the flash configuration address space.
+//	The configuration register itself remains at offset zero, followed
+//	by:
+//
+//	1. ADDR	The byte address, within the flash, where the CRC is to start.
+//		Must be word aligned.  Reads return the next address to be
+//		read.
+//	2. LEN	Writing a non-zero number of words here starts the engine.
+//		Reads return the number of words remaining, with bit 31 set
+//		while the engine is busy.
+//	3. CRC	The CRC of every word read since LEN was last written.  This
+//		is the same CRC32 as used by Ethernet and zlib: reflected,
+//		polynomial 0x04c11db7, starting from and ending with an
+//		inversion, taken across the bytes in the order they are found
+//		in the flash.
+//
+//	While the engine is busy, all other flash requests will stall.
+//	The engine reads the flash as the bus would, so the flash must be
+//	in its normal (read) mode--not in the middle of a configuration
+//	command--for the CRC to be meaningful.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of  the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+`default_nettype	none
+//
+module	qflashcrc(i_clk, i_reset,
+		i_wb_cyc, i_wb_stb, i_cfg_stb, i_wb_we, i_wb_addr, i_wb_data,
+			o_wb_stall, o_wb_ack, o_wb_data,
+		o_qspi_sck, o_qspi_cs_n, o_qspi_mod, o_qspi_dat, i_qspi_dat,
+		o_dbg_trigger, o_debug);
+	//
+	// These parameters are all passed, unchanged, to qflexpress.  See
+	// that module for their descriptions
+	parameter	LGFLASHSZ=24;
+	parameter [0:0]	OPT_PIPE    = 1'b1;
+	parameter [0:0]	OPT_CFG     = 1'b1;
+	parameter [0:0]	OPT_STARTUP = 1'b1;
+	parameter	OPT_CLKDIV = 0;
+	parameter [0:0]	OPT_ENDIANSWAP = 1'b1;
+	parameter	RDDELAY = 0;
+	parameter	NDUMMY = 6;
+	parameter	OPT_STARTUP_FILE="spansion.hex";
+	//
+	localparam	AW=LGFLASHSZ-2;
+	localparam	DW=32;
+	//
+	localparam [1:0]	CRC_ADDR = 2'b01,
+				CRC_LEN  = 2'b10,
+				CRC_VALUE= 2'b11;
+	localparam [31:0]	CRC_POLY = 32'hedb88320;
+	//
+	input	wire			i_clk, i_reset;
+	//
+	input	wire			i_wb_cyc, i_wb_stb, i_cfg_stb, i_wb_we;
+	input	wire	[(AW-1):0]	i_wb_addr;
+	input	wire	[(DW-1):0]	i_wb_data;
+	//
+	output	wire			o_wb_stall, o_wb_ack;
+	output	reg	[(DW-1):0]	o_wb_data;
+	//
+	output	wire		o_qspi_sck;
+	output	wire		o_qspi_cs_n;
+	output	wire	[1:0]	o_qspi_mod;
+	output	wire	[3:0]	o_qspi_dat;
+	input	wire	[3:0]	i_qspi_dat;
+	//
+	// Debugging port
+	output	wire		o_dbg_trigger;
+	output	wire	[31:0]	o_debug;
+
+	wire		q_cyc, q_stb, q_cfg_stb, q_we;
+	wire	[(AW-1):0]	q_addr;
+	wire		q_stall, q_ack;
+	wire	[(DW-1):0]	q_data;
+
+	wire		reg_request, reg_stb, crc_request;
+	reg		crc_busy, reg_ack;
+	reg	[(AW-1):0]	crc_addr;
+	reg	[AW:0]		crc_reqs, crc_acks;
+	reg	[31:0]		crc_value;
+	reg	[1:0]		reg_addr;
+	reg	[3:0]		ext_pending;
+
+	//
+	// Calculate the CRC across one word, one bit at a time, starting with
+	// the first byte in the flash.  Following qflexpress, that byte is
+	// in the low order bits when OPT_ENDIANSWAP is set, and in the high
+	// order bits otherwise.
+	//
+	function [31:0]	crcword;
+		input	[31:0]	crc;
+		input	[31:0]	data;
+
+		reg	[31:0]	c, d;
+		integer		k;
+	begin
+		if (OPT_ENDIANSWAP)
+			d = data;
+		else
+			d = { data[7:0], data[15:8], data[23:16], data[31:24] };
+
+		c = crc;
+		for(k=0; k<32; k=k+1)
+			c = (c[0] ^ d[k]) ? ((c >> 1) ^ CRC_POLY) : (c >> 1);
+		crcword = c;
+	end endfunction
+
+	//
+	// Bus requests for our own registers.  These are only accepted once
+	// any flash requests from the bus have completed, so that our
+	// acknowledgments remain in order.
+	//
+	assign	reg_request = (i_cfg_stb)&&(i_wb_addr[1:0] != 2'b00);
+	assign	reg_stb = (reg_request)&&(!o_wb_stall);
+
+	//
+	// Count the flash requests from the bus that have yet to be
+	// acknowledged
+	//
+	initial	ext_pending = 0;
+	always @(posedge i_clk)
+	if ((i_reset)||((!i_wb_cyc)&&(!crc_busy)))
+		ext_pending <= 0;
+	else if (!crc_busy)
+		case({ (q_stb || q_cfg_stb)&&(!q_stall), q_ack })
+		2'b10: ext_pending <= ext_pending + 1'b1;
+		2'b01: ext_pending <= ext_pending - 1'b1;
+		default: begin end
+		endcase
+
+	//
+	// The CRC engine
+	//
+	assign	crc_request = (crc_busy)&&(crc_reqs != 0)&&(!q_stall);
+
+	initial	crc_busy = 1'b0;
+	initial	crc_reqs = 0;
+	initial	crc_acks = 0;
+	always @(posedge i_clk)
+	if (i_reset)
+	begin
+		crc_busy <= 1'b0;
+		crc_reqs <= 0;
+		crc_acks <= 0;
+	end else if (!crc_busy)
+	begin
+		if ((reg_stb)&&(i_wb_we)&&(i_wb_addr[1:0] == CRC_LEN)
+				&&(i_wb_data[AW:0] != 0))
+		begin
+			crc_busy <= 1'b1;
+			crc_reqs <= i_wb_data[AW:0];
+			crc_acks <= i_wb_data[AW:0];
+		end
+	end else begin
+		if (crc_request)
+			crc_reqs <= crc_reqs - 1'b1;
+		if (q_ack)
+		begin
+			crc_acks <= crc_acks - 1'b1;
+			if (crc_acks == 1)
+				crc_busy <= 1'b0;
+		end
+	end
+
+	always @(posedge i_clk)
+	if (crc_request)
+		crc_addr <= crc_addr + 1'b1;
+	else if ((!crc_busy)&&(reg_stb)&&(i_wb_we)
+			&&(i_wb_addr[1:0] == CRC_ADDR))
+		crc_addr <= i_wb_data[(AW+1):2];
+
+	initial	crc_value = 32'hffff_ffff;
+	always @(posedge i_clk)
+	if ((!crc_busy)&&(reg_stb)&&(i_wb_we)&&(i_wb_addr[1:0] == CRC_LEN))
+		crc_value <= 32'hffff_ffff;
+	else if ((crc_busy)&&(q_ack))
+		crc_value <= crcword(crc_value, q_data);
+
+	//
+	// Register reads
+	//
+	initial	reg_ack = 1'b0;
+	always @(posedge i_clk)
+	if (i_reset)
+		reg_ack <= 1'b0;
+	else
+		reg_ack <= (reg_stb);
+
+	always @(posedge i_clk)
+	if (reg_stb)
+		reg_addr <= i_wb_addr[1:0];
+
+	always @(*)
+	if (!reg_ack)
+		o_wb_data = q_data;
+	else case(reg_addr)
+	CRC_ADDR:  o_wb_data = { {(DW-AW-2){1'b0}}, crc_addr, 2'b00 };
+	CRC_LEN:   o_wb_data = { crc_busy, {(DW-AW-2){1'b0}}, crc_acks };
+	CRC_VALUE: o_wb_data = ~crc_value;
+	default:   o_wb_data = q_data;
+	endcase
+
+	//
+	// The flash controller sees either the bus, or our engine
+	//
+	assign	q_cyc     = (crc_busy)||(i_wb_cyc);
+	assign	q_stb     = (crc_busy) ? (crc_reqs != 0) : (i_wb_stb);
+	assign	q_cfg_stb = (!crc_busy)&&(i_cfg_stb)&&(!reg_request);
+	assign	q_we      = (!crc_busy)&&(i_wb_we);
+	assign	q_addr    = (crc_busy) ? crc_addr : i_wb_addr;
+
+	assign	o_wb_stall = (reg_request) ? (ext_pending != 0)
+				: ((crc_busy)||(q_stall));
+	assign	o_wb_ack   = (reg_ack)||((!crc_busy)&&(q_ack));
+
+	qflexpress #(.LGFLASHSZ(LGFLASHSZ), .OPT_PIPE(OPT_PIPE),
+		.OPT_CFG(OPT_CFG), .OPT_STARTUP(OPT_STARTUP),
+		.OPT_CLKDIV(OPT_CLKDIV), .OPT_ENDIANSWAP(OPT_ENDIANSWAP),
+		.RDDELAY(RDDELAY), .NDUMMY(NDUMMY),
+		.OPT_STARTUP_FILE(OPT_STARTUP_FILE))
+	flashi(i_clk, i_reset,
+		q_cyc, q_stb, q_cfg_stb, q_we, q_addr, i_wb_data,
+			q_stall, q_ack, q_data,
+		o_qspi_sck, o_qspi_cs_n, o_qspi_mod, o_qspi_dat, i_qspi_dat,
+		o_dbg_trigger, o_debug);
+
+endmodule
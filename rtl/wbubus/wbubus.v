@@ -50,6 +50,14 @@ module	wbubus(i_clk, i_rx_stb, i_rx_data,
 	parameter	LGWATCHDOG=19,
 			LGINPUT_FIFO=6,
 			LGOUTPUT_FIFO=10;
+	// The depths of the write (decompression) and read (compression)
+	// tables, log base two.  LGWTBL must match the value the host
+	// software, sw/host/ttybus.h, was built with.
+	parameter	LGWTBL=8,
+			LGRTBL=10;
+	// When the host asks for binary mode, we'll use all eight bits of
+	// each byte.
+	localparam	BINBITS=8;
 	input	wire		i_clk;
 	input	wire		i_rx_stb;
 	input	wire	[7:0]	i_rx_data;
@@ -69,7 +77,10 @@ module	wbubus(i_clk, i_rx_stb, i_rx_data,
 	// Decode ASCII input requests into WB bus cycle requests
 	wire		in_stb;
 	wire	[35:0]	in_word;
-	wbuinput	getinput(i_clk, i_rx_stb, i_rx_data, in_stb, in_word);
+	wire		w_binary;
+	wbuinput #(LGWTBL, BINBITS)
+		getinput(i_clk, i_rx_stb, i_rx_data, in_stb, in_word,
+			w_binary);
 
 	wire	w_bus_busy, fifo_in_stb, exec_stb, w_bus_reset;
 	wire	[35:0]	fifo_in_word, exec_word;
@@ -107,10 +118,10 @@ module	wbubus(i_clk, i_rx_stb, i_rx_data,
 
 	wire		ofifo_err;
 	// wire	[30:0]	out_dbg;
-	wbuoutput #(LGOUTPUT_FIFO) wroutput(i_clk, w_bus_reset,
+	wbuoutput #(LGOUTPUT_FIFO, LGRTBL, BINBITS) wroutput(i_clk, w_bus_reset,
 			exec_stb, exec_word,
 			o_wb_cyc, i_interrupt, exec_stb,
-			o_tx_stb, o_tx_data, i_tx_busy, ofifo_err);
+			o_tx_stb, o_tx_data, i_tx_busy, ofifo_err, w_binary);
 	// verilator lint_off UNUSED
 	wire	ofifo_unused;
 	assign	ofifo_unused = ofifo_err;
@@ -56,6 +56,9 @@
 // better here.
 module	wbucompress(i_clk, i_reset, i_stb, i_codword, i_busy, o_stb, o_cword,
 		o_busy);
+	// TBITS is the log, base two, of the depth of our compression table.
+	// Since the longest table reference we can encode is 521 back, there's
+	// no point in making this any more than ten.
 	parameter	DW=32, CW=36, TBITS=10;
 	input	wire			i_clk, i_reset, i_stb;
 	input	wire	[(CW-1):0]	i_codword;
@@ -213,7 +216,7 @@ module	wbucompress(i_clk, i_reset, i_stb, i_codword, i_busy, o_stb, o_cword,
 	always @(posedge i_clk)
 	if (clear_table)
 		tbl_filled <= 1'b0;
-	else if (tbl_addr == 10'h3ff)
+	else if (&tbl_addr)
 		tbl_filled <= 1'b1;
 
 	// Now that we know where we are writing into the table, and what
@@ -304,7 +307,7 @@ module	wbucompress(i_clk, i_reset, i_stb, i_codword, i_busy, o_stb, o_cword,
 	if (i_reset || !i_busy)
 		addr_within_table <= 1;
 	else if (addr_within_table)
-		addr_within_table <= (dffaddr <= 10'd521);
+		addr_within_table <= (dffaddr <= 10'd521)&&(!(&dffaddr));
 
 
 	// pmatch indicates a *possible* match.  It's basically a shift
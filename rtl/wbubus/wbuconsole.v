@@ -63,6 +63,14 @@ module	wbuconsole(i_clk, i_rx_stb, i_rx_data,
 	parameter	LGWATCHDOG=19,
 			LGINPUT_FIFO=6,
 			LGOUTPUT_FIFO=10;
+	// The depths of the write (decompression) and read (compression)
+	// tables, log base two.  LGWTBL must match the value the host
+	// software, sw/host/ttybus.h, was built with.
+	parameter	LGWTBL=8,
+			LGRTBL=10;
+	// Since we share the port with the console, we only have seven bits
+	// per byte to use should the host ask for binary mode.
+	localparam	BINBITS=7;
 	input	wire		i_clk;
 	input	wire		i_rx_stb;
 	input	wire	[7:0]	i_rx_data;
@@ -99,7 +107,10 @@ module	wbuconsole(i_clk, i_rx_stb, i_rx_data,
 	// Decode ASCII input requests into WB bus cycle requests
 	wire		in_stb;
 	wire	[35:0]	in_word;
-	wbuinput	getinput(i_clk, (i_rx_stb)&&(i_rx_data[7]), { 1'b0, i_rx_data[6:0] }, in_stb, in_word);
+	wire		w_binary;
+	wbuinput #(LGWTBL, BINBITS)
+		getinput(i_clk, (i_rx_stb)&&(i_rx_data[7]),
+			{ 1'b0, i_rx_data[6:0] }, in_stb, in_word, w_binary);
 
 	wire	w_bus_busy, fifo_in_stb, exec_stb, w_bus_reset;
 	wire	[35:0]	fifo_in_word, exec_word;
@@ -142,11 +153,11 @@ module	wbuconsole(i_clk, i_rx_stb, i_rx_data,
 
 	wire		ofifo_err;
 	// wire	[30:0]	out_dbg;
-	wbuoutput #(LGOUTPUT_FIFO)
+	wbuoutput #(LGOUTPUT_FIFO, LGRTBL, BINBITS)
 		wroutput(i_clk, w_bus_reset,
 			exec_stb, exec_word,
 			o_wb_cyc, i_interrupt, exec_stb,
-			wbu_tx_stb, wbu_tx_data, ps_full, ofifo_err);
+			wbu_tx_stb, wbu_tx_data, ps_full, ofifo_err, w_binary);
 
 	// Let's now arbitrate between the two outputs
 	initial	ps_full = 1'b0;
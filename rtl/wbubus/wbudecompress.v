@@ -44,15 +44,21 @@
 `default_nettype none
 //
 module	wbudecompress(i_clk, i_stb, i_word, o_stb, o_word);
+	// LGWTBL is the log, base two, of the depth of our write compression
+	// table.  The host software must be built with the same value, lest it
+	// reference table entries we don't have.  Since compressed writes
+	// carry eight bits of table index, LGWTBL may be no more than eight.
+	parameter	LGWTBL = 8;
 	input	wire		i_clk, i_stb;
 	input	wire	[35:0]	i_word;
 	output	reg		o_stb;
 	output	reg	[35:0]	o_word;
 
-	reg	[7:0]	wr_addr;
-	reg	[31:0]	compression_tbl	[0:255];
+	reg	[(LGWTBL-1):0]	wr_addr;
+	reg	[31:0]	compression_tbl	[0:((1<<LGWTBL)-1)];
 	reg	[35:0]	r_word;
-	reg	[7:0]	cmd_addr;
+	reg	[(LGWTBL-1):0]	cmd_addr;
+	wire	[7:0]	w_tbl_index;
 	reg	[24:0]	r_addr;
 	wire	[31:0]	w_addr;
 	reg	[9:0]	rd_len;
@@ -66,10 +72,10 @@ module	wbudecompress(i_clk, i_stb, i_word, o_stb, o_word);
 
 
 	// Clock one: { o_stb, r_stb } = 4'h1 when done
-	initial	wr_addr = 8'h0;
+	initial	wr_addr = 0;
 	always @(posedge i_clk)
 	if ((i_stb)&&(cmd_write_not_compressed))
-		wr_addr <= wr_addr + 8'h1;
+		wr_addr <= wr_addr + 1'b1;
 
 	always @(posedge i_clk)
 	if (i_stb)
@@ -82,9 +88,11 @@ module	wbudecompress(i_clk, i_stb, i_word, o_stb, o_word);
 
 	// Clock two, calculate the table address ... 1 is the smallest address
 	//	{ o_stb, r_stb } = 4'h2 when done
+	assign	w_tbl_index = { i_word[32:31], i_word[29:24] };
+
 	always @(posedge i_clk)
 	if (i_stb)
-		cmd_addr <= wr_addr - { i_word[32:31], i_word[29:24] };
+		cmd_addr <= wr_addr - w_tbl_index[(LGWTBL-1):0];
 
 	// Let's also calculate the address, in case this is a compressed
 	// address word
@@ -160,7 +168,19 @@ module	wbudecompress(i_clk, i_stb, i_word, o_stb, o_word);
 	6'b1?????: o_word <= { 5'b11000, r_word[30], 20'h00, rd_len };
 	// Read, two word (3+9 bits) length ... same encoding
 	// 6'b1?????: o_word <= { 5'b11000, r_word[30], 20'h00, rd_len };
+	//
+	// Everything else passes straight through.  This includes runs of
+	// values, each the last plus a stride, which go on to wbuexec, the
+	// only place that knows what the last value written was, and that
+	// can hold off further commands while the run completes:
+	//	{ 4'h1, 16-bit (run length - 1), 16-bit signed stride }
 	default: o_word <= r_word;
 	endcase
+
+	// Make verilator happy
+	// verilator lint_off UNUSED
+	wire	unused;
+	assign	unused = &w_tbl_index;
+	// verilator lint_on  UNUSED
 endmodule
 
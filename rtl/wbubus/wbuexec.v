@@ -71,23 +71,30 @@ module	wbuexec(i_clk, i_rst, i_stb, i_codword, o_busy,
 	output	reg	[35:0]	o_codword;
 
 
-	wire	w_accept, w_eow, w_newwr, w_new_err;
+	wire	w_accept, w_eow, w_newwr, w_newrun, w_new_err;
 	// wire	w_newad, w_newrd;
 	assign	w_accept = (i_stb)&&(!o_busy);
 	// assign	w_newad  = (w_accept)&&(i_codword[35:34] == 2'b00);
 	assign	w_newwr  = (w_accept)&&(i_codword[35:34] == 2'b01);
 	assign	w_eow    = (w_accept)&&(i_codword[35:30] == 6'h2e);
+	// A stride run: write the last value plus a stride, some number of
+	// times.  Only valid within a write burst.
+	assign	w_newrun = (w_accept)&&(i_codword[35:32] == 4'h1);
 	// assign	w_newrd  = (w_accept)&&(i_codword[35:34] == 2'b11);
 	wire	[31:0]	w_cod_data;
 	assign	w_cod_data={ i_codword[32:31], i_codword[29:0] }; 
 	assign	w_new_err = ((w_accept)
 				&&(i_codword[35:33] != 3'h3)
+				&&(i_codword[35:32] != 4'h1)
 				&&(i_codword[35:30] != 6'h2e));
 
 	reg	[2:0]	wb_state;
 	reg	[9:0]	r_acks_needed, r_len;
 	reg	r_inc, r_new_addr, last_read_request, last_ack, zero_acks;
 	reg	single_read_request;
+	// The number of writes remaining in any stride run, and its stride
+	reg	[15:0]	r_run;
+	reg	[31:0]	r_stride;
 
 	initial	r_new_addr = 1'b1;
 	initial	wb_state = `WB_IDLE;
@@ -131,6 +138,7 @@ module	wbuexec(i_clk, i_rst, i_stb, i_codword, o_busy,
 			// though we were about to start a write.
 			//
 			o_wb_data <= w_cod_data; 
+			r_run <= 0;
 			//
 			if (i_stb)
 			begin
@@ -210,7 +218,8 @@ module	wbuexec(i_clk, i_rst, i_stb, i_codword, o_busy,
 			if ((r_inc)&&(!i_wb_stall))
 				o_wb_addr <= o_wb_addr + 32'h001;
 
-			o_stb <= (i_wb_err)||(!i_wb_stall);
+			// Only acknowledge the last write of any stride run
+			o_stb <= (i_wb_err)||((!i_wb_stall)&&(r_run == 0));
 
 			// Don't need to worry about accepting anything new
 			// here, since we'll always be busy while in this state.
@@ -223,6 +232,11 @@ module	wbuexec(i_clk, i_rst, i_stb, i_codword, o_busy,
 				//
 				o_wb_cyc <= 1'b0;
 				o_wb_stb <= 1'b0;
+			end else if ((!i_wb_stall)&&(r_run != 0))
+			begin
+				// Continue our stride run
+				o_wb_data <= o_wb_data + r_stride;
+				r_run <= r_run - 1'b1;
 			end else if (!i_wb_stall)
 			begin
 				wb_state <= `WB_WAIT_ON_NEXT_WRITE;
@@ -258,7 +272,13 @@ module	wbuexec(i_clk, i_rst, i_stb, i_codword, o_busy,
 			o_codword <= { 6'h5, i_wb_data[29:0] };
 			o_stb <= (i_wb_err)||(w_new_err);
 
-			o_wb_data <= w_cod_data;
+			if (w_newwr)
+				o_wb_data <= w_cod_data;
+			else if (w_newrun)
+				o_wb_data <= o_wb_data + { {(16){i_codword[15]}},
+							i_codword[15:0] };
+			r_run    <= i_codword[31:16];
+			r_stride <= { {(16){i_codword[15]}}, i_codword[15:0] };
 			o_wb_cyc <= 1'b1;
 			o_wb_stb <= 1'b0;
 
@@ -272,6 +292,11 @@ module	wbuexec(i_clk, i_rst, i_stb, i_codword, o_busy,
 				wb_state <= `WB_FLUSH_WRITE_REQUESTS;
 			end
 			else if (w_newwr) // Need to make a new write request
+			begin
+				wb_state <= `WB_WRITE_REQUEST;
+				o_wb_stb <= 1'b1;
+				r_run <= 0;
+			end else if (w_newrun) // Start a stride run
 			begin
 				wb_state <= `WB_WRITE_REQUEST;
 				o_wb_stb <= 1'b1;
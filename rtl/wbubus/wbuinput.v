@@ -42,16 +42,20 @@
 //
 `default_nettype none
 //
-module	wbuinput(i_clk, i_stb, i_byte, o_stb, o_codword);
+module	wbuinput(i_clk, i_stb, i_byte, o_stb, o_codword, o_binary);
+	parameter	LGWTBL = 8, BINBITS = 8;
 	input	wire		i_clk, i_stb;
 	input	wire	[7:0]	i_byte;
 	output	wire		o_stb;
 	output	wire	[35:0]	o_codword;
+	// True once the host has switched us to binary mode
+	output	wire		o_binary;
 
 	wire		hx_stb, hx_valid;
 	wire	[5:0]	hx_hexbits;
-	wbutohex	tobits(i_clk, i_stb, i_byte,
-				hx_stb, hx_valid, hx_hexbits);
+	wbutohex #(BINBITS)
+		tobits(i_clk, i_stb, i_byte,
+				hx_stb, hx_valid, hx_hexbits, o_binary);
 
 	wire		cw_stb;
 	wire	[35:0]	cw_word;
@@ -63,7 +67,8 @@ module	wbuinput(i_clk, i_stb, i_byte, o_stb, o_codword);
 	assign	o_stb = cw_stb;
 	assign	o_codword = cw_word;
 `else
-	wbudecompress	unpack(i_clk,cw_stb,cw_word, o_stb, o_codword);
+	wbudecompress #(LGWTBL)
+		unpack(i_clk,cw_stb,cw_word, o_stb, o_codword);
 `endif
 
 endmodule
@@ -43,8 +43,8 @@
 //
 module	wbuoutput(i_clk, i_rst, i_stb, i_codword,
 		i_wb_cyc, i_int, i_bus_busy,
-		o_stb, o_char, i_tx_busy, o_fifo_err);
-	parameter	LGOUTPUT_FIFO = 10;
+		o_stb, o_char, i_tx_busy, o_fifo_err, i_binary);
+	parameter	LGOUTPUT_FIFO = 10, LGRTBL = 10, BINBITS = 8;
 	input	wire		i_clk, i_rst;
 	input	wire		i_stb;
 	input	wire	[35:0]	i_codword;
@@ -56,6 +56,8 @@ module	wbuoutput(i_clk, i_rst, i_stb, i_codword,
 	// Miscellaneous I/O: UART transmitter busy, and fifo error
 	input	wire		i_tx_busy;
 	output	wire		o_fifo_err;
+	// Pack our output into BINBITS bit bytes, rather than ASCII
+	input	wire		i_binary;
 
 	wire		fifo_rd, dw_busy, fifo_empty_n, fifo_err;
 	wire	[35:0]	fifo_codword;
@@ -105,7 +107,8 @@ module	wbuoutput(i_clk, i_rst, i_stb, i_codword,
 	assign	cp_word = cw_codword;
 	assign	cp_busy = dw_busy;
 `else
-	wbucompress	packit(i_clk, 1'b0, cw_stb, cw_codword, dw_busy,
+	wbucompress #(.TBITS(LGRTBL))
+		packit(i_clk, 1'b0, cw_stb, cw_codword, dw_busy,
 				cp_stb, cp_word, cp_busy);
 `endif
 
@@ -117,6 +120,8 @@ module	wbuoutput(i_clk, i_rst, i_stb, i_codword,
 			(i_wb_cyc||i_bus_busy||fifo_empty_n||cw_busy),
 			byte_busy, ln_busy);
 
-	wbusixchar	mkbytes(i_clk, ln_stb, ln_bits, o_stb, o_char, byte_busy, i_tx_busy);
+	wbusixchar #(BINBITS)
+		mkbytes(i_clk, ln_stb, ln_bits, o_stb, o_char, byte_busy,
+			i_tx_busy, i_binary);
 
 endmodule
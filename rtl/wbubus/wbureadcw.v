@@ -99,10 +99,12 @@ module	wbureadcw(i_clk, i_stb, i_valid, i_hexbits,
 	default: begin end
 	endcase
 
+	// A stride run (0001) only ever follows a write, and continues that
+	// write burst.  So, like a write, it needs to be ended by a newline.
 	initial	lastcw = 2'b00;
 	always @(posedge i_clk)
 	if (o_stb)
-		lastcw <= o_codword[35:34];
+		lastcw <= (o_codword[35:32] == 4'h1) ? 2'b01 : o_codword[35:34];
 	always @(posedge i_clk)
 	if ((i_stb)&&(!i_valid)&&(lastcw == 2'b01))
 		o_codword[35:30] <= 6'h2e;
@@ -124,7 +126,7 @@ module	wbureadcw(i_clk, i_stb, i_valid, i_hexbits,
 			cw_len <= 3'h2;
 		else if (i_hexbits[5:3] == 3'b001) // 2b compressed addr
 			cw_len <= 3'b010 + { 1'b0, i_hexbits[2:1] };
-		else // long write or set address
+		else // long write, set address, or stride run
 			cw_len <= 3'h6;
 	end else if (w_stb)
 		cw_len <= 0;
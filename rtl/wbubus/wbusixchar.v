@@ -16,6 +16,14 @@
 //
 //		Note that decoding is stateless, yet requires one clock.
 //
+//	Once the host has asked for it (i_binary), we instead pack the six bit
+//	values into BINBITS bit bytes--seven when sharing the port with a
+//	console, eight on a dedicated port--oldest bits first.  The switch
+//	is announced by sending a single 8'h10+BINBITS byte.  In this binary
+//	mode, a 63 is sent as two 63's, and a newline as a 63 followed by a
+//	zero.  Any bits left in the byte following a newline are then padded
+//	with zeros and sent, so that the next value starts on a byte boundary.
+//
 //
 // Creator:	Dan Gisselquist, Ph.D.
 //		Gisselquist Technology, LLC
@@ -48,7 +56,9 @@
 //
 `default_nettype	none
 //
-module	wbusixchar(i_clk, i_stb, i_bits, o_stb, o_char, o_busy, i_busy);
+module	wbusixchar(i_clk, i_stb, i_bits, o_stb, o_char, o_busy, i_busy,
+		i_binary);
+	parameter	BINBITS = 8;
 	input	wire		i_clk;
 	input	wire		i_stb;
 	input	wire	[6:0]	i_bits;
@@ -56,10 +66,72 @@ module	wbusixchar(i_clk, i_stb, i_bits, o_stb, o_char, o_busy, i_busy);
 	output	reg	[7:0]	o_char;
 	output	wire		o_busy;
 	input	wire		i_busy;
+	input	wire		i_binary;
+
+	// Binary mode: r_binary is true once we've announced it.  acc holds
+	// nacc bits waiting to be sent, right aligned, oldest bits first.
+	// r_flush is set following a newline, until every bit's been sent.
+	reg		r_binary, r_flush;
+	reg	[19:0]	acc;
+	reg	[4:0]	nacc;
+	wire	[11:0]	w_sym;
+	wire	[4:0]	w_nsym;
+	wire		w_in, w_out;
+
+	// The one or two six bit values we'll send for this input
+	assign	w_sym  = (i_bits[6]) ? 12'hfc0
+			: ((&i_bits[5:0]) ? 12'hfff : { 6'h0, i_bits[5:0] });
+	assign	w_nsym = ((i_bits[6])||(&i_bits[5:0])) ? 5'd12 : 5'd6;
+
+	assign	w_in  = (i_stb)&&(!o_busy);
+	assign	w_out = (r_binary)&&(i_binary)&&(!o_stb)
+			&&((nacc >= BINBITS)||((r_flush)&&(nacc != 0)));
+
+	initial	r_binary = 1'b0;
+	always @(posedge i_clk)
+	if ((i_binary)&&(!r_binary)&&(!o_stb))
+		r_binary <= 1'b1;
+	else if (!i_binary)
+		r_binary <= 1'b0;
+
+	initial	nacc    = 0;
+	initial	r_flush = 1'b0;
+	always @(posedge i_clk)
+	if ((!r_binary)||(!i_binary))
+	begin
+		nacc    <= 0;
+		r_flush <= 1'b0;
+	end else if (w_in)
+	begin
+		if (w_nsym == 5'd12)
+			acc <= { acc[ 7:0], w_sym };
+		else
+			acc <= { acc[13:0], w_sym[5:0] };
+		nacc <= nacc + w_nsym;
+		r_flush <= i_bits[6];
+	end else if (w_out)
+	begin
+		if (nacc >= BINBITS)
+			nacc <= nacc - BINBITS;
+		else
+			nacc <= 0;
+	end else if (nacc == 0)
+		r_flush <= 1'b0;
 
 	initial	o_char = 8'h00;
 	always @(posedge i_clk)
-	if ((i_stb)&&(!o_busy))
+	if ((i_binary)&&(!r_binary)&&(!o_stb))
+		// Announce the switch to binary
+		o_char <= 8'h10 + BINBITS;
+	else if (w_out)
+	begin
+		if (nacc >= BINBITS)
+			o_char <= { 8'h0, acc } >> (nacc - BINBITS);
+		else
+			o_char <= { 8'h0, acc } << (BINBITS - nacc);
+		if (BINBITS < 8)
+			o_char[7] <= 1'b0;
+	end else if ((w_in)&&(!r_binary))
 	begin
 		if (i_bits[6])
 			o_char <= 8'h0a;
@@ -79,10 +151,17 @@ module	wbusixchar(i_clk, i_stb, i_bits, o_stb, o_char, o_busy, i_busy);
 	always @(posedge i_clk)
 	if ((o_stb)&&(!i_busy))
 		o_stb <= 1'b0;
-	else if ((i_stb)&&(!o_stb))
+	else if ((i_binary)&&(!r_binary)&&(!o_stb))
+		o_stb <= 1'b1;
+	else if ((w_in)&&(!r_binary))
+		o_stb <= 1'b1;
+	else if (w_out)
 		o_stb <= 1'b1;
 
-	assign	o_busy = o_stb;
+	// In ASCII mode, we can take a new value any time we aren't sending
+	// one.  In binary mode, we need room for two more values in acc, and
+	// not to be in the middle of flushing it.
+	assign	o_busy = (i_binary != r_binary)
+			||((r_binary) ? ((nacc >= BINBITS)||(r_flush)) : o_stb);
 
 endmodule
-
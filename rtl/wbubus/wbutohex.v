@@ -16,6 +16,14 @@
 //
 //		Note that decoding is stateless, yet requires one clock.
 //
+//	A 8'h02 byte requests binary mode, and switches this decoder (and
+//	o_binary, which tells wbusixchar to switch as well) over.  In binary
+//	mode, each byte carries BINBITS bits of six-bit values, oldest first.
+//	A 63 followed by a 63 is a 63, a 63 followed by anything else is a
+//	newline, after which any bits remaining in the current byte are
+//	dropped.  Sixteen zero bytes in a row return us to ASCII.  (The host
+//	never otherwise sends so many zero bits in a row.)
+//
 //
 // Creator:	Dan Gisselquist, Ph.D.
 //		Gisselquist Technology, LLC
@@ -46,17 +54,82 @@
 ////////////////////////////////////////////////////////////////////////////////
 //
 //
-module	wbutohex(i_clk, i_stb, i_byte, o_stb, o_valid, o_hexbits);
+module	wbutohex(i_clk, i_stb, i_byte, o_stb, o_valid, o_hexbits, o_binary);
+	parameter	BINBITS = 8;
 	input	wire		i_clk, i_stb;
 	input	wire	[7:0]	i_byte;
 	output	reg		o_stb, o_valid;
 	output	reg	[5:0]	o_hexbits;
+	output	reg		o_binary;
+
+	// Binary mode: acc holds nacc bits, right aligned, oldest bits first
+	reg	[15:0]	acc;
+	reg	[4:0]	nacc;
+	reg		r_esc;
+	reg	[3:0]	zcount;
+	wire	[7:0]	w_data;
+	wire	[5:0]	w_sym;
+	wire	[4:0]	w_left, w_tail;
+	wire		w_take, w_realign;
+
+	assign	w_data = i_byte & ((1<<BINBITS)-1);
+
+	// We can take a six-bit value from acc anytime we have one
+	assign	w_take = (o_binary)&&(nacc >= 5'd6);
+	assign	w_sym  = acc >> (nacc - 5'd6);
+	assign	w_left = nacc - 5'd6;
+	// Following an escaped newline, drop what's left of the current byte
+	assign	w_realign = (w_take)&&(r_esc)&&(w_sym != 6'h3f);
+	assign	w_tail = (w_left >= 2*BINBITS) ? (w_left - 2*BINBITS)
+			: ((w_left >= BINBITS) ? (w_left - BINBITS) : w_left);
+
+	initial	zcount = 0;
+	always @(posedge i_clk)
+	if ((!o_binary)||((i_stb)&&(w_data != 0)))
+		zcount <= 0;
+	else if (i_stb)
+		zcount <= zcount + 1'b1;
+
+	initial	o_binary = 1'b0;
+	always @(posedge i_clk)
+	if ((i_stb)&&(!o_binary)&&(i_byte == 8'h02))
+		o_binary <= 1'b1;
+	else if ((i_stb)&&(w_data == 0)&&(&zcount))
+		o_binary <= 1'b0;
 
+	initial	nacc = 0;
+	initial	r_esc = 1'b0;
 	always @(posedge i_clk)
+	if (!o_binary)
+	begin
+		nacc  <= 0;
+		r_esc <= 1'b0;
+	end else begin
+		if (i_stb)
+			acc <= (acc << BINBITS) | { 8'h00, w_data };
+
+		if (w_take)
+			nacc <= ((w_realign) ? (w_left - w_tail) : w_left)
+				+ ((i_stb) ? BINBITS : 0);
+		else if (i_stb)
+			nacc <= nacc + BINBITS;
+
+		if (w_take)
+			r_esc <= (!r_esc)&&(w_sym == 6'h3f);
+	end
+
+	always @(posedge i_clk)
+	if (o_binary)
+		o_stb <= (w_take)&&((r_esc)||(w_sym != 6'h3f));
+	else
 		o_stb <= i_stb;
 
 	always @(posedge i_clk)
+	if (o_binary)
 	begin
+		o_valid   <= !w_realign;
+		o_hexbits <= w_sym;
+	end else begin
 		// These are the defaults, to be overwridden by the ifs below
 		o_valid <= 1'b1;
 		o_hexbits <= 6'h00;
@@ -75,4 +148,3 @@ module	wbutohex(i_clk, i_stb, i_byte, o_stb, o_valid, o_hexbits);
 			o_valid <= 1'b0;
 	end
 endmodule
-
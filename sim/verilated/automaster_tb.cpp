@@ -57,6 +57,27 @@
 
 #include "main_tb.cpp"
 
+// Set on SIGINT or SIGTERM, so that we may stop cleanly and the trace file
+// (if any) can be completely written out
+static	volatile sig_atomic_t	gbl_stop = 0;
+
+static	void	stop_handler(int) {
+	gbl_stop = 1;
+}
+
+// If set, a checkpoint is written to gbl_ckpt_file once the simulation
+// reaches gbl_ckpt_ps
+static	const char	*gbl_ckpt_file = NULL;
+static	unsigned long	gbl_ckpt_ps = -1ul;
+
+static	void	tick(MAINTB *tb) {
+	tb->tick();
+	if ((gbl_ckpt_file)&&(tb->m_time_ps >= gbl_ckpt_ps)) {
+		tb->save_checkpoint(gbl_ckpt_file);
+		gbl_ckpt_file = NULL;
+	}
+}
+
 void	usage(void) {
 	fprintf(stderr, "USAGE: main_tb <options> [zipcpu-elf-file]\n");
 	fprintf(stderr,
@@ -64,10 +85,36 @@ void	usage(void) {
 // -p # command port
 // -s # serial port
 // -f # profile file
+"\t-b\tBypasses the debugging bus UART, exchanging whole characters\n"
+"\t\twith the bus rather than bits\n"
+"\t-c <filename>[:<ns>]\n"
+"\t\tWrites a checkpoint of the simulation to <filename> once it\n"
+"\t\treaches <ns> ns, or else when it ends.  Requires a SAVABLE=1 build.\n"
 "\t-d\tSets the debugging flag\n"
+"\t-i <filename>[:<ns>]\n"
+"\t\tReplays the packets in the pcap file <filename> into the network\n"
+"\t\tport, starting <ns> ns into the simulation, at the same intervals\n"
+"\t\tthey were captured at.\n"
+"\t-l\tReplays each packet only once the design has answered the last,\n"
+"\t\tand reports the number of round trips per simulated second\n"
+"\t-m <name>\n"
+"\t\tServes the debugging bus through the shared memory block <name>,\n"
+"\t\trather than the network.  Set FPGASHM=<name> for host programs\n"
+"\t\tto connect to it.\n"
+"\t-n <tapdev>\n"
+"\t\tBridges the network port to the (existing) TAP device <tapdev>\n"
+"\t-o <filename>\n"
+"\t\tWrites every packet the design transmits to the pcap file\n"
+"\t\t<filename>\n"
+"\t-r <filename>\n"
+"\t\tRestores the simulation from the checkpoint in <filename>, rather\n"
+"\t\tthan starting it from reset.  Any ELF file is then ignored.\n"
 "\t-t <filename>\n"
 "\t\tTurns on tracing, sends the trace to <filename>--assumed to\n"
-"\t\tbe a vcd file\n"
+"\t\tbe a vcd file.  If <filename> ends in .gz, the trace will be\n"
+"\t\tcompressed as it is written.\n"
+"\t-w <start>[:<stop>]\n"
+"\t\tOnly traces from <start> ns until <stop> ns into the simulation\n"
 );
 }
 
@@ -76,9 +123,13 @@ int	main(int argc, char **argv) {
 
 	const	char *elfload = NULL,
 			*profile_file = NULL,
-			*trace_file = NULL; // "trace.vcd";
-	bool	debug_flag = false, willexit = false;
+			*trace_file = NULL, // "trace.vcd";
+			*restore_file = NULL,
+			*replay_file = NULL;
+	bool	debug_flag = false, willexit = false, lockstep = false;
+	unsigned long	replay_ns = 0;
 	FILE	*profile_fp;
+	unsigned long	trace_start_ns = 0, trace_stop_ns = -1;
 
 	MAINTB	*tb = new MAINTB;
 
@@ -86,12 +137,55 @@ int	main(int argc, char **argv) {
 		if (argv[argn][0] == '-') for(int j=1;
 					(j<512)&&(argv[argn][j]);j++) {
 			switch(tolower(argv[argn][j])) {
+			case 'b': tb->m_wbu->bypass(); break;
+			case 'c': {
+				char	*ptr;
+				gbl_ckpt_file = argv[++argn];
+				if ((ptr = strrchr(argv[argn], ':')) != NULL) {
+					*ptr++ = '\0';
+					gbl_ckpt_ps = strtoul(ptr, &ptr, 0) * 1000ul;
+					if (*ptr) {
+						fprintf(stderr, "ERR: Bad checkpoint time, %s\n",
+							argv[argn]);
+						exit(EXIT_FAILURE);
+					}
+				}
+				j=1000; } break;
 			case 'd': debug_flag = true;
 				if (trace_file == NULL)
 					trace_file = "trace.vcd";
 				break;
 			case 'f': profile_file = "pfile.bin"; break;
+			case 'i': {
+				char	*ptr;
+				replay_file = argv[++argn];
+				if ((ptr = strrchr(argv[argn], ':')) != NULL) {
+					*ptr++ = '\0';
+					replay_ns = strtoul(ptr, &ptr, 0);
+					if (*ptr) {
+						fprintf(stderr, "ERR: Bad replay time, %s\n",
+							argv[argn]);
+						exit(EXIT_FAILURE);
+					}
+				}
+				j=1000; } break;
+			case 'l': lockstep = true; break;
+			case 'm': tb->m_wbu->shm(argv[++argn]); j=1000; break;
+			case 'n': tb->m_net1->tap(argv[++argn]); j=1000; break;
+			case 'o': tb->m_net1->capture(argv[++argn]); j=1000; break;
+			case 'r': restore_file = argv[++argn]; j=1000; break;
 			case 't': trace_file = argv[++argn]; j=1000; break;
+			case 'w': {
+				char	*ptr;
+				trace_start_ns = strtoul(argv[++argn], &ptr, 0);
+				if (*ptr == ':')
+					trace_stop_ns = strtoul(ptr+1, &ptr, 0);
+				if ((*ptr)||(trace_stop_ns <= trace_start_ns)) {
+					fprintf(stderr, "ERR: Bad trace window, %s\n",
+						argv[argn]);
+					exit(EXIT_FAILURE);
+				}
+				j=1000; } break;
 			case 'h': usage(); exit(0); break;
 			default:
 				fprintf(stderr, "ERR: Unexpected flag, -%c\n\n",
@@ -108,6 +202,9 @@ int	main(int argc, char **argv) {
 		}
 	}
 
+	if (replay_file)
+		tb->m_net1->replay(replay_file, replay_ns * 1000ul, lockstep);
+
 	if (elfload)
 		willexit = true;
 	if (debug_flag) {
@@ -117,8 +214,14 @@ int	main(int argc, char **argv) {
 		printf("\tVCD File         = %s\n", trace_file);
 		if (elfload)
 			printf("\tELF File         = %s\n", elfload);
-	} if (trace_file)
+	} if (trace_file) {
 		tb->opentrace(trace_file);
+		tb->trace_window(trace_start_ns * 1000ul,
+			(trace_stop_ns == -1ul) ? -1ul : trace_stop_ns * 1000ul);
+	}
+
+	signal(SIGINT,  stop_handler);
+	signal(SIGTERM, stop_handler);
 
 	if (profile_file) {
 #ifdef	INCLUDE_ZIPCPU
@@ -137,12 +240,18 @@ int	main(int argc, char **argv) {
 		profile_fp = NULL;
 
 
-	tb->reset();
+	if (restore_file) {
+		// The checkpoint already holds the design, flash and all, in
+		// whatever state it was in, so there's nothing to reset or load
+		tb->restore_checkpoint(restore_file);
+	} else {
+		tb->reset();
 #ifdef	SDSPI_ACCESS
-	tb->setsdcard(sdimage_file);
+		tb->setsdcard(sdimage_file);
 #endif
+	}
 
-	if (elfload) {
+	if ((elfload)&&(!restore_file)) {
 #ifdef	INCLUDE_ZIPCPU
 #elif	defined(INCLUDE_PICORV)
 #else // No CPU
@@ -163,6 +272,7 @@ int	main(int argc, char **argv) {
 
 		tb->m_core->cpu_cmd_halt = 0;
 		tb->m_core->cpu_reset    = 0;
+		tb->m_changed = true;
 		tb->tick();
 
 		tb->m_core->cpu_ipc = entry;
@@ -177,21 +287,23 @@ int	main(int argc, char **argv) {
 		tb->m_core->CPUVAR(_dbg_val) = entry;
 		tb->m_core->CPUVAR(_dbg_clear_pipe) = 1;
 	//
+		tb->m_changed = true;
 		tb->tick();
 		tb->m_core->cpu_cmd_halt = 0;
 		tb->m_core->VVAR(_swic__DOT__cmd_reset) = 0;
+		tb->m_changed = true;
 #endif
 	}
 
 #ifdef	INCLUDE_ZIPCPU
 	if (profile_fp) {
 		unsigned long	last_instruction_tick = 0, now = 0;
-		while((!willexit)||(!tb->done())) {
+		while((!gbl_stop)&&((!willexit)||(!tb->done()))) {
 			unsigned long	iticks;
 			unsigned	buf[2];
 
 			now++;
-			tb->tick();
+			tick(tb);
 
 			if (((tb->m_core->cpu_alu_pc_valid)
 					||(tb->m_core->cpu_mem_pc_valid))
@@ -208,11 +320,16 @@ int	main(int argc, char **argv) {
 	} else
 #endif
 	if (willexit) {
-		while(!tb->done())
-			tb->tick();
+		while((!gbl_stop)&&(!tb->done()))
+			tick(tb);
 	} else
-		while(true)
-			tb->tick();
+		while(!gbl_stop)
+			tick(tb);
+
+	// A checkpoint with no time given, or whose time never came, is
+	// written as the simulation ends
+	if (gbl_ckpt_file)
+		tb->save_checkpoint(gbl_ckpt_file);
 
 	tb->close();
 	delete tb;
@@ -0,0 +1,382 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename: 	batch_tb.cpp
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	Runs a batch of simulations, each of its own ELF program, on a
+//		pool of threads--so that a regression suite may use every core
+//	rather than just the one.
+//
+//	The jobs are listed in a file, one per line:
+//
+//		<elf-file> [pass=<text>] [fail=<text>] [timeout=<ns>]
+//			[shm=<name>] [in=<pcap>[:<ns>]] [out=<pcap>] [bypass]
+//
+//	Blank lines, and anything following a '#', are ignored.  Each job runs
+//	until its program halts the simulation, or until it times out.  It
+//	passes if its console never printed the fail text, and if it either
+//	printed the pass text or (with no pass text given) halted.
+//
+//	Every job's console goes to a log file of its own, and its debugging
+//	bus listens on ports of the O/S's choosing.  The log says which.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of  the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#include <signal.h>
+#include <time.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "verilated.h"
+#include "design.h"
+
+#include "testb.h"
+#include "port.h"
+
+// Verilator only allows separate models to be evaluated on separate threads
+// if they've been built for threading.  The Makefile only builds us with
+// THREADS set.
+#include "main_tb.cpp"
+
+// The default timeout: one simulated second
+#define	BATCH_TIMEOUT_NS	1000000000ul
+
+typedef	enum {
+	BATCH_PASS, BATCH_FAIL, BATCH_TIMEOUT, BATCH_ERROR, BATCH_STOPPED
+} BATCH_RESULT;
+
+static	const char	*result_name[] = {
+	"PASS", "FAIL", "TIMEOUT", "ERROR", "STOPPED"
+};
+
+typedef	struct	{
+	// The job, as described by its line in the job file
+	char		*m_elf, *m_pass, *m_fail, *m_shm, *m_replay, *m_capture;
+	unsigned long	m_timeout_ns, m_replay_ns;
+	bool		m_bypass;
+
+	// And how it went
+	char		m_logname[512];
+	BATCH_RESULT	m_result;
+	unsigned long	m_sim_ns;
+	double		m_wall_s;
+} BATCHJOB;
+
+static	BATCHJOB	*gbl_jobs = NULL;
+static	int		gbl_njobs = 0, gbl_next = 0;
+static	const char	*gbl_logdir = ".";
+static	volatile sig_atomic_t	gbl_stop = 0;
+// Reading ELF files isn't known to be thread safe, and reporting certainly
+// isn't
+static	pthread_mutex_t	gbl_elflock = PTHREAD_MUTEX_INITIALIZER,
+			gbl_rptlock = PTHREAD_MUTEX_INITIALIZER;
+
+static	void	stop_handler(int) {
+	gbl_stop = 1;
+}
+
+void	usage(void) {
+	fprintf(stderr, "USAGE: batch_tb <options> <job-file>\n");
+	fprintf(stderr,
+"\t-h\tPrints this usage statement\n"
+"\t-j <n>\tRuns up to <n> simulations at once.  The default is one per core.\n"
+"\t-l <dir>\n"
+"\t\tWrites each job's log into <dir>, rather than the current directory\n"
+"\t-t <ns>\tSets the timeout for jobs that don't give one of their own\n"
+"\n"
+"Each line of the job file names an ELF program, followed by any of:\n"
+"\tpass=<text>\tThe job passes only if its console prints <text>\n"
+"\tfail=<text>\tThe job fails if its console prints <text>\n"
+"\ttimeout=<ns>\tThe job fails if it hasn't halted after <ns> ns\n"
+"\tshm=<name>\tServes the debugging bus through shared memory\n"
+"\tin=<pcap>[:<ns>]\tReplays <pcap> into the network port\n"
+"\tout=<pcap>\tCaptures the network port's output to <pcap>\n"
+"\tbypass\t\tBypasses the debugging bus UART\n"
+);
+}
+
+static	char	*newstr(const char *str) {
+	char	*s = new char[strlen(str)+1];
+	strcpy(s, str);
+	return s;
+}
+
+// Reads the job file, filling gbl_jobs
+static	void	readjobs(const char *fname, const unsigned long timeout_ns) {
+	FILE	*fp;
+	char	line[1024];
+	int	nalloc = 16, lineno = 0;
+
+	if (NULL == (fp = fopen(fname, "r"))) {
+		fprintf(stderr, "ERR: Could not open %s\n", fname);
+		perror("O/S Err:");
+		exit(EXIT_FAILURE);
+	}
+
+	gbl_jobs = new BATCHJOB[nalloc];
+	while(fgets(line, sizeof(line), fp)) {
+		BATCHJOB	*job;
+		char		*tok, *ptr;
+
+		lineno++;
+		if ((ptr = strchr(line, '#')) != NULL)
+			*ptr = '\0';
+		if (NULL == (tok = strtok(line, " \t\n")))
+			continue;
+
+		if (gbl_njobs >= nalloc) {
+			BATCHJOB	*old = gbl_jobs;
+
+			gbl_jobs = new BATCHJOB[nalloc*2];
+			memcpy(gbl_jobs, old, nalloc * sizeof(BATCHJOB));
+			nalloc *= 2;
+			delete[] old;
+		}
+
+		job = &gbl_jobs[gbl_njobs];
+		memset(job, 0, sizeof(BATCHJOB));
+		job->m_elf = newstr(tok);
+		job->m_timeout_ns = timeout_ns;
+		if (!iself(job->m_elf)) {
+			fprintf(stderr, "ERR: %s:%d, %s is not an ELF file\n",
+				fname, lineno, job->m_elf);
+			exit(EXIT_FAILURE);
+		}
+
+		while(NULL != (tok = strtok(NULL, " \t\n"))) {
+			if (0 == strncmp(tok, "pass=", 5))
+				job->m_pass = newstr(tok+5);
+			else if (0 == strncmp(tok, "fail=", 5))
+				job->m_fail = newstr(tok+5);
+			else if (0 == strncmp(tok, "timeout=", 8))
+				job->m_timeout_ns = strtoul(tok+8, NULL, 0);
+			else if (0 == strncmp(tok, "shm=", 4))
+				job->m_shm = newstr(tok+4);
+			else if (0 == strncmp(tok, "in=", 3)) {
+				job->m_replay = newstr(tok+3);
+				if ((ptr = strrchr(job->m_replay, ':')) != NULL) {
+					*ptr++ = '\0';
+					job->m_replay_ns = strtoul(ptr, NULL, 0);
+				}
+			} else if (0 == strncmp(tok, "out=", 4))
+				job->m_capture = newstr(tok+4);
+			else if (0 == strcmp(tok, "bypass"))
+				job->m_bypass = true;
+			else {
+				fprintf(stderr, "ERR: %s:%d, unknown option %s\n",
+					fname, lineno, tok);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		gbl_njobs++;
+	} fclose(fp);
+}
+
+// Returns true if the file fname contains str
+static	bool	logcontains(const char *fname, const char *str) {
+	FILE	*fp;
+	char	*buf;
+	long	ln;
+	bool	found = false;
+
+	if (NULL == (fp = fopen(fname, "r")))
+		return false;
+	fseek(fp, 0, SEEK_END);
+	ln = ftell(fp);
+	rewind(fp);
+	buf = new char[ln+1];
+	ln = fread(buf, 1, ln, fp);
+	buf[ln] = '\0';
+	fclose(fp);
+
+	found = (strstr(buf, str) != NULL);
+	delete[] buf;
+	return found;
+}
+
+static	void	runjob(const int id, BATCHJOB *job) {
+	struct	timespec	start, stop;
+	const	char	*base;
+	MAINTB	*tb;
+	FILE	*logfp;
+	bool	halted;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	base = strrchr(job->m_elf, '/');
+	base = (base) ? base+1 : job->m_elf;
+	snprintf(job->m_logname, sizeof(job->m_logname), "%s/%03d-%s.log",
+		gbl_logdir, id, base);
+	if (NULL == (logfp = fopen(job->m_logname, "w"))) {
+		fprintf(stderr, "ERR: Could not open %s\n", job->m_logname);
+		perror("O/S Err:");
+		job->m_result = BATCH_ERROR;
+		return;
+	}
+
+	tb = new MAINTB(0, logfp);
+	if (job->m_bypass)
+		tb->m_wbu->bypass();
+	if (job->m_shm)
+		tb->m_wbu->shm(job->m_shm);
+	if (job->m_replay)
+		tb->m_net1->replay(job->m_replay, job->m_replay_ns * 1000ul);
+	if (job->m_capture)
+		tb->m_net1->capture(job->m_capture);
+
+	tb->reset();
+
+#ifdef	INCLUDE_PICORV
+	pthread_mutex_lock(&gbl_elflock);
+	tb->loadelf(job->m_elf);
+	pthread_mutex_unlock(&gbl_elflock);
+#else
+	fprintf(logfp, "ERR: batch_tb can only boot PicoRV designs\n");
+	job->m_result = BATCH_ERROR;
+	delete tb;
+	fclose(logfp);
+	return;
+#endif
+
+	while((!gbl_stop)&&(!tb->done())
+			&&(tb->m_time_ps / 1000ul < job->m_timeout_ns))
+		tb->tick();
+
+	halted = tb->done();
+	job->m_sim_ns = tb->m_time_ps / 1000ul;
+	tb->close();
+	// Deleting the test bench flushes the rest of the console to the log
+	delete tb;
+	fclose(logfp);
+
+	if ((job->m_fail)&&(logcontains(job->m_logname, job->m_fail)))
+		job->m_result = BATCH_FAIL;
+	else if (job->m_pass)
+		job->m_result = (logcontains(job->m_logname, job->m_pass))
+			? BATCH_PASS : (halted) ? BATCH_FAIL
+			: (gbl_stop) ? BATCH_STOPPED : BATCH_TIMEOUT;
+	else
+		job->m_result = (halted) ? BATCH_PASS
+			: (gbl_stop) ? BATCH_STOPPED : BATCH_TIMEOUT;
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	job->m_wall_s = (stop.tv_sec - start.tv_sec)
+			+ (stop.tv_nsec - start.tv_nsec) * 1e-9;
+
+	pthread_mutex_lock(&gbl_rptlock);
+	printf("%-8s %-32s %12.3f ms simulated in %8.2f s\n",
+		result_name[job->m_result], job->m_elf,
+		job->m_sim_ns * 1e-6, job->m_wall_s);
+	fflush(stdout);
+	pthread_mutex_unlock(&gbl_rptlock);
+}
+
+static	void	*worker(void *) {
+	int	k;
+
+	while((!gbl_stop)&&((k = __atomic_fetch_add(&gbl_next, 1,
+					__ATOMIC_RELAXED)) < gbl_njobs))
+		runjob(k, &gbl_jobs[k]);
+
+	return NULL;
+}
+
+int	main(int argc, char **argv) {
+	Verilated::commandArgs(argc, argv);
+
+	const	char	*jobfile = NULL;
+	unsigned long	timeout_ns = BATCH_TIMEOUT_NS;
+	int		nthreads = sysconf(_SC_NPROCESSORS_ONLN), npass = 0;
+	pthread_t	*threads;
+
+	for(int argn=1; argn < argc; argn++) {
+		if (argv[argn][0] == '-') for(int j=1;
+					(j<512)&&(argv[argn][j]);j++) {
+			switch(tolower(argv[argn][j])) {
+			case 'j': nthreads = atoi(argv[++argn]); j=1000; break;
+			case 'l': gbl_logdir = argv[++argn]; j=1000; break;
+			case 't': timeout_ns = strtoul(argv[++argn], NULL, 0);
+				j=1000; break;
+			case 'h': usage(); exit(0); break;
+			default:
+				fprintf(stderr, "ERR: Unexpected flag, -%c\n\n",
+					argv[argn][j]);
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		} else
+			jobfile = argv[argn];
+	}
+
+	if (jobfile == NULL) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	readjobs(jobfile, timeout_ns);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > gbl_njobs)
+		nthreads = gbl_njobs;
+
+	signal(SIGINT,  stop_handler);
+	signal(SIGTERM, stop_handler);
+
+	threads = new pthread_t[nthreads];
+	for(int k=0; k<nthreads; k++) {
+		if (pthread_create(&threads[k], NULL, worker, NULL) != 0) {
+			fprintf(stderr, "ERR: Could not start thread %d\n", k);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for(int k=0; k<nthreads; k++)
+		pthread_join(threads[k], NULL);
+	delete[] threads;
+
+	for(int k=0; k<gbl_njobs; k++)
+		if ((k < gbl_next)&&(gbl_jobs[k].m_result == BATCH_PASS))
+			npass++;
+	printf("\n%d of %d jobs passed\n", npass, gbl_njobs);
+	for(int k=0; k<gbl_njobs; k++) {
+		if ((k < gbl_next)&&(gbl_jobs[k].m_result == BATCH_PASS))
+			continue;
+		printf("\t%-8s %s (see %s)\n", (k < gbl_next)
+				? result_name[gbl_jobs[k].m_result] : "NOT-RUN",
+			gbl_jobs[k].m_elf, gbl_jobs[k].m_logname);
+	}
+
+	return (npass == gbl_njobs) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
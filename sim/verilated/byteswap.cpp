@@ -39,6 +39,10 @@
 //
 //
 #include <stdint.h>
+#include <string.h>
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
 #include "byteswap.h"
 
 /*
@@ -48,17 +52,7 @@
  */
 uint32_t
 byteswap(uint32_t v) {
-	uint32_t	r = 0;
-
-	r = (v & 0x0ff);
-	r <<= 8; v >>= 8;
-	r |= (v & 0x0ff);
-	r <<= 8; v >>= 8;
-	r |= (v & 0x0ff);
-	r <<= 8; v >>= 8;
-	r |= (v & 0x0ff);
-
-	return r;
+	return __builtin_bswap32(v);
 }
 
 
@@ -69,8 +63,46 @@ byteswap(uint32_t v) {
  */
 void
 byteswapbuf(int ln, uint32_t *buf) {
-	for(int i=0; i<ln; i++)
-		buf[i] = byteswap(buf[i]);
+	byteswapcpy((char *)buf, (const char *)buf, ln * sizeof(uint32_t));
+}
+
+/*
+ * byteswapcpy
+ *
+ * Copy and swap in one pass.  Where SSE2 is available (any x86-64), swap
+ * sixteen bytes at a time: first the bytes within each 16-bit half word, then
+ * the two halves of each word.
+ */
+void
+byteswapcpy(char *dst, const char *src, int nbytes) {
+	int	nw = nbytes >> 2, i = 0;
+
+#ifdef	__SSE2__
+	for(; i+4 <= nw; i+=4) {
+		__m128i	v = _mm_loadu_si128((const __m128i *)&src[4*i]);
+
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2,3,0,1));
+		_mm_storeu_si128((__m128i *)&dst[4*i], v);
+	}
+#endif
+
+	for(; i<nw; i++) {
+		uint32_t	v;
+
+		memcpy(&v, &src[4*i], sizeof(v));
+		v = byteswap(v);
+		memcpy(&dst[4*i], &v, sizeof(v));
+	}
+
+	if (nbytes & 3) {
+		uint32_t	v = 0;
+
+		memcpy(&v, &src[4*nw], nbytes & 3);
+		v = byteswap(v);
+		memcpy(&dst[4*nw], &v, sizeof(v));
+	}
 }
 
 /*
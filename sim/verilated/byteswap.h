@@ -43,6 +43,7 @@
 #define	BYTESWAP_H
 
 #include <stdint.h>
+#include <string.h>
 
 /*
  * The byte swapping routines below are designed to support conversions from a little endian
@@ -65,9 +66,20 @@ byteswap(uint32_t v);
  */
 extern	void	byteswapbuf(int ln, uint32_t *buf);
 
+/*
+ * byteswapcpy
+ *
+ * Copies nbytes from src to dst, swapping the byte order of every 32-bit word
+ * along the way, in a single pass.  Neither pointer needs to be aligned.  Any
+ * final partial word is padded with zeros, so dst must have room for nbytes
+ * rounded up to a multiple of four.  src and dst may be the same.
+ */
+extern	void	byteswapcpy(char *dst, const char *src, int nbytes);
+
 #else
 #define	byteswap(A)		 (A)
 #define	byteswapbuf(A, B)
+#define	byteswapcpy(D, S, N)	memmove((D), (S), (N))
 #endif
 
 /*
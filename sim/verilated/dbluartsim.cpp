@@ -50,17 +50,28 @@
 #include <signal.h>
 #include <ctype.h>
 #include <assert.h>
+#include <time.h>
+#include <sched.h>
+#include <verilated_save.h>
 
 #include "dbluartsim.h"
 
+// Returns the port a listening socket is bound to
+int	DBLUARTSIM::sktport(const int skt) {
+	struct	sockaddr_in	addr;
+	socklen_t		ln = sizeof(addr);
+
+	if ((skt < 0)||(getsockname(skt, (struct sockaddr *)&addr, &ln) != 0))
+		return -1;
+	return ntohs(addr.sin_port);
+}
+
 int	DBLUARTSIM::setup_listener(const int port) {
 	struct	sockaddr_in	my_addr;
 	int	skt;
 
 	signal(SIGPIPE, SIG_IGN);
 
-	if (m_debug) printf("Listening on port %d\n", port);
-
 	skt = socket(AF_INET, SOCK_STREAM, 0);
 	if (skt < 0) {
 		perror("ERR: Could not allocate socket: ");
@@ -89,6 +100,9 @@ int	DBLUARTSIM::setup_listener(const int port) {
 		exit(EXIT_FAILURE);
 	}
 
+	// Given port zero, the O/S will have picked a free port for us
+	if (m_debug) fprintf(m_log, "Listening on port %d\n", sktport(skt));
+
 	if (listen(skt, 1) != 0) {
 		perror("ERR: Listen failed:");
 		exit(EXIT_FAILURE);
@@ -97,12 +111,12 @@ int	DBLUARTSIM::setup_listener(const int port) {
 	return skt;
 }
 
-DBLUARTSIM::DBLUARTSIM(const int port, const bool copy_to_stdout)
-		: m_copy(copy_to_stdout) {
+DBLUARTSIM::DBLUARTSIM(const int port, const bool copy_to_stdout, FILE *log)
+		: m_copy(copy_to_stdout), m_log(log) {
 	m_debug = true;
 	m_con = m_cmd = -1;
 	m_skt = setup_listener(port);
-	m_console = setup_listener(port+1);
+	m_console = setup_listener((port) ? port+1 : 0);
 	m_rxpos = m_cmdpos = m_conpos = m_ilen = 0;
 	m_started_flag = false;
 	setup(25);	// Set us up for (default) 8N1 w/ a baud rate of CLK/25
@@ -111,21 +125,62 @@ DBLUARTSIM::DBLUARTSIM(const int port, const bool copy_to_stdout)
 	m_rx_state = RXIDLE;
 	m_tx_state = TXIDLE;
 	m_cllen = 0;
+	m_shm = NULL;
+	m_bypass = false;
+	m_gap = 10; m_gapctr = 0;
+
+	m_fromnet = new SHMRING;
+	m_tocmd   = new SHMRING;
+	m_tocon   = new SHMRING;
+	memset(m_fromnet, 0, sizeof(SHMRING));
+	memset(m_tocmd,   0, sizeof(SHMRING));
+	memset(m_tocon,   0, sizeof(SHMRING));
+
+	m_stop = false;
+	if (pthread_create(&m_thread, NULL, iothread, this) != 0) {
+		fprintf(stderr, "ERR: Could not start the UART I/O thread\n");
+		exit(EXIT_FAILURE);
+	}
+	m_running = true;
 }
 
 DBLUARTSIM::~DBLUARTSIM(void) {
 	flushrx();
-	printf("\n");
+	stopio();
+	if (m_conpos > 0) {
+		m_conbuf[m_conpos] = '\0';
+		fprintf(m_log, "%s", m_conbuf);
+	}
+	fprintf(m_log, "\n");
+	if (m_shm)
+		delete m_shm;
+	delete m_fromnet;
+	delete m_tocmd;
+	delete m_tocon;
+}
+
+void	DBLUARTSIM::shm(const char *name) {
+	if (m_shm)
+		delete m_shm;
+	m_shm = new SHMBUSSIM(name);
+}
+
+void	DBLUARTSIM::stopio(void) {
+	if (!m_running)
+		return;
+	__atomic_store_n(&m_stop, true, __ATOMIC_RELEASE);
+	pthread_join(m_thread, NULL);
+	m_running = false;
 }
 
 void	DBLUARTSIM::kill(void) {
+	// Stop the I/O thread, once it has sent everything it has
+	stopio();
+
 	// Close any active connection
 	if (m_con >= 0)	    {
 		const	char	*SIM_CLOSED = "\n[SIM] Connection-Closed\n";
 		int	nr, nw;
-		if (m_conpos > 0) {
-			nw = send(m_con,m_conbuf, m_conpos, 0);
-		}
 		nw = write(m_con, SIM_CLOSED, strlen(SIM_CLOSED));
 		if (nw > 0) {
 			shutdown(m_con, SHUT_WR);
@@ -142,8 +197,6 @@ void	DBLUARTSIM::kill(void) {
 	if (m_console >= 0) close(m_console);
 	if (m_cmd >= 0) {
 		int	nr = 0;
-		if (m_cmdpos > 0)
-			nr = send(m_cmd,m_cmdbuf, m_cmdpos, 0);
 		shutdown(m_cmd, SHUT_WR);
 		do {
 			char	buf[512];
@@ -172,183 +225,294 @@ void	DBLUARTSIM::setup(unsigned isetup) {
 	}
 }
 
-void	DBLUARTSIM::poll_accept(void) {
-	struct	pollfd	pb[2];
-	int	npb = 0;
-
-	// Check if we need to accept any connections
-	if (m_cmd < 0) {
-		pb[npb].fd = m_skt;
-		pb[npb].events = POLLIN;
-		npb++;
-	}
+void	*DBLUARTSIM::iothread(void *dbl) {
+	((DBLUARTSIM *)dbl)->iorun();
+	return NULL;
+}
 
-	if (m_con < 0) {
-		pb[npb].fd = m_console;
-		pb[npb].events = POLLIN;
-		npb++;
+void	DBLUARTSIM::iorun(void) {
+	while(!__atomic_load_n(&m_stop, __ATOMIC_ACQUIRE)) {
+		poll_io();
+		drain_cmd();
+		drain_con();
 	}
 
-	if (npb > 0) {
-		int	pr;
-		pr = poll(pb, npb, 0);
+	// Send whatever the simulation left behind
+	drain_cmd();
+	drain_con();
+}
 
-		assert(pr >= 0);
+// Sends all of buf, returning false if the connection has failed
+static	bool	sendall(int fd, const char *buf, int len) {
+	int	nw = 0;
 
-		if (pr > 0) for(int k=0; k<npb; k++) {
-			if ((pb[k].revents & POLLIN)==0) {
-				// printf("Not #%d\n", k);
-				continue;
-			}
-			if (pb[k].fd == m_skt) {
-				m_cmd = accept(m_skt, 0, 0);
-
-				if (m_cmd < 0)
-					perror("CMD Accept failed:");
-				else printf("Accepted CMD connection\n");
-			} else if (pb[k].fd == m_console) {
-				m_con = accept(m_console, 0, 0);
-				if (m_con < 0)
-					perror("CON Accept failed:");
-				else printf("Accepted CON connection\n");
-			}
-		}
+	while(nw < len) {
+		int	snt = send(fd, &buf[nw], len-nw, 0);
+		if (snt <= 0)
+			return false;
+		nw += snt;
 	}
 
-	// End of trying to accept more connections
+	return true;
 }
 
-void	DBLUARTSIM::poll_read(void) {
-	struct	pollfd	pb[2];
-	int		npb = 0, r;
-
-	if (m_cmd >= 0) {
-		pb[npb].fd = m_cmd;
+// Accept any new connections, and read anything that's arrived from the
+// existing ones into m_fromnet.  If nothing happens, this will wait for up to
+// DBLIOWAIT_NS before returning.
+void	DBLUARTSIM::poll_io(void) {
+	struct	pollfd	pb[4];
+	struct	timespec	waitfor;
+	int	npb = 0, pr;
+	unsigned	room;
+
+	// Check if we need to accept any connections.  There's no need for
+	// a command connection if the bus is on shared memory.
+	if ((m_cmd < 0)&&(!m_shm)&&(m_skt >= 0)) {
+		pb[npb].fd = m_skt;
 		pb[npb].events = POLLIN;
 		npb++;
-	} if (m_con >= 0) {
-		pb[npb].fd = m_con;
+	}
+
+	if ((m_con < 0)&&(m_console >= 0)) {
+		pb[npb].fd = m_console;
 		pb[npb].events = POLLIN;
 		npb++;
 	}
 
-	if (npb == 0)
-		return;
+	// Only read from the connections if there's room for what we read
+	room = shmring_free(m_fromnet);
+	if (room > 0) {
+		if (m_cmd >= 0) {
+			pb[npb].fd = m_cmd;
+			pb[npb].events = POLLIN;
+			npb++;
+		} if (m_con >= 0) {
+			pb[npb].fd = m_con;
+			pb[npb].events = POLLIN;
+			npb++;
+		}
+	}
 
-	r = poll(pb, npb, 0);
-	if (r < 0)
+	waitfor.tv_sec  = 0;
+	waitfor.tv_nsec = DBLIOWAIT_NS;
+	pr = ppoll(pb, npb, &waitfor, NULL);
+	if (pr < 0) {
 		perror("Polling error:");
-	else if (r == 0)
+		return;
+	} else if (pr == 0)
 		return;
 
-	// printf("POLL = %d\n", r);
-	for(int i=0; i<npb; i++) {
-		if (pb[i].revents & POLLIN) {
-			int	nr;
-			nr =recv(pb[i].fd, &m_rxbuf[m_ilen],
-					sizeof(m_rxbuf)-m_ilen,
-					MSG_DONTWAIT);
+	for(int k=0; k<npb; k++) {
+		if ((pb[k].revents & (POLLIN|POLLHUP|POLLERR))==0)
+			continue;
+		if (pb[k].fd == m_skt) {
+			m_cmd = accept(m_skt, 0, 0);
+
+			if (m_cmd < 0)
+				perror("CMD Accept failed:");
+			else fprintf(m_log, "Accepted CMD connection\n");
+		} else if (pb[k].fd == m_console) {
+			m_con = accept(m_console, 0, 0);
+			if (m_con < 0)
+				perror("CON Accept failed:");
+			else fprintf(m_log, "Accepted CON connection\n");
+		} else {
+			char	buf[DBLPIPEBUFLEN];
+			int	nr, ln = sizeof(buf);
 
-			if (pb[i].fd == m_cmd) {
+			room = shmring_free(m_fromnet);
+			if (ln > (int)room)
+				ln = room;
+			if (ln == 0)
+				break;
+			nr = recv(pb[k].fd, buf, ln, MSG_DONTWAIT);
+
+			if (pb[k].fd == m_cmd) {
 				for(int j=0; j<nr; j++) {
-					m_cmdline[m_cllen] = m_rxbuf[j+m_ilen];
+					m_cmdline[m_cllen] = buf[j];
 					if (m_cmdline[m_cllen] != '\r') {
 						if (m_cmdline[m_cllen] == '\n'){
 							m_cmdline[m_cllen]='\0';
-							printf("< %s\n", m_cmdline);
+							fprintf(m_log, "< %s\n",
+								m_cmdline);
 							m_cllen=0;
 						} else
 							m_cllen++;
 					} if (m_cllen >= 64) {
 						m_cmdline[m_cllen+1] = '\0';
-						printf("< %s\n", m_cmdline);
+						fprintf(m_log, "< %s\n", m_cmdline);
 						m_cllen = 0;
 					}
 					
-					m_rxbuf[j+m_ilen] |= 0x80;
+					buf[j] |= 0x80;
 				} m_cmdline[m_cllen] = '\0';
 
 
 				if (nr <= 0) {
 					m_cmdline[m_cllen] = '\0';
-					printf("< %s [CLOSED]\n", m_cmdline);
+					fprintf(m_log, "< %s [CLOSED]\n", m_cmdline);
 					m_cllen = 0;
 				}
 			} if (nr > 0) {
-				m_ilen += nr;
-				if (m_ilen == sizeof(m_rxbuf))
-					break;
-			} else if (nr <= 0) {
-				close(pb[i].fd);
-				if (pb[i].fd == m_cmd)
+				shmring_write(m_fromnet, buf, nr);
+			} else {
+				close(pb[k].fd);
+				if (pb[k].fd == m_cmd)
 					m_cmd = -1;
-				else // if (pb[i].fd == m_con)
+				else // if (pb[k].fd == m_con)
 					m_con = -1;
 			}
 		}
-	} m_rxpos = 0;
+	}
 }
 
-void	DBLUARTSIM::flushrx(void) {
-	int	snt = 0;
+// Send everything headed to the command port, in as few calls as we can
+void	DBLUARTSIM::drain_cmd(void) {
+	int	ln;
 
-	// Nothing to send
-	if (m_cmdpos == 0)
+	ln = shmring_read(m_tocmd, m_iobuf, sizeof(m_iobuf));
+	if (ln == 0)
 		return;
 
-	if (m_cmd >= 0)
-		// Network port
-		snt = send(m_cmd,m_cmdbuf, m_cmdpos, 0);
-	else
-		snt = m_cmdpos;
-	if (snt < 0) {
-		printf("Closing CMD socket\n");
+	if ((m_cmd >= 0)&&(!sendall(m_cmd, m_iobuf, ln))) {
+		fprintf(m_log, "Closing CMD socket\n");
 		close(m_cmd);
 		m_cmd = -1;
-		snt = 0;
-	} // else printf("%d/%d bytes returned\n", snt, m_cmdpos);
-	m_cmdbuf[m_cmdpos] = '\0';
-	if (m_copy) printf("> %s", m_cmdbuf);
-	if (snt < m_cmdpos) {
-		fprintf(stderr, "CMD: Only sent %d bytes of %d!\n",
-			snt, m_cmdpos);
 	}
-	m_cmdpos = 0;
+
+	if (!m_copy)
+		return;
+	for(int k=0; k<ln; k++) {
+		m_cmdbuf[m_cmdpos++] = m_iobuf[k];
+		if ((m_iobuf[k] == '\n')||(m_cmdpos >= DBLPIPEBUFLEN-2)) {
+			m_cmdbuf[m_cmdpos] = '\0';
+			fprintf(m_log, "> %s", m_cmdbuf);
+			m_cmdpos = 0;
+		}
+	}
+}
+
+// Send everything headed to the console, or print it if there's no one
+// connected
+void	DBLUARTSIM::drain_con(void) {
+	int	ln;
+
+	ln = shmring_read(m_tocon, m_iobuf, sizeof(m_iobuf));
+	if (ln == 0)
+		return;
+
+	if (m_con >= 0) {
+		if (sendall(m_con, m_iobuf, ln))
+			return;
+		fprintf(m_log, "Closing CONsole socket\n");
+		close(m_con);
+		m_con = -1;
+	}
+
+	for(int k=0; k<ln; k++) {
+		m_conbuf[m_conpos++] = m_iobuf[k];
+		if ((m_iobuf[k] == '\n')||(m_conpos >= DBLPIPEBUFLEN-2)) {
+			m_conbuf[m_conpos] = '\0';
+			fprintf(m_log, "%s", m_conbuf);
+			m_conpos = 0;
+		}
+	}
+}
+
+void	DBLUARTSIM::flushrx(void) {
+	// The I/O thread empties both rings.  Wait for it.
+	while((m_running)&&((shmring_free(m_tocmd) < SHMRINGLN)
+				||(shmring_free(m_tocon) < SHMRINGLN)))
+		sched_yield();
+}
+
+void	DBLUARTSIM::save(VerilatedSerialize &os) {
+	// Anything the design has sent should go out before the checkpoint
+	flushrx();
+
+	os.write(&m_setup, sizeof(m_setup));
+	os.write(&m_nparity, sizeof(m_nparity));
+	os.write(&m_fixdp, sizeof(m_fixdp));
+	os.write(&m_evenp, sizeof(m_evenp));
+	os.write(&m_nbits, sizeof(m_nbits));
+	os.write(&m_nstop, sizeof(m_nstop));
+	os.write(&m_baud_counts, sizeof(m_baud_counts));
+	os.write(&m_rx_baudcounter, sizeof(m_rx_baudcounter));
+	os.write(&m_rx_state, sizeof(m_rx_state));
+	os.write(&m_rx_busy, sizeof(m_rx_busy));
+	os.write(&m_rx_changectr, sizeof(m_rx_changectr));
+	os.write(&m_last_tx, sizeof(m_last_tx));
+	os.write(&m_tx_baudcounter, sizeof(m_tx_baudcounter));
+	os.write(&m_tx_state, sizeof(m_tx_state));
+	os.write(&m_tx_busy, sizeof(m_tx_busy));
+	os.write(&m_rx_data, sizeof(m_rx_data));
+	os.write(&m_tx_data, sizeof(m_tx_data));
+	os.write(&m_gapctr, sizeof(m_gapctr));
+	os.write(&m_ilen, sizeof(m_ilen));
+	if (m_ilen > 0)
+		os.write(&m_rxbuf[m_rxpos], m_ilen);
+}
+
+void	DBLUARTSIM::restore(VerilatedDeserialize &is) {
+	is.read(&m_setup, sizeof(m_setup));
+	is.read(&m_nparity, sizeof(m_nparity));
+	is.read(&m_fixdp, sizeof(m_fixdp));
+	is.read(&m_evenp, sizeof(m_evenp));
+	is.read(&m_nbits, sizeof(m_nbits));
+	is.read(&m_nstop, sizeof(m_nstop));
+	is.read(&m_baud_counts, sizeof(m_baud_counts));
+	is.read(&m_rx_baudcounter, sizeof(m_rx_baudcounter));
+	is.read(&m_rx_state, sizeof(m_rx_state));
+	is.read(&m_rx_busy, sizeof(m_rx_busy));
+	is.read(&m_rx_changectr, sizeof(m_rx_changectr));
+	is.read(&m_last_tx, sizeof(m_last_tx));
+	is.read(&m_tx_baudcounter, sizeof(m_tx_baudcounter));
+	is.read(&m_tx_state, sizeof(m_tx_state));
+	is.read(&m_tx_busy, sizeof(m_tx_busy));
+	is.read(&m_rx_data, sizeof(m_rx_data));
+	is.read(&m_tx_data, sizeof(m_tx_data));
+	is.read(&m_gapctr, sizeof(m_gapctr));
+	is.read(&m_ilen, sizeof(m_ilen));
+	m_rxpos = 0;
+	if (m_ilen > 0)
+		is.read(m_rxbuf, m_ilen);
+}
+
+void	DBLUARTSIM::push(SHMRING *r, const char ch) {
+	if (!m_running)
+		return;
+
+	// Should the I/O thread fall this far behind, wait for it rather
+	// than drop anything
+	while(shmring_free(r) == 0)
+		sched_yield();
+	shmring_write(r, &ch, 1);
 }
 
 void	DBLUARTSIM::received(const char ch) {
-	if (ch & 0x80) {
-		m_cmdbuf[m_cmdpos++] = ch & 0x7f;
+	if ((ch & 0x80)&&(m_shm)) {
+		m_shm->tx(ch & 0x7f);
+	} else if (ch & 0x80) {
+		push(m_tocmd, ch & 0x7f);
 	} else
-		m_conbuf[m_conpos++] = ch & 0x7f;
-	if ((m_cmdpos>0)&&((m_cmdbuf[m_cmdpos-1] == '\n')
-				||(m_cmdpos >= DBLPIPEBUFLEN-2)))
-		flushrx();
-
-	if ((m_con >= 0)&&(m_conpos > 0)) {
-		int	snt = 0;
-		snt = send(m_con, &m_conbuf[m_conpos-1], 1, 0);
-		if (snt < 0) {
-			printf("Closing CONsole socket\n");
-			close(m_con);
-			m_con = -1;
-			snt = 0;
-		} if (snt < 1) {
-			fprintf(stderr, "CON: no bytes sent!\n");
-		} m_conpos = 0;
-	} if ((m_conpos>0)&&((m_conbuf[m_conpos-1] == '\n')
-				||(m_conpos >= DBLPIPEBUFLEN-2))) {
-		m_conbuf[m_conpos] = '\0';
-		printf("%s", m_conbuf);
-		m_conpos = 0;
-	}
+		push(m_tocon, ch & 0x7f);
 }
 
 int	DBLUARTSIM::next(void) {
-	// If our transmit buffer is empty, see if we can
-	// fill it.
-	if (m_ilen == 0)
-		poll_read();
+	// Bus characters from shared memory come first.  Mark them as bus
+	// characters, just as poll_io() does for those from the network.
+	if ((m_shm)&&(m_ilen == 0)) {
+		int	ch = m_shm->rx();
+		if (ch >= 0)
+			return (ch | 0x80) & 0x0ff;
+	}
+
+	// If our transmit buffer is empty, see if the I/O thread has anything
+	// more for us
+	if (m_ilen == 0) {
+		m_ilen = shmring_read(m_fromnet, m_rxbuf, sizeof(m_rxbuf));
+		m_rxpos = 0;
+	}
 	if (m_ilen <= 0)
 		return -1;
 
@@ -359,11 +523,17 @@ int	DBLUARTSIM::next(void) {
 	return nval & 0x0ff;
 }
 
+int	DBLUARTSIM::bypass_tick(void) {
+	if (++m_gapctr < m_gap)
+		return -1;
+	m_gapctr = 0;
+
+	return next();
+}
+
 int	DBLUARTSIM::tick(int i_tx) {
 	int	o_rx = 1;
 
-	poll_accept();
-
 	if ((!i_tx)&&(m_last_tx))
 		m_rx_changectr = 0;
 	else	m_rx_changectr++;
@@ -10,6 +10,12 @@
 //	This file provides the description of the interface between the UARTSIM
 //	and the rest of the world.  See below for more detailed descriptions.
 //
+//	All of the socket work--accepting connections, reading, writing, and
+//	printing to the terminal--takes place in a separate I/O thread.  That
+//	thread trades characters with the simulation through three single
+//	producer, single consumer rings (SHMRINGs, from shmbus.h), so nothing
+//	called from tick() ever needs to make a system call.
+//
 // Creator:	Dan Gisselquist, Ph.D.
 //		Gisselquist Technology, LLC
 //
@@ -51,8 +57,10 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "port.h"
+#include "shmbussim.h"
 
 #define	TXIDLE	0
 #define	TXDATA	1
@@ -60,25 +68,38 @@
 #define	RXDATA	1
 
 #define	DBLPIPEBUFLEN	256
+// How long the I/O thread waits for the network, in nanoseconds, before
+// checking whether the simulation has anything for it to send
+#define	DBLIOWAIT_NS	100000
+
+class	VerilatedSerialize;
+class	VerilatedDeserialize;
 
 class	DBLUARTSIM	{
 	bool	m_debug;
 
 	int	setup_listener(const int port);
+	static	int	sktport(const int skt);
 public:
-	// The file descriptors:
+	// The file descriptors.  These belong to the I/O thread.
 	int	m_skt,	// Commands come in on this socket
 		m_console, // Console port comes in/out on this socket
 		m_cmd,	// Connection to the command port FD
 		m_con;	// Connection to the console port FD
+	// Characters headed to and from the network.  The I/O thread uses
+	// m_conbuf and m_cmdbuf to collect lines for printing, and m_iobuf
+	// to batch whatever it sends.  The simulation reads from m_rxbuf.
 	char	m_conbuf[DBLPIPEBUFLEN],
 		m_cmdbuf[DBLPIPEBUFLEN],
 		m_rxbuf[DBLPIPEBUFLEN],
 		m_cmdline[DBLPIPEBUFLEN],
+		m_iobuf[SHMRINGLN],
 		m_intransit_data;
 	int	m_ilen, m_rxpos, m_cmdpos, m_conpos, m_cllen;
 	bool	m_started_flag;
 	bool	m_copy;
+	// Where the console, and everything else we have to say, is printed
+	FILE	*m_log;
 	//
 	// The m_setup register is the 29'bit control register used within
 	// the core.
@@ -91,21 +112,55 @@ public:
 	int	m_tx_baudcounter, m_tx_state, m_tx_busy;
 	unsigned	m_rx_data, m_tx_data;
 
-	void	poll_accept(void);
-	void	poll_read(void);
+	// If set, bus traffic goes through shared memory rather than m_cmd
+	SHMBUSSIM	*m_shm;
+	// UART bypass: whole characters, no more than one every m_gap clocks
+	bool	m_bypass;
+	int	m_gap, m_gapctr;
+
+	// The rings between the simulation and the I/O thread.  m_fromnet
+	// carries characters from both connections, with the high bit set on
+	// those from the command port, into the simulation.  m_tocmd and
+	// m_tocon carry characters back out.
+	SHMRING		*m_fromnet, *m_tocmd, *m_tocon;
+	pthread_t	m_thread;
+	bool		m_running, m_stop;
+
+	static	void	*iothread(void *dbl);
+	void	iorun(void);
+	void	stopio(void);
+	void	poll_io(void);
+	void	drain_cmd(void);
+	void	drain_con(void);
+	// Pushes a character into one of the outgoing rings, waiting for the
+	// I/O thread if it's full
+	void	push(SHMRING *r, const char ch);
 public:
 	// The DBLUARTSIM constructor takes one argument: the base port on the
 	// localhost to listen in on.  Once started, connections may be made
-	// to this port to get the output from the port.
-	DBLUARTSIM(const int port = FPGAPORT, const bool copy_to_stdout=true);
+	// to this port to get the output from the port.  Given a port of zero,
+	// the command and console ports are each chosen by the O/S instead,
+	// and may then be found from cmdport() and conport().  Anything that
+	// isn't sent to a connection is printed to log.
+	DBLUARTSIM(const int port = FPGAPORT, const bool copy_to_stdout=true,
+			FILE *log = stdout);
+	int	cmdport(void) const { return sktport(m_skt); }
+	int	conport(void) const { return sktport(m_console); }
 	~DBLUARTSIM(void);
 	// kill() closes any active connection and the socket.  Once killed,
 	// no further output will be sent to the port.
 	virtual	void	kill(void);
 
-	// Send anything remaining in the buffer
+	// Wait for anything the simulation has produced to be sent
 	virtual	void	flushrx(void);
 
+	// Checkpoint support.  The UART's state is captured, together with
+	// any characters already taken from the network but not yet given to
+	// the design.  The connections themselves are not: whatever client
+	// was attached must reconnect to the restored simulation.
+	void	save(VerilatedSerialize &os);
+	void	restore(VerilatedDeserialize &is);
+
 	// The operator() function is called on every tick.  The input is the
 	// the output txuart transmit wire from the device.  The output is to
 	// be connected to the the rxuart receive wire into the device.  This
@@ -135,6 +190,31 @@ public:
 	// your more traditional file descriptors, and use them as such.
 	int	tick(const int i_tx);
 
+	// Use a block of shared memory, rather than the network command port,
+	// for the bus.  The console remains on its network port.  Call this
+	// before the simulation starts.
+	void	shm(const char *name);
+
+	// Skip the UART bit timing entirely, and exchange whole characters
+	// with the design instead--as if the UART ran at one clock per baud
+	// (gap=10).  The design must have been built with its simulation
+	// bypass ports (i_wbu_sim_*, o_wbu_sim_*).  Once bypassed, call
+	// bypass_tick() on every clock rather than tick().
+	void	bypass(const int gap = 10) { m_bypass = true; m_gap = gap; }
+	bool	bypassed(void) const { return m_bypass; }
+
+	// Returns true if we can't accept another character from the design
+	bool	busy(void) {
+		if (m_shm)
+			return m_shm->full();
+		return (shmring_free(m_tocmd) == 0)
+			||(shmring_free(m_tocon) == 0);
+	}
+
+	// Returns the next character for the design, or -1 if there's none
+	// (yet).  Characters from the design go to received(), as always.
+	int	bypass_tick(void);
+
 	// Having just received a character, report it as received
 	void	received(const char ch);
 	//
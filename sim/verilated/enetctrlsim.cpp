@@ -37,6 +37,7 @@
 //
 #include <stdio.h>
 #include <assert.h>
+#include <verilated_save.h>
 #include "enetctrlsim.h"
 
 ENETCTRLSIM::ENETCTRLSIM(void) {
@@ -147,3 +148,29 @@ int	ENETCTRLSIM::operator()(int in_reset, int clk, int data) {
 int	ENETCTRLSIM::operator[](int index) const {
 	return m_mem[index & (ENET_MEMWORDS-1)] & 0x0ffff;
 }
+
+void	ENETCTRLSIM::save(VerilatedSerialize &os) {
+	os.write(&m_consecutive_clocks, sizeof(m_consecutive_clocks));
+	os.write(&m_lastout, sizeof(m_lastout));
+	os.write(&m_tickcount, sizeof(m_tickcount));
+	os.write(&m_ticks_per_clock, sizeof(m_ticks_per_clock));
+	os.write(&m_lastclk, sizeof(m_lastclk));
+	os.write(m_mem, sizeof(m_mem));
+	os.write(&m_synched, sizeof(m_synched));
+	os.write(&m_datareg, sizeof(m_datareg));
+	os.write(&m_halfword, sizeof(m_halfword));
+	os.write(&m_outreg, sizeof(m_outreg));
+}
+
+void	ENETCTRLSIM::restore(VerilatedDeserialize &is) {
+	is.read(&m_consecutive_clocks, sizeof(m_consecutive_clocks));
+	is.read(&m_lastout, sizeof(m_lastout));
+	is.read(&m_tickcount, sizeof(m_tickcount));
+	is.read(&m_ticks_per_clock, sizeof(m_ticks_per_clock));
+	is.read(&m_lastclk, sizeof(m_lastclk));
+	is.read(m_mem, sizeof(m_mem));
+	is.read(&m_synched, sizeof(m_synched));
+	is.read(&m_datareg, sizeof(m_datareg));
+	is.read(&m_halfword, sizeof(m_halfword));
+	is.read(&m_outreg, sizeof(m_outreg));
+}
@@ -39,6 +39,10 @@
 #define	ENETCTRLSIM_H
 
 #define	ENET_MEMWORDS	32
+
+class	VerilatedSerialize;
+class	VerilatedDeserialize;
+
 class	ENETCTRLSIM	{
 	int	m_consecutive_clocks, m_lastout,
 		m_tickcount, m_ticks_per_clock, m_lastclk;
@@ -53,6 +57,10 @@ public:
 
 	int	operator()(int inreset, int clk, int data);
 	int	operator[](int index) const;
+
+	// Checkpoint support
+	void	save(VerilatedSerialize &os);
+	void	restore(VerilatedDeserialize &is);
 };
 
 #endif	// ENETCTRLSIM_H
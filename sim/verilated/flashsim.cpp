@@ -45,14 +45,31 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <verilated_save.h>
 
 #include "flashsim.h"
 
 #ifndef	CLKRATE_HZ
+#ifdef	CLKFREQHZ
+// Count time in clocks of the design, as found in regdefs.h
+#define	CLKRATE_HZ	CLKFREQHZ
+#else
 // Default to a 100MHz clock
 // Much higher and we might suffer from overflow
 #define	CLKRATE_HZ	100000000
 #endif
+#endif
+
+#ifndef	FLASH_SPEEDUP
+// Shall we artificially speed up program and erase cycles?  By default,
+// these take 1/100th of their datasheet times.  Build with -DFLASH_SPEEDUP=1
+// to keep them at their original speed.
+#define	FLASH_SPEEDUP	100
+#endif
 
 extern const unsigned DEVID;
 const unsigned	DEVID = 0x01152340;
@@ -65,12 +82,11 @@ static	const unsigned
 	tBE    =   32 * SECONDS,
 	tDP    =   10 * SECONDS,
 	tRES   =   30 * SECONDS,
-// Shall we artificially speed up this process?
-	tPP    = 12 * MICROSECONDS,
-	tSE    = 15 * MILLISECONDS;
-// or keep it at the original speed
-	// tPP    = 1200 * MICROSECONDS,
-	// tSE    = 1500 * MILLISECONDS;
+// Page program and sector erase times, per the datasheet.  tPP is the time
+// to program a full 256 byte page.  Shorter programs take proportionally
+// less time, in steps of eight bytes.
+	tPP    = 1200 * MICROSECONDS / FLASH_SPEEDUP,
+	tSE    = 1500 * MILLISECONDS / FLASH_SPEEDUP;
 
 FLASHSIM::FLASHSIM(const int lglen, bool debug,
 		const int rddelay, const int ndummy)
@@ -78,7 +94,10 @@ FLASHSIM::FLASHSIM(const int lglen, bool debug,
 			RDDELAY(rddelay), NDUMMY(ndummy) {
 	m_membytes = (1<<lglen);
 	m_memmask = (m_membytes - 1);
-	m_mem = new char[m_membytes];
+	// Every page starts out erased
+	m_npages = (m_membytes + FLASHPGLN-1) >> FLASHLGPGLN;
+	m_pages = new FLASHPAGE *[m_npages];
+	memset(m_pages, 0, m_npages * sizeof(FLASHPAGE *));
 	m_pmem = new char[256];
 	m_state = QSPIF_IDLE;
 	m_last_sck = 1;
@@ -89,14 +108,205 @@ FLASHSIM::FLASHSIM(const int lglen, bool debug,
 	m_mode = FM_SPI;
 	m_mode_byte = 0;
 	m_idle_throttle = false;
+	m_ckdelay = m_rddelay = NULL;
+}
+
+FLASHSIM::~FLASHSIM(void) {
+	erase(0, m_npages);
+	delete[] m_pages;
+	delete[] m_pmem;
+	delete[] m_ckdelay;
+	delete[] m_rddelay;
+}
+
+static	void	pgref(FLASHPAGE *pg) {
+	if (pg)
+		__atomic_add_fetch(&pg->m_refs, 1, __ATOMIC_RELAXED);
+}
+
+static	void	maprelease(FLASHMAP *fm) {
+	if (0 == __atomic_sub_fetch(&fm->m_refs, 1, __ATOMIC_ACQ_REL)) {
+		munmap(fm->m_base, fm->m_len);
+		delete fm;
+	}
+}
+
+static	void	pgrelease(FLASHPAGE *pg) {
+	if ((pg)&&(0 == __atomic_sub_fetch(&pg->m_refs, 1, __ATOMIC_ACQ_REL))) {
+		if (pg->m_map)
+			maprelease(pg->m_map);
+		else
+			delete[] pg->m_data;
+		delete pg;
+	}
+}
 
-	memset(m_mem, 0x0ff, m_membytes);
+// Allocates a new page of our own, either erased or copied from src
+static	FLASHPAGE	*pgnew(const char *src) {
+	FLASHPAGE	*pg = new FLASHPAGE;
+
+	pg->m_refs = 1;
+	pg->m_map  = NULL;
+	pg->m_data = new char[FLASHPGLN];
+	if (src)
+		memcpy(pg->m_data, src, FLASHPGLN);
+	else
+		memset(pg->m_data, 0x0ff, FLASHPGLN);
+	return pg;
+}
+
+char	*FLASHSIM::wrpage(const unsigned addr) {
+	unsigned	pn = (addr & m_memmask) >> FLASHLGPGLN;
+	FLASHPAGE	*pg = m_pages[pn];
+
+	if (!pg) {
+		// An erased page.  Give it some memory.
+		pg = pgnew(NULL);
+		m_pages[pn] = pg;
+	} else if ((pg->m_map)
+			||(__atomic_load_n(&pg->m_refs, __ATOMIC_ACQUIRE) > 1)) {
+		// Shared with a snapshot, or part of a mapped file.  Make a
+		// copy of our own.
+		pg = pgnew(m_pages[pn]->m_data);
+		pgrelease(m_pages[pn]);
+		m_pages[pn] = pg;
+	}
+
+	return pg->m_data;
+}
+
+void	FLASHSIM::erase(const unsigned pg, const unsigned npages) {
+	for(unsigned k=pg; (k<pg+npages)&&(k<m_npages); k++) {
+		pgrelease(m_pages[k]);
+		m_pages[k] = NULL;
+	}
+}
+
+FLASHSNAP::FLASHSNAP(const unsigned npages) {
+	m_npages = npages;
+	m_pages = new FLASHPAGE *[npages];
+	memset(m_pages, 0, npages * sizeof(FLASHPAGE *));
+}
+
+FLASHSNAP::~FLASHSNAP(void) {
+	for(unsigned k=0; k<m_npages; k++)
+		pgrelease(m_pages[k]);
+	delete[] m_pages;
+}
+
+FLASHSNAP	*FLASHSIM::snapshot(void) const {
+	FLASHSNAP	*snap = new FLASHSNAP(m_npages);
+
+	for(unsigned k=0; k<m_npages; k++) {
+		pgref(m_pages[k]);
+		snap->m_pages[k] = m_pages[k];
+	}
+
+	return snap;
+}
+
+void	FLASHSIM::restore(const FLASHSNAP *snap) {
+	if (snap->m_npages != m_npages) {
+		fprintf(stderr, "SPI-FLASH: Snapshot is of a different size flash\n");
+		return;
+	}
+
+	for(unsigned k=0; k<m_npages; k++) {
+		pgref(snap->m_pages[k]);
+		pgrelease(m_pages[k]);
+		m_pages[k] = snap->m_pages[k];
+	}
+}
+
+void	FLASHSIM::save(VerilatedSerialize &os) {
+	bool	valid;
+
+	os.write(&m_state, sizeof(m_state));
+	os.write(&m_last_sck, sizeof(m_last_sck));
+	os.write(&m_write_count, sizeof(m_write_count));
+	os.write(&m_ireg, sizeof(m_ireg));
+	os.write(&m_oreg, sizeof(m_oreg));
+	os.write(&m_sreg, sizeof(m_sreg));
+	os.write(&m_addr, sizeof(m_addr));
+	os.write(&m_count, sizeof(m_count));
+	os.write(&m_config, sizeof(m_config));
+	os.write(&m_mode_byte, sizeof(m_mode_byte));
+	os.write(&m_creg, sizeof(m_creg));
+	os.write(&m_idle_throttle, sizeof(m_idle_throttle));
+	os.write(&m_mode, sizeof(m_mode));
+	os.write(m_pmem, 256);
+	valid = (m_ckdelay != NULL);
+	os.write(&valid, sizeof(valid));
+	if (valid)
+		os.write(m_ckdelay, CKDELAY * sizeof(int));
+	valid = (m_rddelay != NULL);
+	os.write(&valid, sizeof(valid));
+	if (valid)
+		os.write(m_rddelay, RDDELAY * sizeof(int));
+
+	// Only the pages that have been written to are saved, so the
+	// checkpoint of a mostly erased flash stays small
+	os.write(&m_npages, sizeof(m_npages));
+	for(unsigned k=0; k<m_npages; k++) {
+		valid = (m_pages[k] != NULL);
+		os.write(&valid, sizeof(valid));
+		if (valid)
+			os.write(m_pages[k]->m_data, FLASHPGLN);
+	}
+}
+
+void	FLASHSIM::restore(VerilatedDeserialize &is) {
+	bool		valid;
+	unsigned	npages;
+
+	is.read(&m_state, sizeof(m_state));
+	is.read(&m_last_sck, sizeof(m_last_sck));
+	is.read(&m_write_count, sizeof(m_write_count));
+	is.read(&m_ireg, sizeof(m_ireg));
+	is.read(&m_oreg, sizeof(m_oreg));
+	is.read(&m_sreg, sizeof(m_sreg));
+	is.read(&m_addr, sizeof(m_addr));
+	is.read(&m_count, sizeof(m_count));
+	is.read(&m_config, sizeof(m_config));
+	is.read(&m_mode_byte, sizeof(m_mode_byte));
+	is.read(&m_creg, sizeof(m_creg));
+	is.read(&m_idle_throttle, sizeof(m_idle_throttle));
+	is.read(&m_mode, sizeof(m_mode));
+	is.read(m_pmem, 256);
+	is.read(&valid, sizeof(valid));
+	if (valid) {
+		if (!m_ckdelay)
+			m_ckdelay = new int[CKDELAY+8];
+		is.read(m_ckdelay, CKDELAY * sizeof(int));
+	}
+	is.read(&valid, sizeof(valid));
+	if (valid) {
+		if (!m_rddelay)
+			m_rddelay = new int[RDDELAY];
+		is.read(m_rddelay, RDDELAY * sizeof(int));
+	}
+
+	is.read(&npages, sizeof(npages));
+	if (npages != m_npages) {
+		fprintf(stderr, "ERR: SPI-FLASH checkpoint is of a different size flash\n");
+		exit(EXIT_FAILURE);
+	}
+
+	erase(0, m_npages);
+	for(unsigned k=0; k<m_npages; k++) {
+		is.read(&valid, sizeof(valid));
+		if (valid) {
+			m_pages[k] = pgnew(NULL);
+			is.read(m_pages[k]->m_data, FLASHPGLN);
+		}
+	}
 }
 
 void	FLASHSIM::load(const unsigned addr, const char *fname) {
-	FILE	*fp;
-	size_t	len;
-	int	nr = 0;
+	int		fd;
+	struct	stat	sb;
+	size_t		len;
+	unsigned	nr = 0, a, off;
 
 	if (addr >= m_membytes)
 		return;
@@ -104,9 +314,51 @@ void	FLASHSIM::load(const unsigned addr, const char *fname) {
 	// of the flash memory
 	len = m_membytes-addr;
 
-	if (NULL != (fp = fopen(fname, "r"))) {
-		nr = fread(&m_mem[addr], sizeof(char), len, fp);
-		fclose(fp);
+	if ((fd = open(fname, O_RDONLY)) >= 0) {
+		FLASHMAP	*fm = NULL;
+		char		*base;
+
+		if ((fstat(fd, &sb) == 0)&&((size_t)sb.st_size < len))
+			len = sb.st_size;
+		base = (len > 0) ? (char *)mmap(NULL, len, PROT_READ,
+					MAP_PRIVATE, fd, 0) : (char *)MAP_FAILED;
+		close(fd);
+
+		if (base != MAP_FAILED) {
+			fm = new FLASHMAP;
+			fm->m_refs = 1;	// Our own, until we're done here
+			fm->m_base = base;
+			fm->m_len  = len;
+		}
+
+		// Whole pages reference the mapping directly.  Only partial
+		// ones, at either end, need to be copied.
+		a = addr;
+		while((fm)&&(nr < len)) {
+			unsigned	ln = FLASHPGLN - (a & (FLASHPGLN-1));
+
+			if (ln > len - nr)
+				ln = len - nr;
+			if (ln == FLASHPGLN) {
+				FLASHPAGE	*pg = new FLASHPAGE;
+				unsigned	pn = a >> FLASHLGPGLN;
+
+				pg->m_refs = 1;
+				pg->m_data = &base[nr];
+				pg->m_map  = fm;
+				__atomic_add_fetch(&fm->m_refs, 1,
+						__ATOMIC_RELAXED);
+				pgrelease(m_pages[pn]);
+				m_pages[pn] = pg;
+			} else
+				memcpy(&wrpage(a)[a & (FLASHPGLN-1)],
+					&base[nr], ln);
+			a  += ln;
+			nr += ln;
+		}
+
+		if (fm)
+			maprelease(fm);
 		if (nr == 0) {
 			fprintf(stderr, "SPI-FLASH: Could not read %s\n", fname);
 			perror("O/S Err:");
@@ -116,22 +368,37 @@ void	FLASHSIM::load(const unsigned addr, const char *fname) {
 		perror("O/S Err:");
 	}
 
-	for(unsigned i=nr+addr; i<m_membytes; i++)
-		m_mem[i] = 0x0ff;
+	// Erase everything following, starting with the rest of the last
+	// page we wrote to
+	a = nr+addr;
+	off = a & (FLASHPGLN-1);
+	if ((off)&&(m_pages[a >> FLASHLGPGLN]))
+		memset(&wrpage(a)[off], 0x0ff, FLASHPGLN-off);
+	a = (a + FLASHPGLN-1) >> FLASHLGPGLN;
+	if (a < m_npages)
+		erase(a, m_npages-a);
 
 	if (m_debug && addr == 0 && nr > 16) {
 		fprintf(stderr, "FLASH LOAD: ");
 		for(unsigned i=0; i<16; i++)
-			fprintf(stderr, "%02x ", m_mem[i]);
+			fprintf(stderr, "%02x ", rdbyte(i));
 		fprintf(stderr, "\n");
 	}
 }
 
 void	FLASHSIM::load(const uint32_t offset, const char *data,
 		const uint32_t len) {
-	uint32_t	moff = (offset & (m_memmask));
+	uint32_t	moff = (offset & (m_memmask)), nw = 0;
 
-	memcpy(&m_mem[moff], data, len);
+	while(nw < len) {
+		uint32_t	ln = FLASHPGLN - (moff & (FLASHPGLN-1));
+
+		if (ln > len - nw)
+			ln = len - nw;
+		memcpy(&wrpage(moff)[moff & (FLASHPGLN-1)], &data[nw], ln);
+		moff = (moff + ln) & m_memmask;
+		nw += ln;
+	}
 }
 
 bool	FLASHSIM::deep_sleep(void) const {
@@ -161,27 +428,45 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 	}
 
 	if (csn) {
+		const unsigned	nbits = m_count;
+
 		m_last_sck = 1;
 		m_ireg = 0; m_oreg = 0;
 		m_count= 0;
 
 		if ((QSPIF_PP == m_state)||(QSPIF_QPP == m_state)) {
-			// Start a page program
+			unsigned	nbytes, nck;
+
+			// Start a page program.  The command and address are
+			// always sent one bit per clock, the data either one
+			// (PP) or four (QPP) bits per clock.
+			nbytes = (nbits >= 40) ? ((nbits - 32) >> 3) : 0;
+			nck = ((QSPIF_QPP == m_state)&&(nbits >= 32))
+				? (32 + ((nbits - 32)>>2)) : nbits;
+			if (nbytes > 256)
+				nbytes = 256;
 			if (m_debug) printf("FLASHSIM: Page Program write cycle begins (Addr = %08x)\n", (m_addr&(~0x0ff)));
-			if (m_debug) printf("CK = %d & 7 = %d\n", m_count, m_count & 0x07);
+			if (m_debug) printf("FLASHSIM: %s of %d bytes took %d clocks\n",
+				(QSPIF_QPP == m_state) ? "QPP":"PP", nbytes, nck);
 			if (m_debug) printf("FLASHSIM: pmem = %08lx\n", (unsigned long)m_pmem);
-			m_write_count = tPP;
+			m_write_count = (tPP * ((nbytes + 7)>>3) + 31) / 32;
+			if (m_write_count == 0)
+				m_write_count = 1;
 			m_state = QSPIF_IDLE;
 			m_sreg &= (~QSPIF_WEL_FLAG);
 			m_sreg |= (QSPIF_WIP_FLAG);
+			// The program page lies entirely within one of our
+			// pages
+			char	*pg = &wrpage(m_addr)[m_addr & (FLASHPGLN-1)
+							& (~0x0ff)];
 			for(int i=0; i<256; i++) {
 				/*
 				if (m_debug) printf("%02x: m_mem[%02x] = %02x &= %02x = %02x\n",
 					i, (m_addr&(~0x0ff))+i,
-					m_mem[(m_addr&(~0x0ff))+i]&0x0ff, m_pmem[i]&0x0ff,
-					m_mem[(m_addr&(~0x0ff))+i]& m_pmem[i]&0x0ff);
+					pg[i]&0x0ff, m_pmem[i]&0x0ff,
+					pg[i]& m_pmem[i]&0x0ff);
 				*/
-				m_mem[(m_addr&(~0x0ff))+i] &= m_pmem[i];
+				pg[i] &= m_pmem[i];
 			}
 			m_mode = FM_SPI;
 		} else if (m_state == QSPIF_SECTOR_ERASE) {
@@ -191,8 +476,8 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 			m_sreg &= (~QSPIF_WEL_FLAG);
 			m_sreg |= (QSPIF_WIP_FLAG);
 			m_addr &= (-1<<16);
-			for(int i=0; i<(1<<16); i++)
-				m_mem[m_addr + i] = 0x0ff;
+			erase((m_addr & m_memmask) >> FLASHLGPGLN,
+				(1<<16) >> FLASHLGPGLN);
 			if (m_debug) printf("FLASHSIM: Now waiting %d ticks delay\n", m_write_count);
 		} else if (QSPIF_WRSR == m_state) {
 			if (m_debug) printf("FLASHSIM: Actually writing status register\n");
@@ -209,8 +494,7 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 			m_state = QSPIF_IDLE;
 			m_sreg &= (~QSPIF_WEL_FLAG);
 			m_sreg |= (QSPIF_WIP_FLAG);
-			for(unsigned i=0; i<m_membytes; i++)
-				m_mem[i] = 0x0ff;
+			erase(0, m_npages);
 		} else if (m_state == QSPIF_DEEP_POWER_DOWN) {
 			m_write_count = tDP;
 			m_state = QSPIF_IDLE;
@@ -502,11 +786,11 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 				assert((m_addr & (~(m_memmask)))==0);
 				// if (m_debug) printf("MEM[%06x] = %02x\n",
 				//	m_addr, m_mem[m_addr]&0x0ff);
-				QOREG(m_mem[m_addr++]);
+				QOREG(rdbyte(m_addr++));
 			} else if ((m_count >= 40)&&(0 == (m_sreg&0x01))) {
 				// if (m_debug) printf("MEM[%06x] = %02x\n",
 				//	m_addr, m_mem[m_addr]&0x0ff);
-				QOREG(m_mem[m_addr++]);
+				QOREG(rdbyte(m_addr++));
 			} else m_oreg = 0;
 			break;
 		case QSPIF_FAST_READ:
@@ -518,7 +802,7 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 			} else if ((m_count >= 40)&&(0 == (m_sreg&0x01))) {
 				//if (m_count == 40)
 					//printf("DUMMY BYTE COMPLETE ...\n");
-				QOREG(m_mem[m_addr++]);
+				QOREG(rdbyte(m_addr++));
 				// if (m_debug) printf("SPIF[%08x] = %02x\n", m_addr-1, m_oreg);
 			} else m_oreg = 0;
 			break;
@@ -534,9 +818,9 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 			} else if ((m_count == 32+8)&&(0 == (m_sreg&0x01))) {
 				m_mode_byte = (m_ireg) & 0x0ff;
 				if (m_debug) printf("DSPI: MODE BYTE = %02x\n", m_mode_byte);
-				QOREG(m_mem[m_addr++]);
+				QOREG(rdbyte(m_addr++));
 			} else if ((m_count > 32+8)&&(0 == (m_sreg&0x01))) {
-				QOREG(m_mem[m_addr++]);
+				QOREG(rdbyte(m_addr++));
 				if (m_debug) printf("FLASHSIMF[%08x]/DR = %02x\n",
 					m_addr-1, m_oreg);
 			} else m_oreg = 0;
@@ -554,9 +838,9 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 				m_mode_byte = (m_ireg) & 0x0ff;
 				if (m_debug) printf("QSPI: MODE BYTE = %02x\n", m_mode_byte);
 				if (NDUMMY == 2)
-					QOREG(m_mem[m_addr++]);
+					QOREG(rdbyte(m_addr++));
 			} else if ((m_count > 32+4*NDUMMY)&&(0 == (m_sreg&0x01))) {
-				QOREG(m_mem[m_addr++]);
+				QOREG(rdbyte(m_addr++));
 				// printf("QSPIF[%08x]/QR = %02x\n",
 					// m_addr-1, m_oreg);
 			} else m_oreg = 0;
@@ -566,7 +850,7 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 				m_mode_byte = (m_ireg & 0x0ff);
 				if (m_debug) printf("DSPI/DR: MODE BYTE = %02x\n", m_mode_byte);
 			}
-			QOREG(m_mem[m_addr++]);
+			QOREG(rdbyte(m_addr++));
 			if (m_debug) printf("DSPIF[%08x]/DR = %02x\n", m_addr-1, m_oreg & 0x0ff);
 			break;
 		case QSPIF_QUAD_READ:
@@ -574,11 +858,11 @@ int	FLASHSIM::operator()(const int csn, const int sck, const int dat) {
 				m_mode_byte = (m_ireg & 0x0ff);
 				if (m_debug) printf("QSPI/QR: MODE BYTE = %02x\n", m_mode_byte);
 				if (NDUMMY == 2) {
-					QOREG(m_mem[m_addr++]);
+					QOREG(rdbyte(m_addr++));
 					if (m_debug) printf("QSPIF[%08x]/QR = %02x\n", m_addr-1, m_oreg & 0x0ff);
 				}
 			} else if ((m_count >= 24+4*NDUMMY)&&(0 == (m_sreg&0x01))) {
-				QOREG(m_mem[m_addr++]);
+				QOREG(rdbyte(m_addr++));
 				if (m_debug) printf("QSPIF[%08x]/QR = %02x\n", m_addr-1, m_oreg & 0x0ff);
 			} else m_oreg = 0;
 			break;
@@ -9,6 +9,17 @@
 //	board by Digilent.  As such, it is defined by 32 Mbits of memory
 //	(4 Mbyte).
 //
+//	The memory is kept sparsely, in FLASHPGLN byte pages.  Erased pages
+//	aren't stored at all, so erasing costs one step per page rather than
+//	per byte, and an unprogrammed flash costs next to nothing.  Pages are
+//	shared, copy on write, with any snapshots taken of the flash.  Hence a
+//	FLASHSNAP (of a programmed image, say) can be taken once and then
+//	restored into as many FLASHSIMs as desired, as often as desired,
+//	without copying.
+//
+//	Images loaded from a file are memory mapped rather than read.  Each
+//	page then points into the mapping, until it is first written to.
+//
 // Creator:	Dan Gisselquist, Ph.D.
 //		Gisselquist Technology, LLC
 //
@@ -43,6 +54,9 @@
 
 #include "regdefs.h"
 
+class	VerilatedSerialize;
+class	VerilatedDeserialize;
+
 #ifndef	FLASH_NDUMMY
 #define	FLASH_NDUMMY	8
 #endif
@@ -54,6 +68,39 @@
 #define	QSPIF_WIP_FLAG			0x0001
 #define	QSPIF_WEL_FLAG			0x0002
 #define	QSPIF_DEEP_POWER_DOWN_FLAG	0x0200
+
+// The size of each page of flash memory.  This must be a power of two, no
+// smaller than the 256 byte program page and no larger than the 64kB sector.
+#define	FLASHLGPGLN	12
+#define	FLASHPGLN	(1<<FLASHLGPGLN)
+
+// A memory mapped image file, and a count of the pages referencing it
+typedef	struct	{
+	unsigned	m_refs;
+	char		*m_base;
+	size_t		m_len;
+} FLASHMAP;
+
+// A page of memory, and a count of the FLASHSIMs and FLASHSNAPs referencing
+// it.  A page may only be changed once it has just the one reference, and
+// then only if it's our own memory (m_map == NULL) rather than a mapped file's.
+typedef	struct	{
+	unsigned	m_refs;
+	char		*m_data;
+	FLASHMAP	*m_map;
+} FLASHPAGE;
+
+// A snapshot of the contents of a flash.  Any snapshot may be restored into
+// any FLASHSIM of the same size.
+class	FLASHSNAP {
+public:
+	unsigned	m_npages;
+	FLASHPAGE	**m_pages;
+
+	FLASHSNAP(const unsigned npages);
+	~FLASHSNAP(void);
+};
+
 class	FLASHSIM {
 	typedef	enum {
 		QSPIF_IDLE,
@@ -87,7 +134,11 @@ class	FLASHSIM {
 	} FLASH_MODE;
 
 	QSPIF_STATE	m_state;
-	char		*m_mem, *m_pmem;
+	// m_pages[k] holds bytes k*FLASHPGLN through (k+1)*FLASHPGLN-1, or
+	// NULL if they are all erased
+	FLASHPAGE	**m_pages;
+	unsigned	m_npages;
+	char		*m_pmem;
 	int		m_last_sck;
 	unsigned	m_write_count, m_ireg, m_oreg, m_sreg, m_addr,
 			m_count, m_config, m_mode_byte, m_creg, m_membytes,
@@ -99,15 +150,30 @@ class	FLASHSIM {
 
 	int		*m_ckdelay, *m_rddelay;
 
+	// Returns a page that may be written to, copying or allocating it
+	// first if need be
+	char	*wrpage(const unsigned addr);
+	// Erases (releases) the npages starting with page pg
+	void	erase(const unsigned pg, const unsigned npages);
+
+	unsigned char	rdbyte(const unsigned addr) const {
+		const FLASHPAGE	*pg = m_pages[(addr & m_memmask)>>FLASHLGPGLN];
+		return (pg) ? pg->m_data[addr & (FLASHPGLN-1)] : 0x0ff;
+	}
+	void	wrbyte(const unsigned addr, const unsigned char v) {
+		wrpage(addr)[addr & (FLASHPGLN-1)] = v;
+	}
+
 public:
 	FLASHSIM(const int lglen = 24, bool debug = false,
 		const int rddelay = FLASH_RDDELAY,
 		const int ndummy = FLASH_NDUMMY);
+	~FLASHSIM(void);
 	void	load(const char *fname) { load(0, fname); }
 	void	load(const unsigned addr, const char *fname);
 	void	load(const uint32_t offset, const char *data, const uint32_t len);
 	bool	write_protect(void) { return ((m_sreg & QSPIF_WEL_FLAG)==0); }
-	bool	write_in_progress(void) { return ((m_sreg | QSPIF_WIP_FLAG)!=0); }
+	bool	write_in_progress(void) { return ((m_sreg & QSPIF_WIP_FLAG)!=0); }
 	bool	xip_mode(void) { return (QSPIF_QUAD_READ_IDLE == m_state); }
 	bool	deep_sleep(bool newval);
 	bool	deep_sleep(void) const;
@@ -116,21 +182,30 @@ public:
 	void	debug(const bool dbg) { m_debug = dbg; }
 	bool	debug(void) const { return m_debug; }
 	unsigned operator[](const int index) {
-		unsigned char	*cptr = (unsigned char *)&m_mem[index<<2];
-		unsigned	v;
-		v = (*cptr++);
-		v = (v<<8)|(*cptr++);
-		v = (v<<8)|(*cptr++);
-		v = (v<<8)|(*cptr);
+		unsigned	v, a = index<<2;
+		v = rdbyte(a);
+		v = (v<<8)|rdbyte(a+1);
+		v = (v<<8)|rdbyte(a+2);
+		v = (v<<8)|rdbyte(a+3);
 
 		return v; }
 	void set(const unsigned addr, const unsigned val) {
-		unsigned char	*cptr = (unsigned char *)&m_mem[addr<<2];
-		*cptr++ = (val>>24);
-		*cptr++ = (val>>16);
-		*cptr++ = (val>> 8);
-		*cptr   = (val);
+		unsigned	a = addr<<2;
+		wrbyte(a,   val>>24);
+		wrbyte(a+1, val>>16);
+		wrbyte(a+2, val>> 8);
+		wrbyte(a+3, val);
 		return;}
+
+	// Capture the current contents of the flash, or replace them with
+	// those of an earlier snapshot.  Neither copies any memory.  Only the
+	// memory is captured, not the state of any command in progress.
+	FLASHSNAP	*snapshot(void) const;
+	void	restore(const FLASHSNAP *snap);
+	// Checkpoint support.  Unlike a snapshot, this captures the state of
+	// any command in progress as well as the memory.
+	void	save(VerilatedSerialize &os);
+	void	restore(VerilatedDeserialize &is);
 	int	operator()(const int csn, const int sck, const int dat);
 
 	// simtick applies various programmable delays to the inputs in 
@@ -60,6 +60,7 @@
 #include "flashsim.h"
 #include "byteswap.h"
 #include "enetctrlsim.h"
+#include "netsim.h"
 //
 // SIM.DEFINES
 //
@@ -91,7 +92,11 @@ public:
 #ifdef	NETCTRL1_ACCESS
 	ENETCTRLSIM	*m_mdio1;
 #endif // NETCTRL1_ACCESS
-	MAINTB(void) {
+	NETSIM		*m_net1;
+	// The debugging bus listens on port (and port+1, for the console),
+	// or on ports of the O/S's choosing given port zero.  Its console
+	// output is written to log.
+	MAINTB(const int port = FPGAPORT, FILE *log = stdout) {
 		// SIM.INIT
 		//
 		// If your simulation components need to be initialized,
@@ -100,7 +105,7 @@ public:
 		//
 		// From picorv
 		// From wbu
-		m_wbu = new DBLUARTSIM();
+		m_wbu = new DBLUARTSIM(port, true, log);
 		m_wbu->setup(50);
 		// From flash
 #ifdef	FLASH_ACCESS
@@ -110,6 +115,14 @@ public:
 #ifdef	NETCTRL1_ACCESS
 		m_mdio1 = new ENETCTRLSIM;
 #endif // NETCTRL1_ACCESS
+		// From net1
+		m_net1 = new NETSIM(log);
+	}
+
+	~MAINTB(void) {
+		// Give the UART's I/O thread a chance to send anything left
+		delete m_wbu;
+		delete m_net1;
 	}
 
 	void	reset(void) {
@@ -127,6 +140,7 @@ public:
 		//
 // Looking for string: SIM.CLRRESET
 	m_core->i_reset = 1;
+		m_changed = true;
 	}
 
 	void	trace(const char *vcd_trace_file_name) {
@@ -140,6 +154,31 @@ public:
 		m_done = true;
 	}
 
+	// Checkpoints capture the peripheral models along with the design
+	virtual	void	save(VerilatedSerialize &os) {
+		TESTB<Vmain>::save(os);
+		m_wbu->save(os);
+#ifdef	FLASH_ACCESS
+		m_flash->save(os);
+#endif // FLASH_ACCESS
+#ifdef	NETCTRL1_ACCESS
+		m_mdio1->save(os);
+#endif // NETCTRL1_ACCESS
+		m_net1->save(os);
+	}
+
+	virtual	void	restore(VerilatedDeserialize &is) {
+		TESTB<Vmain>::restore(is);
+		m_wbu->restore(is);
+#ifdef	FLASH_ACCESS
+		m_flash->restore(is);
+#endif // FLASH_ACCESS
+#ifdef	NETCTRL1_ACCESS
+		m_mdio1->restore(is);
+#endif // NETCTRL1_ACCESS
+		m_net1->restore(is);
+	}
+
 	void	tick(void) {
 		if (done())
 			return;
@@ -162,7 +201,24 @@ public:
 	if (m_core->o_gpio & GPIO_HALT)
 		m_done = true;
 		// SIM.TICK from wbu
-		m_core->i_wbu_uart_rx = (*m_wbu)(m_core->o_wbu_uart_tx);
+		if (m_wbu->bypassed()) {
+			int	ch;
+
+			// Skip the UART, and trade whole characters with
+			// the bus instead
+			m_core->i_wbu_uart_rx = 1;
+			m_core->i_wbu_sim_bypass = 1;
+			m_core->i_wbu_sim_busy = (m_wbu->busy()) ? 1:0;
+			if ((m_core->o_wbu_sim_stb)&&(!m_core->i_wbu_sim_busy))
+				m_wbu->received(m_core->o_wbu_sim_data);
+
+			ch = m_wbu->bypass_tick();
+			m_core->i_wbu_sim_stb  = (ch >= 0) ? 1:0;
+			m_core->i_wbu_sim_data = ch & 0x0ff;
+		} else {
+			m_core->i_wbu_sim_bypass = 0;
+			m_core->i_wbu_uart_rx = (*m_wbu)(m_core->o_wbu_uart_tx);
+		}
 		// SIM.TICK from flash
 #ifdef	FLASH_ACCESS
 		m_core->i_qspi_dat = m_flash->simtick(
@@ -189,9 +245,9 @@ public:
 		// SIM.TICK tags go here for SIM.CLOCK=clk_125mhz
 		//
 		// SIM.TICK from net1
-		m_core->i_net1_rx_dv  = m_core->o_net1_tx_ctl;
+		(*m_net1)(m_core->o_net1_tx_ctl, m_core->o_net1_txd,
+			m_core->i_net1_rx_dv, m_core->i_net1_rxd);
 		m_core->i_net1_rx_err = 0;
-		m_core->i_net1_rxd    = m_core->o_net1_txd;
 
 	}
 
@@ -293,12 +349,11 @@ public:
 			start = start & (-4);
 			wlen = (wlen+3)&(-4);
 
-			// Need to byte swap data to get it into the memory
-			char	*bswapd = new char[len+8];
-			memcpy(bswapd, &buf[offset], wlen);
-			byteswapbuf(len>>2, (uint32_t *)bswapd);
-			memcpy(&m_core->block_ram[start], bswapd, wlen);
-			delete	bswapd;
+			// Need to byte swap data to get it into the memory.
+			// Do so on the way in, rather than in a copy.
+			byteswapcpy((char *)&m_core->block_ram[start],
+				&buf[offset], (len-offset < wlen)
+					? len-offset : wlen);
 			// AUTOFPGA::Now clean up anything else
 			// Was there more to write than we wrote?
 			if (addr + len > base + adrln)
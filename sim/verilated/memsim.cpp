@@ -47,6 +47,11 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "memsim.h"
 
 MEMSIM::MEMSIM(const unsigned int nwords, const unsigned int delay) {
@@ -54,7 +59,14 @@ MEMSIM::MEMSIM(const unsigned int nwords, const unsigned int delay) {
 	for(nxt=1; nxt < nwords; nxt<<=1)
 		;
 	m_len = nxt; m_mask = nxt-1;
-	m_mem = new BUSW[m_len];
+	// Allocate the memory by mapping it, so that load() can later map a
+	// file (copy on write) over the top of it
+	m_mem = (BUSW *)mmap(NULL, m_len * sizeof(BUSW), PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (m_mem == MAP_FAILED) {
+		perror("MEMSIM: Could not allocate memory");
+		exit(EXIT_FAILURE);
+	}
 
 	m_delay = delay;
 	for(m_delay_mask=1; m_delay_mask < delay; m_delay_mask<<=1)
@@ -68,33 +80,52 @@ MEMSIM::MEMSIM(const unsigned int nwords, const unsigned int delay) {
 }
 
 MEMSIM::~MEMSIM(void) {
-	delete[]	m_mem;
+	munmap(m_mem, m_len * sizeof(BUSW));
 }
 
 void	MEMSIM::load(const char *fname) {
-	FILE	*fp;
+	int		fd;
+	struct	stat	sb;
+	size_t		memlen = m_len * sizeof(BUSW), flen = 0;
 	unsigned int	nr;
 
-	fp = fopen(fname, "r");
-	if (!fp) {
+	// Start over with fresh (zeroed) memory
+	if (MAP_FAILED == mmap(m_mem, memlen, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0)) {
+		perror("MEMSIM: Could not clear memory");
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
 		fprintf(stderr, "Could not open/load file \'%s\'\n",
 			fname);
 		perror("O/S Err:");
 		fprintf(stderr, "\tInitializing memory with zero instead.\n");
 		nr = 0;
 	} else {
-		nr = fread(m_mem, sizeof(BUSW), m_len, fp);
-		fclose(fp);
+		if (fstat(fd, &sb) == 0)
+			flen = (size_t)sb.st_size;
+		flen = (flen < memlen) ? flen : memlen;
 
+		// Map the file over the start of the memory, rather than
+		// reading it in.  Anything past the end of the file reads as
+		// zero, and writes only ever change our private copy.
+		if ((flen > 0)&&(MAP_FAILED == mmap(m_mem, flen,
+				PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED,
+				fd, 0))) {
+			perror("MEMSIM: Could not map file");
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+
+		nr = flen / sizeof(BUSW);
 		if (nr != m_len) {
 			fprintf(stderr, "Only read %d of %d words\n",
 				nr, m_len);
 			fprintf(stderr, "\tFilling the rest with zero.\n");
 		}
 	}
-
-	for(; nr<m_len; nr++)
-		m_mem[nr] = 0l;
 }
 
 void	MEMSIM::load(const unsigned int addr, const char *buf, const size_t len) {
@@ -0,0 +1,500 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename: 	netsim.cpp
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	A simulated network, exchanging packets with the design's
+//		RGMII port.  See netsim.h for details.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of  the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <verilated_save.h>
+
+#include "netsim.h"
+
+#define	PCAP_MAGIC_US	0xa1b2c3d4
+#define	PCAP_MAGIC_NS	0xa1b23c4d
+#define	PCAP_ETHERNET	1
+
+// The table for the Ethernet CRC.  It's built before main() starts, so that
+// NETSIMs on separate threads may share it.
+static	struct	NETCRCTBL {
+	uint32_t	m_tbl[256];
+
+	NETCRCTBL(void) {
+		for(unsigned k=0; k<256; k++) {
+			uint32_t	c = k;
+
+			for(int b=0; b<8; b++)
+				c = (c & 1) ? ((c >> 1) ^ 0xedb88320) : (c >> 1);
+			m_tbl[k] = c;
+		}
+	}
+} crctbl;
+
+// The Ethernet CRC, as it's sent: least significant byte first
+static	uint32_t	netcrc(const unsigned char *buf, const int len) {
+	uint32_t	crc = 0xffffffff;
+
+	for(int k=0; k<len; k++)
+		crc = crctbl.m_tbl[(crc ^ buf[k]) & 0x0ff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static	uint32_t	swap32(const uint32_t v) {
+	return __builtin_bswap32(v);
+}
+
+NETSIM::NETSIM(FILE *log) : m_log(log) {
+	m_ticks = 0;
+	m_rxlen = m_rxpos = m_rxgap = 0;
+	m_txlen = 0;
+	m_txactive = false;
+
+	m_replay = NULL;
+	m_replay_swap = m_replay_nsec = m_lockstep = m_waiting = false;
+	m_replay_start = m_replay_at = m_replay_first = 0;
+	m_replaylen = 0;
+
+	m_capture = NULL;
+
+	m_tap = -1;
+	m_fromtap = m_totap = NULL;
+	m_running = m_stop = false;
+
+	m_rxpkts = m_txpkts = m_rxbytes = m_txbytes = m_badpkts = 0;
+	m_trips = m_first_ps = m_last_ps = 0;
+}
+
+NETSIM::~NETSIM(void) {
+	if ((active())||(m_capture))
+		stats(m_log);
+
+	stopio();
+	if (m_tap >= 0)
+		close(m_tap);
+	delete m_fromtap;
+	delete m_totap;
+	if (m_replay)
+		fclose(m_replay);
+	if (m_capture)
+		fclose(m_capture);
+}
+
+void	NETSIM::replay(const char *fname, const unsigned long start_ps,
+		const bool lockstep) {
+	uint32_t	hdr[6];
+
+	if (NULL == (m_replay = fopen(fname, "r"))) {
+		fprintf(stderr, "ERR: Could not open %s\n", fname);
+		perror("O/S Err:");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fread(hdr, sizeof(hdr), 1, m_replay) != 1) {
+		fprintf(stderr, "ERR: %s is not a pcap file\n", fname);
+		exit(EXIT_FAILURE);
+	}
+
+	m_replay_swap = false;
+	if ((swap32(hdr[0]) == PCAP_MAGIC_US)
+			||(swap32(hdr[0]) == PCAP_MAGIC_NS)) {
+		m_replay_swap = true;
+		for(int k=0; k<6; k++)
+			hdr[k] = swap32(hdr[k]);
+	}
+
+	if ((hdr[0] != PCAP_MAGIC_US)&&(hdr[0] != PCAP_MAGIC_NS)) {
+		fprintf(stderr, "ERR: %s is not a pcap file\n", fname);
+		exit(EXIT_FAILURE);
+	} else if (hdr[5] != PCAP_ETHERNET) {
+		fprintf(stderr, "ERR: %s holds no Ethernet packets\n", fname);
+		exit(EXIT_FAILURE);
+	}
+
+	m_replay_nsec  = (hdr[0] == PCAP_MAGIC_NS);
+	m_replay_start = start_ps / NETBYTE_PS;
+	m_replay_first = -1ul;
+	m_lockstep     = lockstep;
+	m_waiting      = false;
+	nextreplay();
+}
+
+// Reads the next packet to be replayed into m_replaybuf, and determines when
+// it should be sent.  Returns false at the end of the file.
+bool	NETSIM::nextreplay(void) {
+	uint32_t	hdr[4];
+	unsigned long	ns;
+
+	m_replaylen = 0;
+	while(fread(hdr, sizeof(hdr), 1, m_replay) == 1) {
+		if (m_replay_swap)
+			for(int k=0; k<4; k++)
+				hdr[k] = swap32(hdr[k]);
+
+		if (hdr[2] > NETMAXPKT) {
+			fprintf(stderr, "NETSIM: Skipping a %u byte packet\n",
+				hdr[2]);
+			fseek(m_replay, hdr[2], SEEK_CUR);
+			continue;
+		} else if (fread(m_replaybuf, 1, hdr[2], m_replay) != hdr[2])
+			break;
+
+		ns = hdr[0] * 1000000000ul
+			+ hdr[1] * ((m_replay_nsec) ? 1ul : 1000ul);
+		if (m_replay_first == -1ul)
+			m_replay_first = ns;
+		// In lockstep, only the first packet waits on the clock
+		m_replay_at = m_replay_start;
+		if ((!m_lockstep)&&(ns > m_replay_first))
+			m_replay_at += (ns - m_replay_first) * 1000ul
+					/ NETBYTE_PS;
+		m_replaylen = hdr[2];
+		return true;
+	}
+
+	return false;
+}
+
+void	NETSIM::capture(const char *fname) {
+	uint32_t	hdr[6];
+
+	if (NULL == (m_capture = fopen(fname, "w"))) {
+		fprintf(stderr, "ERR: Could not open %s\n", fname);
+		perror("O/S Err:");
+		exit(EXIT_FAILURE);
+	}
+
+	// Our clock is good to the nanosecond, so keep it that way
+	hdr[0] = PCAP_MAGIC_NS;
+	hdr[1] = 0x040002;	// Version 2.4
+	hdr[2] = 0;		// GMT
+	hdr[3] = 0;		// Timestamp accuracy
+	hdr[4] = NETMAXPKT;	// Snap length
+	hdr[5] = PCAP_ETHERNET;
+	fwrite(hdr, sizeof(hdr), 1, m_capture);
+}
+
+void	NETSIM::wrpcap(const unsigned char *pkt, int len) {
+	uint32_t	hdr[4];
+	unsigned long	ns = m_ticks * NETBYTE_PS / 1000;
+
+	hdr[0] = ns / 1000000000ul;
+	hdr[1] = ns % 1000000000ul;
+	hdr[2] = len;
+	hdr[3] = len;
+	fwrite(hdr, sizeof(hdr), 1, m_capture);
+	fwrite(pkt, 1, len, m_capture);
+}
+
+void	NETSIM::tap(const char *ifname) {
+	struct	ifreq	ifr;
+
+	if ((m_tap = open("/dev/net/tun", O_RDWR)) < 0) {
+		fprintf(stderr, "ERR: Could not open /dev/net/tun\n");
+		perror("O/S Err:");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+	if (ioctl(m_tap, TUNSETIFF, &ifr) < 0) {
+		fprintf(stderr, "ERR: Could not attach to TAP device %s\n",
+			ifname);
+		perror("O/S Err:");
+		exit(EXIT_FAILURE);
+	}
+
+	m_fromtap = new SHMRING;
+	m_totap   = new SHMRING;
+	memset(m_fromtap, 0, sizeof(SHMRING));
+	memset(m_totap,   0, sizeof(SHMRING));
+
+	m_stop = false;
+	if (pthread_create(&m_thread, NULL, iothread, this) != 0) {
+		fprintf(stderr, "ERR: Could not start the TAP I/O thread\n");
+		exit(EXIT_FAILURE);
+	}
+	m_running = true;
+}
+
+void	*NETSIM::iothread(void *net) {
+	((NETSIM *)net)->iorun();
+	return NULL;
+}
+
+// Sends every packet the simulation has left for the TAP device
+static	void	drain(int fd, SHMRING *r) {
+	char		buf[NETMAXPKT];
+	uint16_t	ln;
+
+	while(shmring_used(r) > 0) {
+		shmring_read(r, (char *)&ln, sizeof(ln));
+		shmring_read(r, buf, ln);
+		if (write(fd, buf, ln) != ln)
+			perror("NETSIM: TAP write");
+	}
+}
+
+void	NETSIM::iorun(void) {
+	char		buf[sizeof(uint16_t)+NETMAXPKT];
+	struct	pollfd	pb;
+	struct	timespec	waitfor;
+
+	while(!__atomic_load_n(&m_stop, __ATOMIC_ACQUIRE)) {
+		pb.fd = m_tap;
+		pb.events = POLLIN;
+		waitfor.tv_sec  = 0;
+		waitfor.tv_nsec = NETIOWAIT_NS;
+		if ((ppoll(&pb, 1, &waitfor, NULL) > 0)
+				&&(pb.revents & POLLIN)) {
+			int		nr;
+			uint16_t	ln;
+
+			nr = read(m_tap, &buf[sizeof(ln)], NETMAXPKT);
+			// Should the simulation fall behind, drop the packet
+			// just as a busy network would
+			if ((nr > 0)&&(shmring_free(m_fromtap)
+						>= sizeof(ln) + nr)) {
+				ln = nr;
+				memcpy(buf, &ln, sizeof(ln));
+				// One write, so the simulation never sees
+				// a length without its packet
+				shmring_write(m_fromtap, buf, sizeof(ln) + nr);
+			}
+		}
+
+		drain(m_tap, m_totap);
+	}
+
+	drain(m_tap, m_totap);
+}
+
+void	NETSIM::stopio(void) {
+	if (!m_running)
+		return;
+	__atomic_store_n(&m_stop, true, __ATOMIC_RELEASE);
+	pthread_join(m_thread, NULL);
+	m_running = false;
+}
+
+// Picks the next packet to go to the design, if any is ready, and frames it
+// into m_rxframe
+bool	NETSIM::nextpacket(void) {
+	unsigned char	buf[NETMAXPKT];
+	const unsigned char	*pkt = NULL;
+	int		len = 0;
+	uint32_t	crc;
+
+	if ((m_replaylen > 0)&&(!m_waiting)&&(m_ticks >= m_replay_at)) {
+		pkt = m_replaybuf;
+		len = m_replaylen;
+	} else if ((m_fromtap)&&(shmring_used(m_fromtap) > 0)) {
+		uint16_t	ln;
+
+		shmring_read(m_fromtap, (char *)&ln, sizeof(ln));
+		shmring_read(m_fromtap, (char *)buf, ln);
+		pkt = buf;
+		len = ln;
+	} else
+		return false;
+
+	memset(m_rxframe, 0x55, NETPREAMBLE-1);
+	m_rxframe[NETPREAMBLE-1] = 0xd5;
+	memcpy(&m_rxframe[NETPREAMBLE], pkt, len);
+	if (len < NETMINPKT) {
+		memset(&m_rxframe[NETPREAMBLE+len], 0, NETMINPKT-len);
+		len = NETMINPKT;
+	}
+	crc = netcrc(&m_rxframe[NETPREAMBLE], len);
+	for(int k=0; k<NETCRCLN; k++)
+		m_rxframe[NETPREAMBLE+len+k] = (crc >> (8*k)) & 0x0ff;
+	m_rxlen = NETPREAMBLE + len + NETCRCLN;
+	m_rxpos = 0;
+
+	m_rxpkts++;
+	m_rxbytes += len;
+
+	if (pkt == m_replaybuf) {
+		if (m_lockstep) {
+			if (m_trips == 0)
+				m_first_ps = m_ticks * NETBYTE_PS;
+			m_waiting = true;
+		}
+		nextreplay();
+	}
+
+	return true;
+}
+
+// The design has just finished transmitting m_txframe
+void	NETSIM::received(void) {
+	int	start = 0, len;
+	const unsigned char	*pkt;
+
+	// Skip the preamble
+	while((start < m_txlen)&&(m_txframe[start] == 0x55))
+		start++;
+	if ((start >= m_txlen)||(m_txframe[start] != 0xd5)) {
+		m_badpkts++;
+		return;
+	}
+
+	pkt = &m_txframe[start+1];
+	len = m_txlen - start - 1 - NETCRCLN;
+	if ((len < 14)||(netcrc(pkt, len) != (uint32_t)(pkt[len]
+				| (pkt[len+1]<<8) | (pkt[len+2]<<16)
+				| (pkt[len+3]<<24)))) {
+		m_badpkts++;
+		return;
+	}
+
+	m_txpkts++;
+	m_txbytes += len;
+
+	if (m_capture)
+		wrpcap(pkt, len);
+
+	if (m_totap) {
+		uint16_t	ln = len;
+		char		buf[sizeof(ln)+NETMAXPKT];
+
+		if ((len <= NETMAXPKT)
+				&&(shmring_free(m_totap) >= sizeof(ln) + len)) {
+			memcpy(buf, &ln, sizeof(ln));
+			memcpy(&buf[sizeof(ln)], pkt, len);
+			shmring_write(m_totap, buf, sizeof(ln) + len);
+		}
+	}
+
+	if (m_waiting) {
+		m_waiting = false;
+		m_trips++;
+		m_last_ps = m_ticks * NETBYTE_PS;
+	}
+}
+
+void	NETSIM::operator()(const int tx_ctl, const int txd,
+		unsigned char &rx_dv, unsigned char &rxd) {
+	m_ticks++;
+
+	// Collect whatever the design is transmitting
+	if (tx_ctl) {
+		if (m_txlen < NETFRAMELN)
+			m_txframe[m_txlen++] = txd;
+		m_txactive = true;
+	} else if (m_txactive) {
+		received();
+		m_txactive = false;
+		m_txlen = 0;
+	}
+
+	if (!active()) {
+		// Loop the transmitter back to the receiver
+		rx_dv = tx_ctl;
+		rxd   = txd;
+		return;
+	}
+
+	if (m_rxpos < m_rxlen) {
+		rx_dv = 1;
+		rxd   = m_rxframe[m_rxpos++];
+		if (m_rxpos >= m_rxlen)
+			m_rxgap = NETIFG;
+		return;
+	}
+
+	rx_dv = 0;
+	rxd   = NETIDLE;
+	if (m_rxgap > 0)
+		m_rxgap--;
+	else
+		nextpacket();
+}
+
+void	NETSIM::stats(FILE *fp) {
+	fprintf(fp, "NETSIM: %lu packets (%lu bytes) in, "
+			"%lu packets (%lu bytes) out",
+		m_rxpkts, m_rxbytes, m_txpkts, m_txbytes);
+	if (m_badpkts > 0)
+		fprintf(fp, ", %lu bad", m_badpkts);
+	fprintf(fp, "\n");
+
+	if ((m_trips > 0)&&(m_last_ps > m_first_ps)) {
+		double	secs = (m_last_ps - m_first_ps) * 1e-12;
+
+		fprintf(fp, "NETSIM: %lu round trips in %.6f simulated "
+			"seconds, or %.1f per second\n",
+			m_trips, secs, m_trips / secs);
+	}
+}
+
+void	NETSIM::save(VerilatedSerialize &os) {
+	os.write(&m_ticks, sizeof(m_ticks));
+	os.write(&m_rxlen, sizeof(m_rxlen));
+	os.write(&m_rxpos, sizeof(m_rxpos));
+	os.write(&m_rxgap, sizeof(m_rxgap));
+	os.write(m_rxframe, m_rxlen);
+	os.write(&m_txlen, sizeof(m_txlen));
+	os.write(&m_txactive, sizeof(m_txactive));
+	os.write(m_txframe, m_txlen);
+}
+
+void	NETSIM::restore(VerilatedDeserialize &is) {
+	is.read(&m_ticks, sizeof(m_ticks));
+	is.read(&m_rxlen, sizeof(m_rxlen));
+	is.read(&m_rxpos, sizeof(m_rxpos));
+	is.read(&m_rxgap, sizeof(m_rxgap));
+	if ((m_rxlen < 0)||(m_rxlen > NETFRAMELN)
+			||(m_rxpos < 0)||(m_rxpos > m_rxlen)) {
+		fprintf(stderr, "ERR: NETSIM checkpoint has an invalid receive frame, %d of %d\n", m_rxpos, m_rxlen);
+		exit(EXIT_FAILURE);
+	}
+	is.read(m_rxframe, m_rxlen);
+	is.read(&m_txlen, sizeof(m_txlen));
+	is.read(&m_txactive, sizeof(m_txactive));
+	if ((m_txlen < 0)||(m_txlen > NETFRAMELN)) {
+		fprintf(stderr, "ERR: NETSIM checkpoint has an invalid transmit frame length, %d\n", m_txlen);
+		exit(EXIT_FAILURE);
+	}
+	is.read(m_txframe, m_txlen);
+}
@@ -0,0 +1,157 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename: 	netsim.h
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	A simulated network, attached to the (gigabit) RGMII port of
+//		the design.  The bytes the design transmits are framed into
+//	packets, which may be written to a pcap file and/or forwarded to a Linux
+//	TAP device.  Packets from a pcap file, or from the TAP device, are
+//	likewise framed into bytes and handed to the design.
+//
+//	With neither a pcap file nor a TAP device to read from, the network
+//	simply loops the design's transmitter back to its receiver, just as
+//	the simulation always has.
+//
+//	All TAP I/O takes place on a thread of its own, so that the simulation
+//	never waits on a system call.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of  the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#ifndef	NETSIM_H
+#define	NETSIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "shmbus.h"
+
+// The largest packet we'll handle, less its preamble and CRC
+#define	NETMAXPKT	1518
+// Room for the preamble, the smallest packet, and the CRC
+#define	NETPREAMBLE	8
+#define	NETMINPKT	60
+#define	NETCRCLN	4
+#define	NETFRAMELN	(NETPREAMBLE+NETMAXPKT+NETCRCLN)
+// The minimum gap between packets, in bytes (clocks)
+#define	NETIFG		12
+// The in-band status sent between packets: link up, gigabit, full duplex
+#define	NETIDLE		0x0dd
+// Time per byte (clock), at 1Gb/s
+#define	NETBYTE_PS	8000ul
+// How long the TAP thread waits for a packet, before checking whether the
+// simulation has any for it to send
+#define	NETIOWAIT_NS	100000
+
+class	VerilatedSerialize;
+class	VerilatedDeserialize;
+
+class	NETSIM	{
+	// The clock, counted in bytes
+	unsigned long	m_ticks;
+
+	// The frame (preamble, packet, and CRC) going into the design
+	unsigned char	m_rxframe[NETFRAMELN];
+	int		m_rxlen, m_rxpos, m_rxgap;
+
+	// The frame coming out of the design
+	unsigned char	m_txframe[NETFRAMELN];
+	int		m_txlen;
+	bool		m_txactive;
+
+	// pcap replay.  The next packet to replay waits in m_replaybuf, to
+	// be sent once the clock reaches m_replay_at.
+	FILE		*m_replay;
+	bool		m_replay_swap, m_replay_nsec, m_lockstep, m_waiting;
+	unsigned long	m_replay_start, m_replay_at, m_replay_first;
+	unsigned char	m_replaybuf[NETMAXPKT];
+	int		m_replaylen;
+
+	// pcap capture
+	FILE		*m_capture;
+
+	// The TAP device, and the rings between it and the simulation.  Each
+	// ring holds packets, each preceded by a two byte length.
+	int		m_tap;
+	SHMRING		*m_fromtap, *m_totap;
+	pthread_t	m_thread;
+	bool		m_running, m_stop;
+
+	// Statistics, printed to m_log when we're done
+	FILE		*m_log;
+	unsigned long	m_rxpkts, m_txpkts, m_rxbytes, m_txbytes, m_badpkts,
+			m_trips, m_first_ps, m_last_ps;
+
+	static	void	*iothread(void *net);
+	void	iorun(void);
+	void	stopio(void);
+
+	bool	nextreplay(void);
+	bool	nextpacket(void);
+	void	received(void);
+	void	wrpcap(const unsigned char *pkt, int len);
+public:
+	NETSIM(FILE *log = stdout);
+	~NETSIM(void);
+
+	// Replays the packets in the pcap file fname into the design.  The
+	// first is sent start_ps into the simulation, and the rest follow
+	// at the intervals recorded in the file.  Or, if lockstep is set,
+	// each waits instead for the design to answer the one before it.
+	void	replay(const char *fname, const unsigned long start_ps = 0,
+			const bool lockstep = false);
+
+	// Writes every packet the design transmits to the pcap file fname
+	void	capture(const char *fname);
+
+	// Bridges the design to the (existing) TAP device ifname
+	void	tap(const char *ifname);
+
+	// True if packets come from somewhere, rather than a loopback
+	bool	active(void) const { return (m_replay)||(m_tap >= 0); }
+
+	// Called on every (125MHz) clock, with the design's transmit outputs.
+	// Sets the design's receive inputs.
+	void	operator()(const int tx_ctl, const int txd,
+			unsigned char &rx_dv, unsigned char &rxd);
+
+	// Prints the packet counts and, for a lockstep replay, the rate of
+	// round trips through the design
+	void	stats(FILE *fp);
+
+	// Checkpoint support.  Any packet in flight is captured, but neither
+	// the pcap files nor the TAP device are.
+	void	save(VerilatedSerialize &os);
+	void	restore(VerilatedDeserialize &is);
+};
+
+#endif
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename: 	shmbussim.cpp
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	The simulation's half of the shared memory bus link.  See
+//		shmbussim.h for a description.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "shmbussim.h"
+
+SHMBUSSIM::SHMBUSSIM(const char *name) {
+	int	fd;
+	void	*ptr;
+
+	m_name = strdup(name);
+	m_rxpos = m_rxlen = 0;
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "ERR: Could not create shared memory, %s\n",
+			name);
+		perror("O/S Err:");
+		exit(EXIT_FAILURE);
+	}
+
+	if (ftruncate(fd, sizeof(SHMBUS)) != 0) {
+		perror("ERR: Could not size shared memory:");
+		exit(EXIT_FAILURE);
+	}
+
+	ptr = mmap(NULL, sizeof(SHMBUS), PROT_READ|PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		perror("ERR: Could not map shared memory:");
+		exit(EXIT_FAILURE);
+	}
+
+	m_shm = (SHMBUS *)ptr;
+
+	// Start from empty rings, and only then tell any host that might
+	// be looking that we're ready
+	m_shm->m_tofpga.m_head   = m_shm->m_tofpga.m_tail   = 0;
+	m_shm->m_fromfpga.m_head = m_shm->m_fromfpga.m_tail = 0;
+	__atomic_store_n(&m_shm->m_magic, SHMMAGIC, __ATOMIC_RELEASE);
+
+	printf("Bus available on shared memory, %s\n", name);
+}
+
+SHMBUSSIM::~SHMBUSSIM(void) {
+	__atomic_store_n(&m_shm->m_magic, 0, __ATOMIC_RELEASE);
+	munmap(m_shm, sizeof(SHMBUS));
+	shm_unlink(m_name);
+	free(m_name);
+}
+
+int	SHMBUSSIM::rx(void) {
+	if (m_rxpos >= m_rxlen) {
+		// Grab as many characters as we can at once, so we aren't
+		// touching the shared counters on every character
+		m_rxpos = 0;
+		m_rxlen = shmring_read(&m_shm->m_tofpga, m_rxbuf,
+					sizeof(m_rxbuf));
+		if (m_rxlen <= 0)
+			return -1;
+	}
+
+	return m_rxbuf[m_rxpos++] & 0x0ff;
+}
+
+void	SHMBUSSIM::tx(const char ch) {
+	shmring_write(&m_shm->m_fromfpga, &ch, 1);
+}
@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename: 	shmbussim.h
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	The simulation's half of the shared memory bus link.  This
+//		creates the block of shared memory described in
+//	sw/host/shmbus.h, and then hands the characters the host writes into it
+//	to the simulation, and the characters the simulation returns back to
+//	the host.  This replaces the network connection to DBLUARTSIM's
+//	command port, for when the host and simulation share a machine.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#ifndef	SHMBUSSIM_H
+#define	SHMBUSSIM_H
+
+#include "shmbus.h"
+
+class	SHMBUSSIM {
+	SHMBUS	*m_shm;
+	char	*m_name;
+	char	m_rxbuf[256];
+	int	m_rxpos, m_rxlen;
+public:
+	// Creates (or re-creates) a shared memory block with the given name.
+	// Host programs may then attach to it with SHMCOMMS(name).
+	SHMBUSSIM(const char *name);
+	~SHMBUSSIM(void);
+
+	// Returns the next character the host has sent, or -1 if there are
+	// none.  This never blocks.
+	int	rx(void);
+
+	// Returns true if there's no room to return another character to the
+	// host.
+	bool	full(void) { return shmring_free(&m_shm->m_fromfpga) == 0; }
+
+	// Returns a character to the host.  Check full() first, characters
+	// sent while full() are dropped.
+	void	tx(const char ch);
+};
+
+#endif
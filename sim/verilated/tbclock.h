@@ -41,8 +41,13 @@
 #ifndef	TBCLOCK_H
 #define	TBCLOCK_H
 
+#include <verilated_save.h>
+
 class	TBCLOCK	{
 	unsigned long	m_increment_ps, m_now_ps, m_last_posedge_ps, m_ticks;
+	// True if the last call to advance() landed on an edge of this clock,
+	// and clear_edge() hasn't been called since
+	bool		m_edge;
 
 public:
 	TBCLOCK(void) {
@@ -51,6 +56,7 @@ public:
 		m_now_ps = m_increment_ps+1;
 		m_last_posedge_ps = 0;
 		m_ticks = 0;
+		m_edge = false;
 	}
 
 	TBCLOCK(unsigned long increment_ps) {
@@ -65,6 +71,8 @@ public:
 		// Start with the clock low, waiting on a positive edge
 		m_now_ps = m_increment_ps+1;
 		m_last_posedge_ps = 0;
+		m_ticks = 0;
+		m_edge = false;
 	}
 
 	unsigned long	time_to_edge(void) {
@@ -129,23 +137,49 @@ public:
 			// a positive valued clock
 			m_last_posedge_ps += 2*m_increment_ps;
 			m_ticks++;
+			m_edge = (m_now_ps == m_last_posedge_ps);
 			return 1;
 		} else if (m_now_ps >= m_last_posedge_ps + m_increment_ps) {
 			// Negative half of the clock's duty cycle
+			m_edge = (m_now_ps == m_last_posedge_ps + m_increment_ps);
 			return 0;
-		} else
+		} else {
 			// Positive half of the clock's duty cycle
+			m_edge = false;
 			return 1;
+		}
+	}
+
+	// Checkpoint support.  The interval is saved as well, in case it was
+	// changed while the simulation was running.
+	void	save(VerilatedSerialize &os) {
+		os.write(&m_increment_ps, sizeof(m_increment_ps));
+		os.write(&m_now_ps, sizeof(m_now_ps));
+		os.write(&m_last_posedge_ps, sizeof(m_last_posedge_ps));
+		os.write(&m_ticks, sizeof(m_ticks));
+		os.write(&m_edge, sizeof(m_edge));
+	}
+
+	void	restore(VerilatedDeserialize &is) {
+		is.read(&m_increment_ps, sizeof(m_increment_ps));
+		is.read(&m_now_ps, sizeof(m_now_ps));
+		is.read(&m_last_posedge_ps, sizeof(m_last_posedge_ps));
+		is.read(&m_ticks, sizeof(m_ticks));
+		is.read(&m_edge, sizeof(m_edge));
 	}
 
+	// A scheduler that only advances a clock when it has an edge may
+	// use this to note that time has since moved on without it.
+	void	clear_edge(void) { m_edge = false; }
+
 	bool	rising_edge(void) {
-		if (m_now_ps == m_last_posedge_ps)
+		if ((m_edge)&&(m_now_ps == m_last_posedge_ps))
 			return true;
 		return false;
 	}
 
 	bool	falling_edge(void) {
-		if (m_now_ps == m_last_posedge_ps + m_increment_ps)
+		if ((m_edge)&&(m_now_ps == m_last_posedge_ps + m_increment_ps))
 			return true;
 		return false;
 	}
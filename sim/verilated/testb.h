@@ -44,16 +44,98 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#ifdef	TRACE_FST
+// Build with "make TRACE=fst" (in both rtl and here) to trace to an FST
+// file instead of a VCD.  Verilator's FST writer compresses as it goes.
+#include <verilated_fst_c.h>
+#define	TRACECLASS	VerilatedFstC
+#else
 #include <verilated_vcd_c.h>
+#include "tracefile.h"
+#define	TRACECLASS	VerilatedVcdC
+#endif
+#include <verilated_save.h>
 #include <tbclock.h>
 
+// The most clocks the scheduler within TESTB can handle
+#define	TBMAXCLOCKS	16
+
 template <class VA>	class TESTB {
+public:
+	// The type of a method to be called following the falling edge of a
+	// clock.  Any such method that changes the inputs to the core must
+	// leave m_changed set (it is set before the call).
+	typedef	void	(TESTB<VA>::*TICKFN)(void);
+private:
+	// Clock edges are scheduled via a binary heap, ordered by the time
+	// (m_next_ps) of each clock's next edge.  Only those clocks with
+	// an edge at the next time step are touched.
+	typedef	struct	{
+		TBCLOCK		*m_clk;
+		unsigned char	*m_pin;
+		TICKFN		m_tick;
+		unsigned long	m_last_ps, m_next_ps;
+	} TBCLKENT;
+
+	TBCLKENT	m_clocks[TBMAXCLOCKS];
+	int		m_nclocks, m_heap[TBMAXCLOCKS];
+	// The clocks with an edge at the current time step, in the order
+	// they were added
+	int		m_nedged, m_edged[TBMAXCLOCKS];
+	// Scheduler time.  Unlike m_time_ps, this is never reset.
+	unsigned long	m_sched_ps;
+#ifndef	TRACE_FST
+	// VCD traces are written to disk from a separate thread
+	TRACEFILE	*m_tracefile;
+#endif
+
+	bool	heaplt(const int a, const int b) const {
+		return m_clocks[m_heap[a]].m_next_ps
+				< m_clocks[m_heap[b]].m_next_ps;
+	}
+
+	void	heapswap(const int a, const int b) {
+		int	t = m_heap[a];
+		m_heap[a] = m_heap[b];
+		m_heap[b] = t;
+	}
+
+	// Restore the heap, following a change to the key at position k
+	void	heapdown(int k) {
+		while(2*k+1 < m_nclocks) {
+			int	c = 2*k+1;
+
+			if ((c+1 < m_nclocks)&&(heaplt(c+1, c)))
+				c++;
+			if (!heaplt(c, k))
+				break;
+			heapswap(c, k);
+			k = c;
+		}
+	}
+
+	void	heapup(int k) {
+		while((k > 0)&&(heaplt(k, (k-1)/2))) {
+			heapswap(k, (k-1)/2);
+			k = (k-1)/2;
+		}
+	}
+
 public:
 	VA	*m_core;
+	// Set whenever the core's inputs may have changed since its last
+	// evaluation.  Anything adjusting them between calls to tick(),
+	// other than the sim_*_tick() methods, must set this as well.
 	bool		m_changed;
-	VerilatedVcdC*	m_trace;
+	TRACECLASS*	m_trace;
 	bool		m_done;
 	uint64_t	m_time_ps;
+	// Only dump the trace while m_time_ps is within [m_trace_start_ps,
+	// m_trace_stop_ps).  If m_trigger_cycles is non-zero, dump only for
+	// the m_trigger_cycles cycles (of the first clock) following any
+	// time trace_trigger() returns true.
+	uint64_t	m_trace_start_ps, m_trace_stop_ps;
+	unsigned long	m_trigger_cycles, m_trigger_left;
 	// TBCLOCK is a clock support class, enabling multiclock simulation
 	// operation.
 	TBCLOCK	m_clk;
@@ -64,22 +146,65 @@ public:
 		m_core = new VA;
 		m_time_ps  = 0ul;
 		m_trace    = NULL;
+#ifndef	TRACE_FST
+		m_tracefile = NULL;
+#endif
+		m_trace_start_ps = 0;
+		m_trace_stop_ps  = -1;
+		m_trigger_cycles = 0;
+		m_trigger_left   = 0;
 		m_done     = false;
+		m_changed  = true;
+		m_nclocks  = 0;
+		m_nedged   = 0;
+		m_sched_ps = 0ul;
 		Verilated::traceEverOn(true);
 // Set the initial clock periods
 		m_clk.init(20000);	//   50.00 MHz
 		m_clk_125mhz.init(8000);	//  125.00 MHz
 		m_net1_rx_clk.init(8000);	//  125.00 MHz
+		addclock(m_clk, &m_core->i_clk, &TESTB<VA>::sim_clk_tick);
+		addclock(m_clk_125mhz, &m_core->i_clk_125mhz,
+			&TESTB<VA>::sim_clk_125mhz_tick);
+		addclock(m_net1_rx_clk, &m_core->i_net1_rx_clk,
+			&TESTB<VA>::sim_net1_rx_clk_tick);
+	}
+
+	// Adds a clock to the schedule.  pin is the core's input for this
+	// clock, and tick (if not NULL) is called following every falling
+	// edge.  A derived class may pass its own methods, as in
+	//	addclock(m_myclk, &m_core->i_myclk,
+	//		static_cast<TICKFN>(&MYTB::sim_myclk_tick));
+	void	addclock(TBCLOCK &clk, unsigned char *pin, TICKFN tick) {
+		TBCLKENT	*e;
+
+		assert(m_nclocks < TBMAXCLOCKS);
+		e = &m_clocks[m_nclocks];
+		e->m_clk  = &clk;
+		e->m_pin  = pin;
+		e->m_tick = tick;
+		e->m_last_ps = m_sched_ps;
+		e->m_next_ps = m_sched_ps + clk.time_to_edge();
+
+		m_heap[m_nclocks] = m_nclocks;
+		m_nclocks++;
+		heapup(m_nclocks-1);
 	}
 	virtual ~TESTB(void) {
-		if (m_trace) m_trace->close();
+		closetrace();
 		delete m_core;
 		m_core = NULL;
 	}
 
+	// Opens a trace file.  VCD files ending in .gz will be compressed.
 	virtual	void	opentrace(const char *vcdname) {
 		if (!m_trace) {
-			m_trace = new VerilatedVcdC;
+#ifdef	TRACE_FST
+			m_trace = new VerilatedFstC;
+#else
+			m_tracefile = new TRACEFILE;
+			m_trace = new VerilatedVcdC(m_tracefile);
+#endif
 			m_core->trace(m_trace, 99);
 			m_trace->spTrace()->set_time_resolution("ps");
 			m_trace->spTrace()->set_time_unit("ps");
@@ -87,6 +212,115 @@ public:
 		}
 	}
 
+	// Limit the trace to the times from start_ps up to stop_ps
+	void	trace_window(const uint64_t start_ps, const uint64_t stop_ps) {
+		m_trace_start_ps = start_ps;
+		m_trace_stop_ps  = stop_ps;
+	}
+
+	// Limit the trace to the ncycles following any trigger
+	void	trace_trigger_cycles(const unsigned long ncycles) {
+		m_trigger_cycles = ncycles;
+		m_trigger_left   = 0;
+	}
+
+	// Checkpoints.  save() and restore() capture the model along with the
+	// state of the scheduler and its clocks.  Test benches with peripheral
+	// models should extend them to capture those models as well.  The
+	// model may only be captured if it was built with SAVABLE=1 (i.e.
+	// verilated with --savable).  Tracing isn't captured.
+	virtual	void	save(VerilatedSerialize &os) {
+#ifdef	SAVABLE
+		os << *m_core;
+#endif
+		os.write(&m_time_ps, sizeof(m_time_ps));
+		os.write(&m_sched_ps, sizeof(m_sched_ps));
+		os.write(&m_changed, sizeof(m_changed));
+		os.write(&m_done, sizeof(m_done));
+		for(int k=0; k<m_nclocks; k++) {
+			m_clocks[k].m_clk->save(os);
+			os.write(&m_clocks[k].m_last_ps, sizeof(unsigned long));
+			os.write(&m_clocks[k].m_next_ps, sizeof(unsigned long));
+		}
+		os.write(m_heap, sizeof(m_heap));
+		os.write(&m_nedged, sizeof(m_nedged));
+		os.write(m_edged, sizeof(m_edged));
+	}
+
+	virtual	void	restore(VerilatedDeserialize &is) {
+#ifdef	SAVABLE
+		is >> *m_core;
+#endif
+		is.read(&m_time_ps, sizeof(m_time_ps));
+		is.read(&m_sched_ps, sizeof(m_sched_ps));
+		is.read(&m_changed, sizeof(m_changed));
+		is.read(&m_done, sizeof(m_done));
+		for(int k=0; k<m_nclocks; k++) {
+			m_clocks[k].m_clk->restore(is);
+			is.read(&m_clocks[k].m_last_ps, sizeof(unsigned long));
+			is.read(&m_clocks[k].m_next_ps, sizeof(unsigned long));
+		}
+		is.read(m_heap, sizeof(m_heap));
+		is.read(&m_nedged, sizeof(m_nedged));
+		is.read(m_edged, sizeof(m_edged));
+		// Whatever was in the model before, the inputs have changed
+		m_changed = true;
+	}
+
+	// Write a checkpoint to, or restore one from, the file fname
+	void	save_checkpoint(const char *fname) {
+		VerilatedSave	os;
+
+		checksavable();
+		os.open(fname);
+		if (!os.isOpen()) {
+			fprintf(stderr, "ERR: Could not open %s\n", fname);
+			exit(EXIT_FAILURE);
+		}
+		save(os);
+		os.close();
+	}
+
+	void	restore_checkpoint(const char *fname) {
+		VerilatedRestore	is;
+
+		checksavable();
+		is.open(fname);
+		if (!is.isOpen()) {
+			fprintf(stderr, "ERR: Could not open %s\n", fname);
+			exit(EXIT_FAILURE);
+		}
+		restore(is);
+		is.close();
+	}
+
+	void	checksavable(void) {
+#ifndef	SAVABLE
+		fprintf(stderr, "ERR: Checkpoints require a model built "
+			"with SAVABLE=1\n");
+		exit(EXIT_FAILURE);
+#endif
+	}
+
+	// Override this to return true on the condition of interest, to
+	// start a triggered capture.  It's checked following every time
+	// step while no capture is in progress.
+	virtual	bool	trace_trigger(void) {
+		return false;
+	}
+
+	// True if the current time step should go into the trace
+	bool	tracing(void) const {
+		if (!m_trace)
+			return false;
+		if ((m_time_ps < m_trace_start_ps)
+				||(m_time_ps >= m_trace_stop_ps))
+			return false;
+		if ((m_trigger_cycles)&&(m_trigger_left == 0))
+			return false;
+		return true;
+	}
+
 	void	trace(const char *vcdname) {
 		opentrace(vcdname);
 	}
@@ -97,55 +331,91 @@ public:
 			delete m_trace;
 			m_trace = NULL;
 		}
+#ifndef	TRACE_FST
+		if (m_tracefile) {
+			delete m_tracefile;
+			m_tracefile = NULL;
+		}
+#endif
 	}
 
 	virtual	void	eval(void) {
 		m_core->eval();
 	}
 
+	// Advance to the next clock edge.  Every clock with an edge at that
+	// time steps together, followed by a single evaluation.
 	virtual	void	tick(void) {
-		unsigned	mintime = m_clk.time_to_edge();
-
-		if (m_clk_125mhz.time_to_edge() < mintime)
-			mintime = m_clk_125mhz.time_to_edge();
-
-		if (m_net1_rx_clk.time_to_edge() < mintime)
-			mintime = m_net1_rx_clk.time_to_edge();
+		unsigned long	now, mintime;
+		bool		changed, dump;
 
+		assert(m_nclocks > 0);
+		now = m_clocks[m_heap[0]].m_next_ps;
+		mintime = now - m_sched_ps;
 		assert(mintime > 1);
 
+		// Those clocks that had an edge on the last step, don't now
+		for(int k=0; k<m_nedged; k++)
+			m_clocks[m_edged[k]].m_clk->clear_edge();
+		m_nedged = 0;
+
 		// Pre-evaluate, to give verilator a chance to settle any
-		// combinatorial logic thatthat may have changed since the
-		// last clockevaluation, and then record that in the trace.
-		eval();
-		if (m_trace) m_trace->dump(m_time_ps+1);
+		// combinatorial logic that may have changed since the
+		// last clock evaluation, and then record that in the trace.
+		// If nothing has touched the core's inputs since then, there's
+		// nothing to settle.
+		dump = tracing();
+		if ((m_changed)||(dump)) {
+			eval();
+			if (dump) m_trace->dump(m_time_ps+1);
+			m_changed = false;
+		}
 
-		// Advance each clock
-		m_core->i_clk = m_clk.advance(mintime);
-		m_core->i_clk_125mhz = m_clk_125mhz.advance(mintime);
-		m_core->i_net1_rx_clk = m_net1_rx_clk.advance(mintime);
+		// Advance each clock with an edge at this time
+		while(m_clocks[m_heap[0]].m_next_ps == now) {
+			int		id = m_heap[0], k;
+			TBCLKENT	*e = &m_clocks[id];
 
+			*e->m_pin = e->m_clk->advance(now - e->m_last_ps);
+			e->m_last_ps = now;
+			e->m_next_ps = now + e->m_clk->time_to_edge();
+			heapdown(0);
+
+			for(k=m_nedged; (k>0)&&(m_edged[k-1] > id); k--)
+				m_edged[k] = m_edged[k-1];
+			m_edged[k] = id;
+			m_nedged++;
+		}
+
+		m_sched_ps = now;
 		m_time_ps += mintime;
 		eval();
+
+		if ((m_trigger_cycles)&&(m_trace)) {
+			if (m_trigger_left == 0) {
+				if (trace_trigger())
+					m_trigger_left = m_trigger_cycles;
+			} else if (m_clocks[0].m_clk->rising_edge())
+				m_trigger_left--;
+		}
+
 		// If we are keeping a trace, dump the current state to that
-		// trace now
-		if (m_trace) {
+		// trace now.  There's no need to flush it, closetrace() will
+		// do that.
+		if (tracing())
 			m_trace->dump(m_time_ps);
-			m_trace->flush();
-		}
 
-		if (m_clk.falling_edge()) {
-			m_changed = true;
-			sim_clk_tick();
-		}
-		if (m_clk_125mhz.falling_edge()) {
-			m_changed = true;
-			sim_clk_125mhz_tick();
-		}
-		if (m_net1_rx_clk.falling_edge()) {
-			m_changed = true;
-			sim_net1_rx_clk_tick();
+		changed = false;
+		for(int k=0; k<m_nedged; k++) {
+			TBCLKENT	*e = &m_clocks[m_edged[k]];
+
+			if ((e->m_tick)&&(e->m_clk->falling_edge())) {
+				m_changed = true;
+				(this->*e->m_tick)();
+				changed = (changed)||(m_changed);
+			}
 		}
+		m_changed = changed;
 	}
 
 	virtual	void	sim_clk_tick(void) {
@@ -181,8 +451,10 @@ public:
 
 	virtual	void	reset(void) {
 		m_core->i_reset = 1;
+		m_changed = true;
 		tick();
 		m_core->i_reset = 0;
+		m_changed = true;
 		// printf("RESET\n");
 	}
 };
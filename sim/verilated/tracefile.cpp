@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename: 	tracefile.cpp
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	Writes Verilator's VCD traces from a background thread.  See
+//		tracefile.h for a description.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of  the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "tracefile.h"
+
+TRACEFILE::TRACEFILE(void) {
+	m_fd = -1;
+	m_gz = NULL;
+	for(int k=0; k<TFNBUFS; k++) {
+		m_buf[k] = new char[TFBUFLN];
+		m_len[k] = 0;
+	}
+	m_head = m_tail = 0;
+	m_fill = 0;
+	m_closing = false;
+	m_running = false;
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_cond, NULL);
+}
+
+TRACEFILE::~TRACEFILE(void) {
+	close();
+	for(int k=0; k<TFNBUFS; k++)
+		delete[] m_buf[k];
+	pthread_mutex_destroy(&m_lock);
+	pthread_cond_destroy(&m_cond);
+}
+
+bool	TRACEFILE::open(const std::string &name) {
+	int	ln = name.size();
+
+	close();
+
+	m_fd = ::open(name.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_LARGEFILE,
+			0644);
+	if (m_fd < 0) {
+		fprintf(stderr, "ERR: Could not open %s for tracing\n",
+			name.c_str());
+		perror("O/S Err:");
+		return false;
+	}
+
+	if ((ln > 3)&&(name.compare(ln-3, 3, ".gz") == 0)) {
+		// Compress quickly.  Higher levels cost far more time than
+		// they save in space on a trace.
+		m_gz = gzdopen(m_fd, "wb1");
+		if (m_gz == NULL) {
+			fprintf(stderr, "ERR: Could not compress %s\n",
+				name.c_str());
+			::close(m_fd);
+			m_fd = -1;
+			return false;
+		}
+	}
+
+	m_head = m_tail = 0;
+	m_fill = 0;
+	m_closing = false;
+	if (pthread_create(&m_thread, NULL, writer, this) != 0) {
+		fprintf(stderr, "ERR: Could not start the trace writer\n");
+		exit(EXIT_FAILURE);
+	}
+	m_running = true;
+
+	return true;
+}
+
+void	TRACEFILE::close(void) {
+	if (!m_running)
+		return;
+
+	// Hand off whatever remains, and then wait for the writer to finish
+	handoff();
+	pthread_mutex_lock(&m_lock);
+	m_closing = true;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_lock);
+	pthread_join(m_thread, NULL);
+	m_running = false;
+
+	if (m_gz)
+		gzclose(m_gz);	// Also closes m_fd
+	else
+		::close(m_fd);
+	m_gz = NULL;
+	m_fd = -1;
+}
+
+// Pass the buffer being filled on to the writer.  If every buffer is already
+// waiting on the writer, we'll need to wait for it first.
+void	TRACEFILE::handoff(void) {
+	if (m_fill == 0)
+		return;
+
+	pthread_mutex_lock(&m_lock);
+	m_len[m_head % TFNBUFS] = m_fill;
+	m_head++;
+	pthread_cond_broadcast(&m_cond);
+	while(m_head - m_tail >= TFNBUFS)
+		pthread_cond_wait(&m_cond, &m_lock);
+	pthread_mutex_unlock(&m_lock);
+
+	m_fill = 0;
+}
+
+ssize_t	TRACEFILE::write(const char *bufp, ssize_t len) {
+	ssize_t	nw = 0;
+
+	while(nw < len) {
+		int	ln = len - nw;
+
+		if (ln > TFBUFLN - m_fill)
+			ln = TFBUFLN - m_fill;
+		memcpy(&m_buf[m_head % TFNBUFS][m_fill], &bufp[nw], ln);
+		m_fill += ln;
+		nw += ln;
+
+		if (m_fill >= TFBUFLN)
+			handoff();
+	}
+
+	return len;
+}
+
+void	*TRACEFILE::writer(void *tf) {
+	((TRACEFILE *)tf)->run();
+	return NULL;
+}
+
+void	TRACEFILE::run(void) {
+	pthread_mutex_lock(&m_lock);
+	while(1) {
+		while((m_tail == m_head)&&(!m_closing))
+			pthread_cond_wait(&m_cond, &m_lock);
+		if (m_tail == m_head)
+			break;
+
+		// The simulation won't touch this buffer until we've
+		// advanced m_tail past it, so we can write it unlocked
+		char	*buf = m_buf[m_tail % TFNBUFS];
+		int	len  = m_len[m_tail % TFNBUFS], nw = 0;
+
+		pthread_mutex_unlock(&m_lock);
+		if (m_gz) {
+			if (gzwrite(m_gz, buf, len) != len)
+				fprintf(stderr, "ERR: Trace write failed\n");
+		} else while(nw < len) {
+			int	ln = ::write(m_fd, &buf[nw], len-nw);
+
+			if (ln <= 0) {
+				perror("ERR: Trace write failed");
+				break;
+			}
+			nw += ln;
+		}
+		pthread_mutex_lock(&m_lock);
+
+		m_tail++;
+		pthread_cond_broadcast(&m_cond);
+	}
+	pthread_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename: 	tracefile.h
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	A file for Verilator's VCD trace writer, which gets the actual
+//		writing (and compression) off of the simulation's thread.
+//	Verilator hands us its trace in large blocks.  We copy these into one
+//	of a small set of buffers and return.  A background thread then takes
+//	each full buffer and writes it to disk, compressing it along the way
+//	(with zlib) if the file name ends in ".gz".  GTKWave can read such
+//	compressed VCD files directly.
+//
+//	The simulation only ever waits on the writer if it gets more than
+//	TFNBUFS buffers ahead of it.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of  the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#ifndef	TRACEFILE_H
+#define	TRACEFILE_H
+
+#include <pthread.h>
+#include <zlib.h>
+#include <string>
+#include <verilated_vcd_c.h>
+
+// The number of buffers, and the size of each
+#define	TFNBUFS	8
+#define	TFBUFLN	(1<<20)
+
+class	TRACEFILE : public VerilatedVcdFile {
+	int		m_fd;
+	gzFile		m_gz;
+
+	// Buffers are filled by the simulation, m_head counting those
+	// handed to the writer, and emptied by the writer, m_tail counting
+	// those written.  m_fill is the number of characters in the buffer
+	// currently being filled, m_buf[m_head % TFNBUFS].
+	char		*m_buf[TFNBUFS];
+	int		m_len[TFNBUFS];
+	unsigned	m_head, m_tail;
+	int		m_fill;
+	bool		m_closing, m_running;
+
+	pthread_t	m_thread;
+	pthread_mutex_t	m_lock;
+	pthread_cond_t	m_cond;
+
+	static	void	*writer(void *tf);
+	void	run(void);
+	void	handoff(void);
+public:
+	TRACEFILE(void);
+	virtual	~TRACEFILE(void);
+
+	// The VerilatedVcdFile interface
+	virtual	bool	open(const std::string &name);
+	virtual	void	close(void);
+	virtual	ssize_t	write(const char *bufp, ssize_t len);
+};
+
+#endif
@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename:	busstats.cpp
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	Collects, and then reports on, the performance of the debugging
+//		bus.  See busstats.h for a description.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "busstats.h"
+
+static	const char	*opname[BS_NOPS] = {
+	"readio", "writeio", "readi", "readz", "writei", "writez", "complete"
+};
+
+static	unsigned long	clockus(void) {
+	struct	timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+BUSSTATS::BUSSTATS(void) {
+	memset(m_op, 0, sizeof(m_op));
+	m_wrraw = m_wrtbl = m_wrruns = m_wrrunwords = 0;
+	m_rdraw = m_rdtbl = m_rdltbl = 0;
+	m_txchars = m_rxchars = m_buserrs = 0;
+	m_start = clockus();
+}
+
+unsigned long	BUSSTATS::now(void) const {
+	return clockus() - m_start;
+}
+
+void	BUSSTATS::record(const BSOP op, const unsigned long t0,
+		const int nwords, const bool err) {
+	OPSTAT		*s = &m_op[op];
+	unsigned long	dt = now() - t0;
+	int		bin;
+
+	s->m_count++;
+	if (err)
+		s->m_errs++;
+	else
+		s->m_words += nwords;
+	if ((s->m_count == 1)||(dt < s->m_min))
+		s->m_min = dt;
+	if (dt > s->m_max)
+		s->m_max = dt;
+	s->m_total += dt;
+
+	for(bin=0; (bin < BSHIST-1)&&((dt >> (bin+1)) != 0); bin++)
+		;
+	s->m_hist[bin]++;
+}
+
+double	BUSSTATS::wordrate(void) const {
+	unsigned long	words = 0, us = 0;
+
+	// complete() is called from within readv_scatter() and
+	// writev_scatter(), but never from within any of the others.  Hence,
+	// no time is counted twice.
+	for(int k=0; k<BS_NOPS; k++) {
+		words += m_op[k].m_words;
+		us    += m_op[k].m_total;
+	}
+
+	return (us > 0) ? words * 1e6 / us : 0.0;
+}
+
+double	BUSSTATS::wrratio(void) const {
+	unsigned long	raw, used;
+
+	raw  = 6 * (m_wrraw + m_wrtbl + m_wrrunwords);
+	used = 6 * m_wrraw + 2 * m_wrtbl + 6 * m_wrruns;
+	return (used > 0) ? (double)raw / used : 1.0;
+}
+
+double	BUSSTATS::rdratio(void) const {
+	unsigned long	raw, used;
+
+	raw  = 6 * (m_rdraw + m_rdtbl + m_rdltbl);
+	used = 6 * m_rdraw + m_rdtbl + 2 * m_rdltbl;
+	return (used > 0) ? (double)raw / used : 1.0;
+}
+
+void	BUSSTATS::print(FILE *fp, const unsigned long nread,
+		const unsigned long nwrit) const {
+	unsigned long	nwr = m_wrraw + m_wrtbl + m_wrrunwords,
+			nrd = m_rdraw + m_rdtbl + m_rdltbl;
+
+	fprintf(fp, "BUS-STATS: %.3f seconds, %.1f words/s while busy, "
+			"%ld bus errors\n",
+		now() / 1e6, wordrate(), m_buserrs);
+	fprintf(fp, "%-9s %8s %9s %5s %10s %10s %10s\n", "Op", "Count",
+		"Words", "Errs", "Min(us)", "Avg(us)", "Max(us)");
+	for(int k=0; k<BS_NOPS; k++) {
+		const OPSTAT	*s = &m_op[k];
+
+		if (s->m_count == 0)
+			continue;
+		fprintf(fp, "%-9s %8ld %9ld %5ld %10ld %10.1f %10ld\n",
+			opname[k], s->m_count, s->m_words, s->m_errs,
+			s->m_min, (double)s->m_total / s->m_count, s->m_max);
+
+		// The histogram, from the first bin used to the last
+		int	lo = 0, hi = BSHIST-1;
+		while((lo < hi)&&(s->m_hist[lo] == 0))
+			lo++;
+		while((hi > lo)&&(s->m_hist[hi] == 0))
+			hi--;
+		fprintf(fp, "%9s", "");
+		for(int b=lo; b<=hi; b++)
+			fprintf(fp, " <%ldus:%ld", 2ul<<b, s->m_hist[b]);
+		fprintf(fp, "\n");
+	}
+
+	fprintf(fp, "Writes: %ld words, %ld raw, %ld from table (%.1f%%), "
+			"%ld in %ld runs, %.2f:1 compression\n",
+		nwr, m_wrraw, m_wrtbl,
+		(nwr > 0) ? 100.0 * m_wrtbl / nwr : 0.0,
+		m_wrrunwords, m_wrruns, wrratio());
+	fprintf(fp, "Reads:  %ld words, %ld raw, %ld from table (%.1f%%), "
+			"%.2f:1 compression\n",
+		nrd, m_rdraw, m_rdtbl + m_rdltbl,
+		(nrd > 0) ? 100.0 * (m_rdtbl + m_rdltbl) / nrd : 0.0,
+		rdratio());
+	fprintf(fp, "Characters: %ld sent, %ld received\n",
+		m_txchars, m_rxchars);
+	fprintf(fp, "Bytes: %ld written, %ld read\n", nwrit, nread);
+}
+
+void	BUSSTATS::json(FILE *fp, const unsigned long nread,
+		const unsigned long nwrit) const {
+	fprintf(fp, "{\n\t\"seconds\": %.6f,\n\t\"words_per_second\": %.1f,\n"
+			"\t\"bus_errors\": %ld,\n",
+		now() / 1e6, wordrate(), m_buserrs);
+
+	fprintf(fp, "\t\"ops\": {");
+	for(int k=0, first=1; k<BS_NOPS; k++) {
+		const OPSTAT	*s = &m_op[k];
+
+		if (s->m_count == 0)
+			continue;
+		fprintf(fp, "%s\n\t\t\"%s\": { \"count\": %ld, \"words\": %ld, "
+				"\"errors\": %ld, \"min_us\": %ld, "
+				"\"total_us\": %ld, \"max_us\": %ld,\n"
+				"\t\t\t\"hist_us\": [",
+			(first) ? "" : ",", opname[k],
+			s->m_count, s->m_words, s->m_errs,
+			s->m_min, s->m_total, s->m_max);
+		for(int b=0; b<BSHIST; b++)
+			fprintf(fp, "%s%ld", (b) ? ", " : "", s->m_hist[b]);
+		fprintf(fp, "] }");
+		first = 0;
+	} fprintf(fp, "\n\t},\n");
+
+	fprintf(fp, "\t\"write\": { \"raw\": %ld, \"table\": %ld, "
+			"\"runs\": %ld, \"run_words\": %ld, "
+			"\"compression\": %.3f },\n",
+		m_wrraw, m_wrtbl, m_wrruns, m_wrrunwords, wrratio());
+	fprintf(fp, "\t\"read\": { \"raw\": %ld, \"table\": %ld, "
+			"\"long_table\": %ld, \"compression\": %.3f },\n",
+		m_rdraw, m_rdtbl, m_rdltbl, rdratio());
+	fprintf(fp, "\t\"chars_sent\": %ld,\n\t\"chars_received\": %ld,\n"
+			"\t\"bytes_written\": %ld,\n\t\"bytes_read\": %ld\n}\n",
+		m_txchars, m_rxchars, nwrit, nread);
+}
+
+void	BUSSTATS::report(const unsigned long nread,
+		const unsigned long nwrit) const {
+	const char	*name = getenv(FPGASTATS);
+	FILE		*fp;
+	int		ln;
+
+	if ((!name)||(!name[0]))
+		return;
+
+	if (strcmp(name, "1") == 0) {
+		print(stderr, nread, nwrit);
+		return;
+	}
+
+	fp = fopen(name, "w");
+	if (!fp) {
+		fprintf(stderr, "ERR: Could not open %s for bus statistics\n",
+			name);
+		return;
+	}
+
+	ln = strlen(name);
+	if ((ln > 5)&&(strcmp(&name[ln-5], ".json") == 0))
+		json(fp, nread, nwrit);
+	else
+		print(fp, nread, nwrit);
+	fclose(fp);
+}
@@ -0,0 +1,142 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename:	busstats.h
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	Keeps track of how well the debugging bus is performing: how
+//		long each kind of bus operation takes (as a histogram), how
+//	many words get moved, how well those words compress, and how many bus
+//	errors are returned.  This is enough to tell whether a slow program is
+//	limited by the latency of each round trip, or by the bandwidth of the
+//	link.
+//
+//	TTYBUS keeps one of these, and reports it when it is destroyed if the
+//	FPGASTATS environment variable is set:
+//
+//		FPGASTATS=1	Print a summary to stderr
+//		FPGASTATS=name	Write the summary to the file "name", in
+//				JSON if name ends in ".json"
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#ifndef	BUSSTATS_H
+#define	BUSSTATS_H
+
+#include <stdio.h>
+
+// The environment variable controlling whether (and where) we report
+#define	FPGASTATS	"FPGASTATS"
+
+// The number of latency histogram bins.  Bin k counts operations taking
+// between 2^k and 2^(k+1) microseconds, save that bin zero also counts
+// anything faster, and the last bin anything slower.
+#define	BSHIST	24
+
+// The operations we time
+typedef	enum	{
+	BS_READIO = 0, BS_WRITEIO, BS_READI, BS_READZ, BS_WRITEI, BS_WRITEZ,
+	BS_COMPLETE, BS_NOPS
+} BSOP;
+
+class	BUSSTATS {
+	unsigned long	m_start;
+public:
+	typedef	struct	{
+		unsigned long	m_count, m_words, m_errs;
+		// Times, in microseconds
+		unsigned long	m_total, m_min, m_max;
+		unsigned long	m_hist[BSHIST];
+	} OPSTAT;
+
+	OPSTAT		m_op[BS_NOPS];
+
+	// How each value written was encoded: as a raw (six character)
+	// codeword, as a (two character) reference to the write table, or
+	// as part of a (six character) stride run
+	unsigned long	m_wrraw, m_wrtbl, m_wrruns, m_wrrunwords;
+
+	// How each value read was encoded: raw (six characters), or as a
+	// one or two character reference to the read table
+	unsigned long	m_rdraw, m_rdtbl, m_rdltbl;
+
+	// Characters sent and received, before any binary packing, and the
+	// number of bus errors returned
+	unsigned long	m_txchars, m_rxchars, m_buserrs;
+
+	BUSSTATS(void);
+
+	// Microseconds since we were created
+	unsigned long	now(void) const;
+
+	// Record an operation, begun at time t0, that moved nwords.  If err
+	// is set, the operation ended in an error.
+	void	record(const BSOP op, const unsigned long t0, const int nwords,
+			const bool err);
+
+	// Words moved per second, counting only the time spent within bus
+	// operations
+	double	wordrate(void) const;
+	// Compression ratios: characters a raw encoding would've taken,
+	// divided by the characters actually used, for values written and read
+	double	wrratio(void) const;
+	double	rdratio(void) const;
+
+	// Write a summary, as text or as JSON.  nread and nwrit are the bytes
+	// actually read from and written to the device.
+	void	print(FILE *fp, const unsigned long nread,
+			const unsigned long nwrit) const;
+	void	json(FILE *fp, const unsigned long nread,
+			const unsigned long nwrit) const;
+
+	// Report to wherever FPGASTATS says, if anywhere
+	void	report(const unsigned long nread,
+			const unsigned long nwrit) const;
+};
+
+// Times a bus operation from construction to destruction.  If done() isn't
+// called before the timer is destroyed, the operation is recorded as having
+// failed--as when a BUSERR is thrown through it.
+class	BUSTIMER {
+	BUSSTATS	&m_stats;
+	BSOP		m_op;
+	unsigned long	m_t0;
+	int		m_nwords;
+	bool		m_done;
+public:
+	BUSTIMER(BUSSTATS &stats, const BSOP op, const int nwords)
+		: m_stats(stats), m_op(op), m_nwords(nwords), m_done(false) {
+		m_t0 = m_stats.now();
+	}
+	~BUSTIMER(void) { m_stats.record(m_op, m_t0, m_nwords, !m_done); }
+	void	done(void) { m_done = true; }
+};
+
+#endif
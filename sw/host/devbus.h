@@ -57,7 +57,15 @@ typedef	unsigned int	uint32;
 class	BUSERR {
 public:
 	uint32 addr;
-	BUSERR(const uint32 a) : addr(a) {};
+	// Errors thrown by complete() also give the index, within the queue,
+	// of the transaction that failed, and the number of queued
+	// transactions that were sent to the device.  Those before index
+	// completed.  Those from index up to nsent were sent, and may have
+	// been executed, but their results are lost.  The rest were never
+	// sent.  An index of -1 means nothing in the queue was sent.
+	int	index, nsent;
+	BUSERR(const uint32 a, const int idx = -1, const int ns = 0)
+		: addr(a), index(idx), nsent(ns) {};
 };
 
 class	DEVBUS {
@@ -120,6 +128,54 @@ public:
 	//
 	virtual	void	writez(const BUSW a, const int len, const BUSW *buf) = 0;
 
+	// Read a series of values from an arbitrary (scattered) set of
+	// addresses.
+	//	addrs is a list of n addresses to read from
+	//	out is a pointer to a place to store the n values once read
+	// This is equivalent to:
+	//	for(int i=0; i<n; i++)
+	//		out[i] = readio(addrs[i]);
+	// only our implementation issues all of the reads as one burst.
+	virtual	void	readv_scatter(const BUSW *addrs, const int n,
+				BUSW *out) {
+		for(int i=0; i<n; i++)
+			out[i] = readio(addrs[i]);
+	}
+
+	// Write a series of values to an arbitrary (scattered) set of
+	// addresses.  This is equivalent to:
+	//	for(int i=0; i<n; i++)
+	//		writeio(addrs[i], vals[i]);
+	// only (again) it's faster in our implementation.
+	virtual	void	writev_scatter(const BUSW *addrs, const int n,
+				const BUSW *vals) {
+		for(int i=0; i<n; i++)
+			writeio(addrs[i], vals[i]);
+	}
+
+	// Queue a write, to be issued later together with any other queued
+	// reads or writes.  The write is only guaranteed to have taken place
+	// once complete() returns.  This is equivalent to writeio(a, v),
+	// only it needn't wait on a round trip to the device before
+	// returning.  The default implementation simply calls writeio().
+	virtual	void	queue_write(const BUSW a, const BUSW v) {
+		writeio(a, v); }
+
+	// Queue a read.  The value read from address a will be placed into
+	// *v, but only once complete() returns.  Until then, *v must remain
+	// a valid place to write to.  The default implementation simply
+	// calls readio().
+	virtual	void	queue_read(const BUSW a, BUSW *v) {
+		*v = readio(a); }
+
+	// Issue any queued reads and writes, in the order they were queued,
+	// and then wait for all of them to complete.  Our implementation
+	// packs these into as few round trips as it can.  Should any
+	// transaction return a bus error, the remainder of the queue is
+	// abandoned and a BUSERR is thrown with the failing address, its
+	// index within the queue, and the number of transactions sent.
+	virtual	void	complete(void) { }
+
 	// Query whether or not an interrupt has taken place
 	virtual	bool	poll(void) = 0;
 
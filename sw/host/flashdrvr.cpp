@@ -45,6 +45,7 @@
 #include <string.h>
 #include <signal.h>
 #include <assert.h>
+#include <time.h>
 
 #include "port.h"
 #include "design.h"
@@ -85,6 +86,84 @@ static const unsigned	F_RESET = (CFG_USERMODE|0x0ff),
 
 const	bool	HIGH_SPEED = false;
 
+// The datasheet's (maximum) sector erase and page program times, in
+// microseconds.  These set how long we wait before asking the flash whether
+// it has finished, and how often we ask thereafter.
+#ifndef	FLASH_tSE_US
+#define	FLASH_tSE_US	1500000
+#endif
+#ifndef	FLASH_tPP_US
+#define	FLASH_tPP_US	1200
+#endif
+
+static unsigned long	clockus(void) {
+	struct	timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+//
+// Encode a sector erase command, together with the write enable that must
+// precede it, into cmd[].  Returns the number of words used.
+//
+static unsigned	erase_cmd(DEVBUS::BUSW *cmd, const unsigned flashaddr) {
+	unsigned	n = 0;
+
+	// Write enable
+	cmd[n++] = F_END;
+	cmd[n++] = F_WREN;
+	cmd[n++] = F_END;
+	// Then the sector erase command, and the sector's address
+	cmd[n++] = F_SE;
+	cmd[n++] = CFG_USERMODE | ((flashaddr>>16)&0x0ff);
+	cmd[n++] = CFG_USERMODE | ((flashaddr>> 8)&0x0ff);
+	cmd[n++] = CFG_USERMODE | ((flashaddr    )&0x0ff);
+	cmd[n++] = F_END;
+
+	return n;
+}
+
+//
+// Encode a page program command, from write enable through the last data
+// byte, into cmd[], which must have room for 8+PGLENB words.  Returns the
+// number of words used.
+//
+static unsigned	program_cmd(DEVBUS::BUSW *cmd, const unsigned flashaddr,
+		const unsigned len, const char *data) {
+	unsigned	n = 0;
+
+	// Write enable
+	cmd[n++] = F_END;
+	cmd[n++] = F_WREN;
+	cmd[n++] = F_END;
+
+#ifdef	QSPI_FLASH
+	// Issue the quad page program command.  The command and address
+	// still go out one bit at a time, but the data then goes out four
+	// bits at a time.
+	cmd[n++] = F_QPP;
+#else
+	// Issue the page program command
+	cmd[n++] = F_PP;
+#endif
+	// The address of the page to be programmed
+	cmd[n++] = CFG_USERMODE|((flashaddr>>16)&0x0ff);
+	cmd[n++] = CFG_USERMODE|((flashaddr>> 8)&0x0ff);
+	cmd[n++] = CFG_USERMODE|((flashaddr    )&0x0ff);
+	// Write the page data itself
+	for(unsigned i=0; i<len; i++)
+#ifdef	QSPI_FLASH
+		cmd[n++] = CFG_USERMODE | CFG_QSPEED | CFG_WEDIR
+				| (data[i] & 0x0ff);
+#else
+		cmd[n++] = CFG_USERMODE | CFG_WEDIR | (data[i] & 0x0ff);
+#endif
+	cmd[n++] = F_END;
+
+	return n;
+}
+
 #ifdef	R_FLASHSCOPE // Scope for the eqspi flash driver
 # define SETSCOPE m_fpga->writeio(R_FLASHSCOPE, 8180)
 #else
@@ -94,6 +173,8 @@ const	bool	HIGH_SPEED = false;
 FLASHDRVR::FLASHDRVR(DEVBUS *fpga) : m_fpga(fpga),
 		m_debug(false), m_id(FLASH_UNKNOWN) {
 	m_debug = true;
+	m_issued = 0;
+	m_npolls = 0;
 }
 
 unsigned FLASHDRVR::flashid(void) {
@@ -101,23 +182,25 @@ unsigned FLASHDRVR::flashid(void) {
 printf("No flash\n");
 	return FLASH_UNKNOWN;
 #else
-	unsigned	r;
+	DEVBUS::BUSW	id[4];
 	if (m_id != FLASH_UNKNOWN)
 		return m_id;
 
 // printf("Getting ID\n");
 	take_offline();
 
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | 0x9f);
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | 0x00);
-	r = m_fpga->readio(R_FLASHCFG) & 0x0ff;
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | 0x00);
-	r = (r<<8) | (m_fpga->readio(R_FLASHCFG) & 0x0ff);
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | 0x00);
-	r = (r<<8) | (m_fpga->readio(R_FLASHCFG) & 0x0ff);
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | 0x00);
-	r = (r<<8) | (m_fpga->readio(R_FLASHCFG) & 0x0ff);
-	m_id = r;
+	// Queue the whole ID exchange, so it costs one round trip rather
+	// than one per byte
+	m_fpga->queue_write(R_FLASHCFG, CFG_USERMODE | 0x9f);
+	for(int k=0; k<4; k++) {
+		m_fpga->queue_write(R_FLASHCFG, CFG_USERMODE | 0x00);
+		m_fpga->queue_read(R_FLASHCFG, &id[k]);
+	}
+	m_fpga->complete();
+
+	m_id = 0;
+	for(int k=0; k<4; k++)
+		m_id = (m_id<<8) | (id[k] & 0x0ff);
 	place_online();
 
 
@@ -128,15 +211,13 @@ printf("No flash\n");
 
 void	FLASHDRVR::take_offline(void) {
 #ifdef	R_FLASHCFG
+	static const DEVBUS::BUSW	cmd[] = {
+		F_END,
+		F_RESET, F_RESET, F_RESET, F_RESET, F_RESET, F_RESET,
+		F_END };
+
 // printf("Take offline\n");
-	m_fpga->writeio(R_FLASHCFG, F_END);
-	m_fpga->writeio(R_FLASHCFG, F_RESET);
-	m_fpga->writeio(R_FLASHCFG, F_RESET);
-	m_fpga->writeio(R_FLASHCFG, F_RESET);
-	m_fpga->writeio(R_FLASHCFG, F_RESET);
-	m_fpga->writeio(R_FLASHCFG, F_RESET);
-	m_fpga->writeio(R_FLASHCFG, F_RESET);
-	m_fpga->writeio(R_FLASHCFG, F_END);
+	m_fpga->writez(R_FLASHCFG, sizeof(cmd)/sizeof(cmd[0]), cmd);
 #endif
 }
 
@@ -163,52 +244,159 @@ void	FLASHDRVR::restore_quadio(void) {
 #ifdef	QSPI_FLASH
 	//static const	uint32_t	DUAL_IO_READ     = CFG_USERMODE|0xbb;
 	static	const	uint32_t	QUAD_IO_READ     = CFG_USERMODE|0xeb;
+	DEVBUS::BUSW	cmd[16+FLASH_NDUMMY/2];
+	int		n = 0;
 
-	m_fpga->writeio(R_FLASHCFG, F_END);
+	// Build the entire command sequence, and then send it all at once
+	cmd[n++] = F_END;
 	if (MICRON_FLASHID == m_id) {
 		// printf("MICRON-flash\n");
 		// Need to enable XIP first for MICRON's flash
 		//
 		// This requires sending a write enable first
-		m_fpga->writeio(R_FLASHCFG, F_WREN);
-		m_fpga->writeio(R_FLASHCFG, F_END);
+		cmd[n++] = F_WREN;
+		cmd[n++] = F_END;
 
 		// Then sending a 0xab, 0x81
-		m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | 0x81);
-		m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | 0x23);
-		m_fpga->writeio(R_FLASHCFG, F_END);
+		cmd[n++] = CFG_USERMODE | 0x81;
+		cmd[n++] = CFG_USERMODE | 0x23;
+		cmd[n++] = F_END;
 	}
 
-	m_fpga->writeio(R_FLASHCFG, QUAD_IO_READ);
+	cmd[n++] = QUAD_IO_READ;
 	// 3 address bytes
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | CFG_QSPEED | CFG_WEDIR);
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | CFG_QSPEED | CFG_WEDIR);
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | CFG_QSPEED | CFG_WEDIR);
+	cmd[n++] = CFG_USERMODE | CFG_QSPEED | CFG_WEDIR;
+	cmd[n++] = CFG_USERMODE | CFG_QSPEED | CFG_WEDIR;
+	cmd[n++] = CFG_USERMODE | CFG_QSPEED | CFG_WEDIR;
 	// Mode byte
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | CFG_QSPEED | CFG_WEDIR | 0xa0);
+	cmd[n++] = CFG_USERMODE | CFG_QSPEED | CFG_WEDIR | 0xa0;
 	// Read NDUMMY clocks worth
 	for(int k=0; k<(FLASH_NDUMMY-2)/2; k++)
-		m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | CFG_QSPEED );
+		cmd[n++] = CFG_USERMODE | CFG_QSPEED;
 	// Read a dummy byte
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | CFG_QSPEED );
+	cmd[n++] = CFG_USERMODE | CFG_QSPEED;
 	// Close the interface
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE);
-	m_fpga->writeio(R_FLASHCFG, CFG_USER_CS_n);
+	cmd[n++] = CFG_USERMODE;
+	cmd[n++] = CFG_USER_CS_n;
+
+	assert(n <= (int)(sizeof(cmd)/sizeof(cmd[0])));
+	m_fpga->writez(R_FLASHCFG, n, cmd);
+#endif
+}
+
+//
+// Send an erase or program command, built by erase_cmd() or program_cmd(),
+// to the flash in one burst, and note when it was sent
+//
+void	FLASHDRVR::issue(const unsigned n, const DEVBUS::BUSW *cmd) {
+#ifdef	FLASH_ACCESS
+	m_fpga->writez(R_FLASHCFG, n, cmd);
+	m_issued = clockus();
 #endif
 }
 
-void	FLASHDRVR::flwait(void) {
+//
+// Wait for the erase or program command last issued to complete, given that
+// it should take no longer than expected_us.  Rather than asking the flash
+// over and over, sleep until it might reasonably be done, and then ask at an
+// ever decreasing rate.  Unless close is set, the status read is left open
+// for the next command, whose first word (F_END) will close it.
+//
+void	FLASHDRVR::flwait(const unsigned expected_us, const bool close) {
 #ifdef	FLASH_ACCESS
 	const	int	WIP = 1;	// Write in progress bit
+	static const DEVBUS::BUSW	cmd[] = { F_END, F_RDSR1 };
 	DEVBUS::BUSW	sr;
+	unsigned long	elapsed, first = expected_us/4,
+			step = (expected_us >= 16) ? expected_us/16 : 1;
+
+	// Any time spent since the command was issued counts towards the
+	// wait
+	elapsed = clockus() - m_issued;
+	if (elapsed < first)
+		::usleep(first - elapsed);
+
+	m_fpga->writez(R_FLASHCFG, 2, cmd);
+	while(1) {
+		// Clock out the next copy of the status register, and read
+		// it, within the same round trip
+		m_fpga->queue_write(R_FLASHCFG, F_EMPTY);
+		m_fpga->queue_read(R_FLASHCFG, &sr);
+		m_fpga->complete();
+		m_npolls++;
+
+		if (0 == (sr & WIP))
+			break;
+		::usleep(step);
+		if (step < first)
+			step *= 2;
+	}
 
-	m_fpga->writeio(R_FLASHCFG, F_END);
-	m_fpga->writeio(R_FLASHCFG, F_RDSR1);
+	if (close)
+		m_fpga->writeio(R_FLASHCFG, F_END);
+#endif
+}
+
+#ifdef	R_FLASHCRC
+//
+// The same CRC32 as the flash controller's CRC engine: reflected, using the
+// Ethernet (and zlib) polynomial, and taken over bytes in flash order
+//
+static uint32_t	flashcrc(const char *data, const unsigned len) {
+	uint32_t	crc = 0xffffffff;
+
+	for(unsigned i=0; i<len; i++) {
+		crc ^= (data[i] & 0x0ff);
+		for(int k=0; k<8; k++)
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320) : (crc >> 1);
+	} return ~crc;
+}
+#endif
+
+bool	FLASHDRVR::verify_range(const unsigned addr, const unsigned len,
+		const char *data) {
+#ifdef	FLASH_ACCESS
+	assert((len & 3) == 0);
+#ifdef	R_FLASHCRC
+	// Have the flash controller calculate a CRC across this range, and
+	// compare it against our own.  This costs a handful of words across
+	// the bus, rather than reading every word back.
+	DEVBUS::BUSW	stat, crc, goal;
+
+	m_fpga->writeio(R_FLASHCRCADDR, addr & 0x0ffffff);
+	m_fpga->writeio(R_FLASHCRCLEN, len >> 2);
 	do {
-		m_fpga->writeio(R_FLASHCFG, F_EMPTY);
-		sr = m_fpga->readio(R_FLASHCFG);
-	} while(sr&WIP);
-	m_fpga->writeio(R_FLASHCFG, F_END);
+		stat = m_fpga->readio(R_FLASHCRCLEN);
+	} while(stat & 0x80000000);
+	crc  = m_fpga->readio(R_FLASHCRC);
+	goal = flashcrc(data, len);
+
+	if (crc != goal) {
+		printf("\nVERIFY FAILS: %08x - %08x\n", addr, addr+len-1);
+		printf("\t(Flash CRC) %08x != %08x (Goal)\n", crc, goal);
+		return false;
+	}
+#else
+	// Otherwise, read everything back and compare
+	DEVBUS::BUSW	*buf = new DEVBUS::BUSW[len>>2];
+
+	m_fpga->readi(addr, len>>2, buf);
+	for(unsigned i=0; i<(len>>2); i++) {
+		DEVBUS::BUSW	goal;
+
+		goal = buildword((const unsigned char *)&data[i<<2]);
+		if (buf[i] != goal) {
+			printf("\nVERIFY FAILS[%d]: %08x\n", i, (i<<2)+addr);
+			printf("\t(Flash[%d]) %08x != %08x (Goal[%08x])\n",
+				(i<<2), buf[i], goal, (i<<2)+addr);
+			delete[] buf;
+			return false;
+		}
+	} delete[] buf;
+#endif
+	return true;
+#else
+	return false; // No flash present
 #endif
 }
 
@@ -216,26 +404,19 @@ bool	FLASHDRVR::erase_sector(const unsigned sector, const bool verify_erase) {
 #ifdef	FLASH_ACCESS
 	unsigned	flashaddr = sector & 0x0ffffff;
 
-	take_offline();
-
-	// Write enable
-	m_fpga->writeio(R_FLASHCFG, F_END);
-	m_fpga->writeio(R_FLASHCFG, F_WREN);
-	m_fpga->writeio(R_FLASHCFG, F_END);
+	DEVBUS::BUSW	cmd[8];
+	unsigned	n;
 
-	DEVBUS::BUSW	page[SZPAGEW];
+	take_offline();
 
 	// printf("EREG before   : %08x\n", m_fpga->readio(R_QSPI_EREG));
 	printf("Erasing sector: %06x\n", flashaddr);
 
-	m_fpga->writeio(R_FLASHCFG, F_SE);
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | ((flashaddr>>16)&0x0ff));
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | ((flashaddr>> 8)&0x0ff));
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE | ((flashaddr    )&0x0ff));
-	m_fpga->writeio(R_FLASHCFG, F_END);
+	n = erase_cmd(cmd, flashaddr);
+	issue(n, cmd);
 
 	// Wait for the erase to complete
-	flwait();
+	flwait(FLASH_tSE_US);
 
 	// Turn quad-mode read back on, so we can read next
 	place_online();
@@ -244,20 +425,14 @@ bool	FLASHDRVR::erase_sector(const unsigned sector, const bool verify_erase) {
 	if (verify_erase) {
 		if (m_debug)
 			printf("Verifying the erase\n");
-		for(int i=0; i<NPAGES; i++) {
-			// printf("READI[%08x + %04x]\n", R_FLASH+flashaddr+i*SZPAGEB, SZPAGEW);
-			m_fpga->readi(R_FLASH+flashaddr+i*SZPAGEB, SZPAGEW, page);
-			for(int j=0; j<SZPAGEW; j++)
-				if (page[j] != 0xffffffff) {
-					unsigned rdaddr = R_FLASH+flashaddr+i*SZPAGEB;
-
-					if (m_debug)
-						printf("FLASH[%07x] = %08x, not 0xffffffff as desired (%06x + %d)\n",
-							R_FLASH+flashaddr+i*SZPAGEB+(j<<2),
-							page[j], rdaddr,(j<<2));
-					return false;
-				}
-		}
+		char	*ones = new char[SECTORSZB];
+		bool	erased;
+
+		memset(ones, -1, SECTORSZB);
+		erased = verify_range(R_FLASH+flashaddr, SECTORSZB, ones);
+		delete[] ones;
+		if (!erased)
+			return false;
 		if (m_debug)
 			printf("Erase verified\n");
 	}
@@ -271,7 +446,6 @@ bool	FLASHDRVR::erase_sector(const unsigned sector, const bool verify_erase) {
 bool	FLASHDRVR::page_program(const unsigned addr, const unsigned len,
 		const char *data, const bool verify_write) {
 #ifdef	FLASH_ACCESS
-	DEVBUS::BUSW	buf[SZPAGEW], bswapd[SZPAGEW];
 	unsigned	flashaddr = addr & 0x0ffffff;
 
 	take_offline();
@@ -284,12 +458,11 @@ bool	FLASHDRVR::page_program(const unsigned addr, const unsigned len,
 		return true;
 
 	bool	empty_page = true;
-	for(unsigned i=0; i<len; i+=4) {
-		DEVBUS::BUSW v;
-		v = buildword((const unsigned char *)&data[i]);
-		bswapd[(i>>2)] = v;
-		if (v != 0xffffffff)
+	for(unsigned i=0; i<len; i++) {
+		if ((data[i]&0x0ff) != 0x0ff) {
 			empty_page = false;
+			break;
+		}
 	}
 
 	if (empty_page) {
@@ -298,26 +471,15 @@ bool	FLASHDRVR::page_program(const unsigned addr, const unsigned len,
 	}
 
 
-	// Write enable
-	m_fpga->writeio(R_FLASHCFG, F_END);
-	m_fpga->writeio(R_FLASHCFG, F_WREN);
-	m_fpga->writeio(R_FLASHCFG, F_END);
-
 	//
-	// Write the page
+	// Write the page.  The whole command, from write enable through the
+	// last data byte, is built up front and then sent as one burst.
 	//
+	DEVBUS::BUSW	cmd[8+PGLENB];
+	unsigned	n;
 
-	// Issue the page program command
-	m_fpga->writeio(R_FLASHCFG, F_PP);
-	// The address of the page to be programmed
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE|((flashaddr>>16)&0x0ff));
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE|((flashaddr>> 8)&0x0ff));
-	m_fpga->writeio(R_FLASHCFG, CFG_USERMODE|((flashaddr    )&0x0ff));
-	// Write the page data itself
-	for(unsigned i=0; i<len; i++)
-		m_fpga->writeio(R_FLASHCFG,
-			CFG_USERMODE | CFG_WEDIR | (data[i] & 0x0ff));
-	m_fpga->writeio(R_FLASHCFG, F_END);
+	n = program_cmd(cmd, flashaddr, len, data);
+	issue(n, cmd);
 
 	printf("Writing page: 0x%08x - 0x%08x", addr, addr+len-1);
 	if ((m_debug)&&(verify_write))
@@ -326,22 +488,16 @@ bool	FLASHDRVR::page_program(const unsigned addr, const unsigned len,
 		printf("\n");
 
 	// Wait for the write to complete
-	flwait();
+	flwait(FLASH_tPP_US);
 
 	// Turn quad-mode read back on, so we can verify the program
 	place_online();
 	if (verify_write) {
 		// printf("Attempting to verify page\n");
 		// NOW VERIFY THE PAGE
-		m_fpga->readi(addr, len>>2, buf);
-		for(unsigned i=0; i<(len>>2); i++) {
-			if (buf[i] != bswapd[i]) {
-				printf("\nVERIFY FAILS[%d]: %08x\n", i, (i<<2)+addr);
-				printf("\t(Flash[%d]) %08x != %08x (Goal[%08x])\n",
-					(i<<2), buf[i], bswapd[i], (i<<2)+addr);
-				return false;
-			}
-		} if (m_debug)
+		if (!verify_range(addr, len, data))
+			return false;
+		if (m_debug)
 			printf(" -- Successfully verified\n");
 		else
 			printf("\r");
@@ -403,71 +559,160 @@ bool	FLASHDRVR::write(const unsigned addr, const unsigned len,
 		}
 	}
 
-	// Work through this one sector at a time.
-	// If this buffer is equal to the sector value(s), go on
-	// If not, erase the sector
-
-	for(unsigned s=SECTOROF(addr); s<SECTOROF(addr+len+SECTORSZB-1);
-			s+=SECTORSZB) {
-		// Do we need to erase?
-		bool	need_erase = false, need_program = false;
-		unsigned newv = 0; // (s<addr)?addr:s;
-		{
-			char *sbuf = new char[SECTORSZB];
-			const char *dp;	// pointer to our "desired" buffer
-			unsigned	base,ln;
-
-			base = (addr>s)?addr:s;
-			ln=((addr+len>s+SECTORSZB)?(s+SECTORSZB):(addr+len))-base;
-			m_fpga->readi(base, ln>>2, (uint32_t *)sbuf);
-
-			dp = &data[base-addr];
-			SETSCOPE;
-			for(unsigned i=0; i<ln; i++) {
-				if (((sbuf[i]&dp[i])&0x0ff) != (dp[i]&0x0ff)) {
-					if (m_debug) {
-						printf("\nNeed sector erase, @0x%08x ... %02x != %02x (Goal)\n",
-							i+base-addr, (sbuf[i]&0x0ff), (dp[i]&0x0ff));
-					}
-					need_erase = true;
-					newv = (i&-4)+base;
-					break;
-				} else if ((sbuf[i] != dp[i])&&(newv == 0))
-					newv = (i&-4)+base;
+	// Work through this in two passes.  The first reads each sector back,
+	// and compares what we want against what the flash already holds.
+	// Sectors that already match are skipped.  Sectors whose bits only
+	// need to go from 1 to 0 are programmed in place, one differing page
+	// at a time.  Only the rest need to be erased.
+	//
+	// The second pass then erases and programs everything, with the flash
+	// kept offline throughout.  Each command is encoded while the flash is
+	// still busy with the last one, and sent in the same burst that ends
+	// the status read telling us the flash is ready for it.
+	const unsigned	first = SECTOROF(addr),
+			nsectors = (SECTOROF(addr+len+SECTORSZB-1)-first)
+					/ SECTORSZB,
+			npgsector = SECTORSZB / PGLENB;
+	DEVBUS::BUSW	*sbuf = new DEVBUS::BUSW[SECTORSZW];
+	char		*goal = new char[nsectors * SECTORSZB];
+	bool		*dirty = new bool[nsectors * npgsector],
+			*erase = new bool[nsectors],
+			*skip  = new bool[nsectors];
+	const char	*cbuf = (const char *)sbuf;
+	unsigned	nskipped = 0, nprogrammed = 0, nerased = 0, npages = 0;
+	unsigned long	t0, tpgm, tdone;
+
+	t0 = clockus();
+	for(unsigned k=0; k<nsectors; k++) {
+		const unsigned	s = first + k * SECTORSZB;
+		char		*gbuf = &goal[k * SECTORSZB];
+		unsigned	base, ln;
+
+		// Read the whole sector back, in one request, and place it
+		// into flash byte order
+		SETSCOPE;
+		m_fpga->readi(s, SECTORSZW, sbuf);
+#ifndef	LITTLEENDIAN_CPU
+		byteswapbuf(SECTORSZW, sbuf);
+#endif
+
+		// Our goal is what's there now, save for the part we are
+		// writing.  This keeps an erase from losing any data in this
+		// sector that lies outside of the range we've been given.
+		base = (addr>s)?addr:s;
+		ln=((addr+len>s+SECTORSZB)?(s+SECTORSZB):(addr+len))-base;
+		memcpy(gbuf, cbuf, SECTORSZB);
+		memcpy(&gbuf[base-s], &data[base-addr], ln);
+
+		skip[k]  = (memcmp(gbuf, cbuf, SECTORSZB) == 0);
+		erase[k] = false;
+		if (skip[k]) {
+			nskipped++;
+			continue; // This sector already matches
+		}
+
+		for(unsigned i=0; i<SECTORSZB; i++) {
+			if ((cbuf[i]&gbuf[i]) != gbuf[i]) {
+				if (m_debug) {
+					printf("Need sector erase, @0x%08x ... %02x != %02x (Goal)\n",
+						s+i, (cbuf[i]&0x0ff),
+						(gbuf[i]&0x0ff));
+				}
+				erase[k] = true;
+				break;
 			}
 		}
 
-		if (newv == 0)
-			continue; // This sector already matches
+		if (erase[k]) {
+			// After the erase, the flash will hold nothing but ones
+			memset(sbuf, -1, SECTORSZB);
+			nerased++;
+		} else
+			nprogrammed++;
+
+		// Program only those pages that differ from what the flash
+		// will then hold
+		for(unsigned p=0; p<npgsector; p++)
+			dirty[k*npgsector+p] = (memcmp(&gbuf[p*PGLENB],
+					&cbuf[p*PGLENB], PGLENB) != 0);
+	}
 
-		// Erase the sector if necessary
-		if (!need_erase) {
-			if (m_debug) printf("No erase required\n");
-		} else {
-			printf("Erasing sector: %08x\n", s);
-			if (!erase_sector(s, verify)) {
-				printf("SECTOR ERASE FAILED!\n");
-				return false;
-			} newv = (s<addr) ? addr : s;
+	//
+	// The second pass: erase and program
+	//
+	DEVBUS::BUSW	cmd[8+PGLENB];
+	unsigned	n, pending = 0;
+
+	m_npolls = 0;
+	tpgm = clockus();
+	take_offline();
+	for(unsigned k=0; k<nsectors; k++) {
+		const unsigned	s = first + k * SECTORSZB;
+
+		if (skip[k])
+			continue;
+
+		if (erase[k]) {
+			n = erase_cmd(cmd, s & 0x0ffffff);
+			if (pending)
+				flwait(pending, false);
+			issue(n, cmd);
+			pending = FLASH_tSE_US;
+			printf("Erasing sector: %06x\n", s & 0x0ffffff);
+		} else if (m_debug)
+			printf("No erase required\n");
+
+		for(unsigned p=0; p<npgsector; p++) {
+			if (!dirty[k*npgsector+p])
+				continue;
+			n = program_cmd(cmd, (s + p*PGLENB) & 0x0ffffff, PGLENB,
+				&goal[k*SECTORSZB + p*PGLENB]);
+			if (pending)
+				flwait(pending, false);
+			issue(n, cmd);
+			pending = FLASH_tPP_US;
+			npages++;
 		}
 
-		// Now walk through all of our pages in this sector and write
-		// to them.
-		for(unsigned p=newv; (p<s+SECTORSZB)&&(p<addr+len); p=PAGEOF(p+PGLENB)) {
-			unsigned start = p, len = addr+len-start;
-
-			// BUT! if we cross page boundaries, we need to clip
-			// our results to the page boundary
-			if (PAGEOF(start+len-1)!=PAGEOF(start))
-				len = PAGEOF(start+PGLENB)-start;
-			if (!page_program(start, len, &data[p-addr], verify)) {
-				printf("WRITE-PAGE FAILED!\n");
-				return false;
-			}
-		} if ((need_erase)||(need_program))
-			printf("Sector 0x%08x: DONE%15s\n", s, "");
+		printf("Sector 0x%08x: DONE%15s\n", s, "");
 	}
 
+	if (pending)
+		flwait(pending);
+	tdone = clockus();
+
+	// Turn quad-mode read back on, so we can verify what we've written.
+	// Verify each sector at once, rather than page by page
+	place_online();
+	if (verify) for(unsigned k=0; k<nsectors; k++) {
+		const unsigned	s = first + k * SECTORSZB;
+
+		if ((!skip[k])&&(!verify_range(s, SECTORSZB,
+					&goal[k * SECTORSZB]))) {
+			printf("SECTOR VERIFY FAILED!\n");
+			delete[] sbuf;
+			delete[] goal;
+			delete[] dirty;
+			delete[] erase;
+			delete[] skip;
+			return false;
+		}
+	}
+
+	delete[] sbuf;
+	delete[] goal;
+	delete[] dirty;
+	delete[] erase;
+	delete[] skip;
+
+	printf("Flash: %d sector(s) unchanged, %d programmed in place, %d erased, %d page(s) written\n",
+		nskipped, nprogrammed, nerased, npages);
+	if ((npages > 0)&&(tdone > tpgm))
+		printf("Flash: %d bytes programmed in %.3f s, %.1f kB/s (%d status polls), %.1f kB/s overall\n",
+			npages * PGLENB, (tdone - tpgm) / 1e6,
+			npages * PGLENB * 1e6 / 1024. / (tdone - tpgm),
+			m_npolls, len * 1e6 / 1024. / (clockus() - t0));
+
 	take_offline();
 
 	m_fpga->writeio(R_FLASHCFG, F_WRDI);
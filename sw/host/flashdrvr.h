@@ -47,6 +47,10 @@ private:
 	DEVBUS	*m_fpga;
 	bool	m_debug;
 	unsigned	m_id; // ID of the flash device
+	// When the last erase or program command was issued, and how many
+	// times we've since asked the flash if it's done
+	unsigned long	m_issued;
+	unsigned	m_npolls;
 
 	//
 	void	take_offline(void);
@@ -56,7 +60,10 @@ private:
 	//
 	bool	verify_config(void);
 	void	set_config(void);
-	void	flwait(void);
+	void	issue(const unsigned n, const DEVBUS::BUSW *cmd);
+	void	flwait(const unsigned expected_us, const bool close=true);
+	bool	verify_range(const unsigned addr, const unsigned len,
+			const char *data);
 public:
 	FLASHDRVR(DEVBUS *fpga);
 	bool	erase_sector(const unsigned sector, const bool verify_erase=true);
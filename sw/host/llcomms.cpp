@@ -56,14 +56,19 @@
 #include <strings.h> 
 #include <poll.h> 
 #include <ctype.h> 
+#include <sys/mman.h>
+#include <time.h>
 
 #include "llcomms.h"
+#include "shmbus.h"
 
 LLCOMMSI::LLCOMMSI(void) {
 	m_fdw = -1;
 	m_fdr = -1;
 	m_total_nread = 0l;
 	m_total_nwrit = 0l;
+	m_rxbuf = new char[RXBUFLN];
+	m_rxhead = m_rxtail = 0;
 }
 
 void	LLCOMMSI::write(char *buf, int len) {
@@ -76,13 +81,88 @@ void	LLCOMMSI::write(char *buf, int len) {
 	assert(nw == len);
 }
 
-int	LLCOMMSI::read(char *buf, int len) {
+int	LLCOMMSI::rawread(char *buf, int len) {
 	int	nr;
-	nr = ::read(m_fdr, buf, len);
-	if (nr <= 0) {
-		throw "Read-Failure";
+
+	while(1) {
+		nr = ::read(m_fdr, buf, len);
+		if ((nr < 0)&&((errno == EAGAIN)||(errno == EWOULDBLOCK))) {
+			// Our device was opened non-blocking.  Wait for
+			// something to show up.
+			rawpoll(-1);
+			continue;
+		} else if (nr <= 0) {
+			throw "Read-Failure";
+		}
+		return nr;
 	}
+}
+
+void	LLCOMMSI::fill(void) {
+	unsigned	used, first, ln;
+	int		nr;
+
+	used = m_rxtail - m_rxhead;
+	if (used == 0)
+		m_rxhead = m_rxtail = 0;
+	else if (used >= RXBUFLN)
+		return;
+
+	// Read into the free space at the end of our buffer, up to where it
+	// wraps.  Should that read come back full, try for more at the
+	// beginning of the buffer--but only if we won't block doing so.
+	first = m_rxtail & (RXBUFLN-1);
+	if (first < (m_rxhead & (RXBUFLN-1)))
+		ln = (m_rxhead & (RXBUFLN-1)) - first;
+	else
+		ln = RXBUFLN - first;
+	nr = rawread(&m_rxbuf[first], ln);
+	m_rxtail += nr;
 	m_total_nread += nr;
+
+	used = m_rxtail - m_rxhead;
+	if (((unsigned)nr == ln)&&(used < RXBUFLN)&&(rawpoll(0))) {
+		first = m_rxtail & (RXBUFLN-1);
+		nr = rawread(&m_rxbuf[first], RXBUFLN-used);
+		m_rxtail += nr;
+		m_total_nread += nr;
+	}
+}
+
+int	LLCOMMSI::peek(const char **ptr) {
+	unsigned	first, ln;
+
+	if (m_rxtail == m_rxhead)
+		fill();
+
+	first = m_rxhead & (RXBUFLN-1);
+	ln = m_rxtail - m_rxhead;
+	if (first + ln > RXBUFLN)
+		ln = RXBUFLN - first;
+
+	*ptr = &m_rxbuf[first];
+	return ln;
+}
+
+void	LLCOMMSI::consume(int len) {
+	assert((len >= 0)&&((unsigned)len <= m_rxtail - m_rxhead));
+	m_rxhead += len;
+}
+
+int	LLCOMMSI::read(char *buf, int len) {
+	const char	*ptr;
+	int		nr, ln;
+
+	nr = 0;
+	do {
+		ln = peek(&ptr);
+		if (ln > len - nr)
+			ln = len - nr;
+		memcpy(&buf[nr], ptr, ln);
+		consume(ln);
+		nr += ln;
+	} while((nr < len)&&(m_rxtail != m_rxhead));
+
 	return nr;
 }
 
@@ -95,6 +175,12 @@ void	LLCOMMSI::close(void) {
 }
 
 bool	LLCOMMSI::poll(unsigned ms) {
+	if (m_rxtail != m_rxhead)
+		return true;
+	return rawpoll(ms);
+}
+
+bool	LLCOMMSI::rawpoll(unsigned ms) {
 	struct	pollfd	fds;
 
 	fds.fd = m_fdr;
@@ -107,7 +193,9 @@ bool	LLCOMMSI::poll(unsigned ms) {
 }
 
 int	LLCOMMSI::available(void) {
-	return poll(0)?1:0;
+	if (m_rxtail != m_rxhead)
+		return m_rxtail - m_rxhead;
+	return rawpoll(0)?1:0;
 }
 
 TTYCOMMS::TTYCOMMS(const char *dev) {
@@ -174,4 +262,97 @@ void	NETCOMMS::close(void) {
 	::close(m_fdw);
 }
 
+SHMCOMMS::SHMCOMMS(const char *name) {
+	int	fd;
+	void	*ptr;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		printf("\n Error : Could not open shared memory, %s\n", name);
+		perror("O/S Err:");
+		exit(-1);
+	}
+
+	ptr = mmap(NULL, sizeof(SHMBUS), PROT_READ|PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	::close(fd);
+	if (ptr == MAP_FAILED) {
+		perror("MMAP Failed Err");
+		exit(-1);
+	}
+
+	m_shm = (SHMBUS *)ptr;
+	if (__atomic_load_n(&m_shm->m_magic, __ATOMIC_ACQUIRE) != SHMMAGIC) {
+		printf("\n Error : %s isn't a simulation's bus\n", name);
+		exit(-1);
+	}
+
+	// We are the only reader of this ring.  Anything in it now was left
+	// over from some prior program, so ignore it.
+	m_shm->m_fromfpga.m_head = __atomic_load_n(&m_shm->m_fromfpga.m_tail,
+					__ATOMIC_ACQUIRE);
+}
+
+void	SHMCOMMS::close(void) {
+	if (m_shm)
+		munmap(m_shm, sizeof(SHMBUS));
+	m_shm = NULL;
+}
+
+void	SHMCOMMS::write(char *buf, int len) {
+	int	nw = 0;
+
+	if (!m_shm)
+		throw "Write-Failure";
+
+	// The simulation may be slower to read than we are to write.  If
+	// the ring is full, wait for it to catch up.
+	while(nw < len) {
+		int	ln = shmring_write(&m_shm->m_tofpga, &buf[nw], len-nw);
+
+		if (ln == 0)
+			::usleep(20);
+		nw += ln;
+	}
+	m_total_nwrit += nw;
+}
+
+int	SHMCOMMS::rawread(char *buf, int len) {
+	int	nr;
+
+	if (!m_shm)
+		throw "Read-Failure";
+	while(0 == (nr = shmring_read(&m_shm->m_fromfpga, buf, len)))
+		rawpoll(-1);
+	return nr;
+}
 
+bool	SHMCOMMS::rawpoll(unsigned ms) {
+	struct	timespec	now, stop;
+
+	if ((!m_shm)||(shmring_used(&m_shm->m_fromfpga) > 0))
+		return true;
+	else if (ms == 0)
+		return false;
+
+	// There's no file descriptor to wait on, so we'll check back
+	// periodically until either something shows up or we run out of time.
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	stop.tv_sec  += ms / 1000;
+	stop.tv_nsec += (ms % 1000) * 1000000l;
+	if (stop.tv_nsec >= 1000000000l) {
+		stop.tv_sec++;
+		stop.tv_nsec -= 1000000000l;
+	}
+
+	do {
+		::usleep(20);
+		if (shmring_used(&m_shm->m_fromfpga) > 0)
+			return true;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while((ms == (unsigned)-1)||(now.tv_sec < stop.tv_sec)
+			||((now.tv_sec == stop.tv_sec)
+				&&(now.tv_nsec < stop.tv_nsec)));
+
+	return false;
+}
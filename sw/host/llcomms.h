@@ -41,14 +41,36 @@
 #ifndef	LLCOMMS_H
 #define	LLCOMMS_H
 
+// The size of our receive buffer.  This must be a power of two.
+#define	RXBUFLN	16384
+
 class	LLCOMMSI {
 protected:
 	int	m_fdw, m_fdr;
+
+	// Our receive buffer.  Characters are read into this (circular) buffer
+	// in as large a block as the device will give us, and then handed out
+	// from there.  m_rxhead and m_rxtail are free running counters, so
+	// m_rxtail-m_rxhead is the number of characters in the buffer.
+	char		*m_rxbuf;
+	unsigned	m_rxhead, m_rxtail;
+
 	LLCOMMSI(void);
+
+	// The low level interface to the device.  rawread() reads up to len
+	// characters, blocking until at least one is available, and rawpoll()
+	// waits up to ms milliseconds for a character to become available.
+	// Neither knows anything about our receive buffer.
+	virtual	int	rawread(char *buf, int len);
+	virtual	bool	rawpoll(unsigned ms);
+
+	// Fill as much of our receive buffer as the device can immediately
+	// supply, blocking until at least one character is available.
+	void	fill(void);
 public:
 	unsigned long	m_total_nread, m_total_nwrit;
 
-	virtual	~LLCOMMSI(void) { close(); }
+	virtual	~LLCOMMSI(void) { close(); delete[] m_rxbuf; }
 	virtual	void	kill(void)  { this->close(); };
 	virtual	void	close(void);
 	virtual	void	write(char *buf, int len);
@@ -58,6 +80,14 @@ public:
 	// Tests whether or not bytes are available to be read, returns a 
 	// count of the bytes that may be immediately read
 	virtual	int	available(void); // { return 0; };
+
+	// Zero-copy access to the receive buffer.  peek() blocks until at
+	// least one character has been received, then sets *ptr to point to
+	// the received characters and returns how many of them may be found
+	// there.  These characters remain in the buffer until consume()
+	// removes the first len of them.
+	virtual	int	peek(const char **ptr);
+	virtual	void	consume(int len);
 };
 
 class	TTYCOMMS : public LLCOMMSI {
@@ -71,4 +101,19 @@ public:
 	virtual	void	close(void);
 };
 
+// Talks to the simulation through a block of shared memory (see shmbus.h),
+// rather than through a socket.  name is the name of the block, as given to
+// the simulation when it created it.
+struct	SHMBUS;
+class	SHMCOMMS : public LLCOMMSI {
+	SHMBUS	*m_shm;
+protected:
+	virtual	int	rawread(char *buf, int len);
+	virtual	bool	rawpoll(unsigned ms);
+public:
+	SHMCOMMS(const char *name);
+	virtual	void	close(void);
+	virtual	void	write(char *buf, int len);
+};
+
 #endif
@@ -85,11 +85,18 @@ int main(int argc, char **argv) {
 		exit(-1);
 	}
 
-	unsigned	v;
+	const	unsigned	regs[] = { R_NET_RXCMD, R_NET_TXCMD,
+				R_NET_MACHI, R_NET_MACLO,
+				R_NET_RXMISS, R_NET_RXERR, R_NET_RXCRC };
+	const	int	NREGS = sizeof(regs)/sizeof(regs[0]);
+	unsigned	v, vals[NREGS];
+
+	// Read all of our registers at once, in a single burst
+	m_fpga->readv_scatter(regs, NREGS, vals);
 
 	////////////////////////////////
 	//
-	v = m_fpga->readio(R_NET_RXCMD);
+	v = vals[0];	// R_NET_RXCMD
 	printf("RX: 0x%08x Status\n", v);
 	if ((v & 0xc0000000) == 0)
 		printf("RX:\t1000 Mbase T\n");
@@ -126,7 +133,7 @@ int main(int argc, char **argv) {
 	
 	////////////////////////////////
 	//
-	v = m_fpga->readio(R_NET_TXCMD);
+	v = vals[1];	// R_NET_TXCMD
 	printf("TX: 0x%08x Status\n", v);
 	if ((v & 0xc0000000) == 0)
 		printf("TX:\t1000 Mbase T\n");
@@ -155,17 +162,17 @@ int main(int argc, char **argv) {
 
 	////////////////////////////////
 	//
-	v = m_fpga->readio(R_NET_MACHI);
+	v = vals[2];	// R_NET_MACHI
 	printf("MAC: %02x:%02x", (v>>8)&0x0ff, (v & 0x0ff));
-	v = m_fpga->readio(R_NET_MACLO);
+	v = vals[3];	// R_NET_MACLO
 	printf(":%02x:%02x:%02x:%02x\n",
 		(v>>24)&0x0ff, ((v>>16) & 0x0ff), (v>>8)&0x0ff, (v & 0x0ff));
 
-	v = m_fpga->readio(R_NET_RXMISS);
+	v = vals[4];	// R_NET_RXMISS
 	printf("%6d\tMissed packets\n", v);
-	v = m_fpga->readio(R_NET_RXERR);
+	v = vals[5];	// R_NET_RXERR
 	printf("%6d\tPackets received in error\n", v);
-	v = m_fpga->readio(R_NET_RXCRC);
+	v = vals[6];	// R_NET_RXCRC
 	printf("%6d\tPackets with bad CRCs\n", v);
 
 
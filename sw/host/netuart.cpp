@@ -4,7 +4,13 @@
 //
 // Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
 //
-// Purpose:	
+// Purpose:	To share a serial port connected to the FPGA across the network.
+//		The port carries both the debugging bus and a console.  The
+//	console may be connected to on port FPGAPORT+1.  The bus is served on
+//	FPGAPORT, to as many clients at once as wish to connect.  Each client's
+//	bus commands are decoded, issued to the FPGA in turn along with those
+//	of every other client, and the results are returned to the client that
+//	issued them.
 //
 // Creator:	Dan Gisselquist, Ph.D.
 //		Gisselquist Technology, LLC
@@ -47,6 +53,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <signal.h>
 #include <ctype.h>
 #include <assert.h>
@@ -54,6 +61,8 @@
 
 #include "port.h"
 #include "regdefs.h"
+#include "llcomms.h"
+#include "ttybus.h"
 
 #ifndef	BAUDRATE
 #define	BAUDRATE	115200
@@ -61,6 +70,7 @@
 
 #define	NO_WAITING	0
 #define	FOREVER		-1
+#define	MAXEVENTS	32
 
 void	sigstop(int v) {
 	fprintf(stderr, "SIGSTOP!!\n");
@@ -119,7 +129,7 @@ int	setup_listener(const int port) {
 		exit(-1);
 	}
 
-	if (listen(skt, 1) != 0) {
+	if (listen(skt, 8) != 0) {
 		perror("Listen failed:");
 		exit(-1);
 	}
@@ -248,6 +258,490 @@ public:
 	}
 };
 
+//
+// TTYMUX
+//
+// The bus and the console share our serial port.  Bytes headed to or from the
+// bus have their high bit set, console bytes have it clear.  This splits the
+// two apart, so that our TTYBUS only ever sees its own half of the traffic.
+// Anything for the console is forwarded (and logged) as it is read.
+//
+class	TTYMUX : public LLCOMMSI {
+	LINBUFS	*m_con;
+
+	void	console(const char *buf, int ln) {
+		while(ln > 0) {
+			int	nc = ln;
+
+			if (nc > (int)sizeof(m_con->m_buf))
+				nc = sizeof(m_con->m_buf);
+			memcpy(m_con->m_buf, buf, nc);
+			if ((m_con->m_fd >= 0)
+					&&(m_con->write(m_con->m_fd, nc) != nc))
+				m_con->close();
+			m_con->print_in(stdout, nc);
+			buf += nc; ln -= nc;
+		}
+	}
+
+protected:
+	// Reads from the serial port, keeping only the bus characters.  This
+	// may return zero if only console characters were available.
+	int	rawread(char *buf, int len) {
+		int	nr, ncmd = 0;
+
+		nr = LLCOMMSI::rawread(buf, len);
+		for(int i=0; i<nr; i++) {
+			if (buf[i] & 0x80)
+				buf[ncmd++] = buf[i] & 0x07f;
+			else {
+				int	ncon = 1;
+
+				while((i+ncon < nr)&&(0 == (buf[i+ncon] & 0x80)))
+					ncon++;
+				console(&buf[i], ncon);
+				i += ncon-1;
+			}
+		}
+
+		return ncmd;
+	}
+
+public:
+	TTYMUX(const int tty, LINBUFS *con) : m_con(con) {
+		m_fdr = m_fdw = tty;
+	}
+
+	void	write(char *buf, int len) {
+		char	obuf[256];
+
+		while(len > 0) {
+			int	nw = (len > (int)sizeof(obuf)) ? sizeof(obuf) : len;
+
+			for(int i=0; i<nw; i++)
+				obuf[i] = buf[i] | 0x80;
+			LLCOMMSI::write(obuf, nw);
+			buf += nw; len -= nw;
+		}
+	}
+};
+
+//
+// BUSCLIENT
+//
+// One client of the bus.  Each client speaks the same wbubus protocol it
+// would speak to the FPGA directly, so we keep a copy of the state the FPGA
+// would keep for it: its address, its write compression table, and whether
+// or not it is in the middle of a write burst.  Its commands are decoded into
+// a queue of transactions (MUXOPs), which we then issue on its behalf through
+// our one TTYBUS--interleaved with those of every other client, but never
+// split apart from the other transactions in the same command.  Responses are
+// then encoded back into the protocol, and queued for the client.
+//
+// Responses are always sent as raw (uncompressed) values, each read command
+// being preceded by its address.  We don't respond to any request for binary
+// mode, so every client stays in ASCII.
+//
+#define	MX_READ		0
+#define	MX_WRITE	1
+#define	MX_ERR		2	// A protocol error, just return an error
+
+#define	MXF_INC		1	// Increment the address following this op
+#define	MXF_ADDR	2	// Send the address before this (read) op
+#define	MXF_ACK		4	// Acknowledge this (write) op
+
+// Maximum number of transactions we'll issue for a client on its turn
+#define	MAXBATCH	1024
+// Stop issuing transactions for a client that isn't reading its responses
+#define	MAXBACKLOG	65536
+
+class	BUSCLIENT {
+public:
+	typedef	struct	{
+		unsigned	m_addr, m_data;
+		int		m_op, m_flags, m_group;
+	} MUXOP;
+
+	int		m_fd, m_id;
+	bool		m_dead;
+	unsigned	m_events;
+	BUSCLIENT	*m_next;
+
+	// Decoder state
+	char		m_cw[8];
+	int		m_cwlen;
+	unsigned	m_addr, m_lastwr, m_wraddr;
+	unsigned	m_wrtbl[1<<LGWTBL];
+	bool		m_inwrite, m_winc;
+	int		m_group, m_skip;
+
+	// Transactions waiting to be issued, starting at m_ohead
+	MUXOP		*m_ops;
+	int		m_nops, m_opalloc, m_ohead;
+
+	// Responses waiting to be sent, starting at m_opos
+	char		*m_obuf;
+	int		m_olen, m_oalloc, m_opos;
+
+	BUSCLIENT(const int fd, const int id) : m_fd(fd), m_id(id) {
+		m_dead = false; m_events = 0; m_next = NULL;
+		m_cwlen = 0;
+		m_addr = 0; m_lastwr = 0; m_wraddr = 0;
+		memset(m_wrtbl, 0, sizeof(m_wrtbl));
+		m_inwrite = false; m_winc = false;
+		m_group = 0; m_skip = -1;
+		m_ops = NULL; m_nops = m_opalloc = m_ohead = 0;
+		m_obuf = NULL; m_olen = m_oalloc = m_opos = 0;
+	}
+
+	~BUSCLIENT(void) {
+		if (m_fd >= 0)
+			::close(m_fd);
+		if (m_ops)
+			delete[] m_ops;
+		if (m_obuf)
+			delete[] m_obuf;
+	}
+
+	static	char	charenc(const int v) {
+		static	const char	enc[] = "0123456789"
+			"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"abcdefghijklmnopqrstuvwxyz@%";
+		return enc[v & 0x03f];
+	}
+
+	static	int	chardec(const char ch) {
+		if ((ch >= '0')&&(ch <= '9'))
+			return ch - '0';
+		else if ((ch >= 'A')&&(ch <= 'Z'))
+			return ch - 'A' + 10;
+		else if ((ch >= 'a')&&(ch <= 'z'))
+			return ch - 'a' + 36;
+		else if (ch == '@')
+			return 0x03e;
+		else if (ch == '%')
+			return 0x03f;
+		return -1;
+	}
+
+	// The length of a codeword, given its first six bits
+	static	int	cwlen(const int sb) {
+		if (sb < 0x08)		// Set address, or a stride run
+			return 6;
+		else if (sb < 0x10)	// Compressed address
+			return 2 + ((sb>>1)&3);
+		else if (sb < 0x18)	// Compressed write
+			return 2;
+		else if (sb < 0x20)	// Raw write
+			return 6;
+		else if (sb < 0x30)	// Short read
+			return 1;
+		return 2;		// Long read
+	}
+
+	bool	pending(void) const {
+		return (m_ohead < m_nops)&&(m_olen < MAXBACKLOG);
+	}
+
+	MUXOP	*push(const int op, const unsigned addr, const unsigned data,
+			const int flags) {
+		MUXOP	*p;
+
+		if (m_nops >= m_opalloc) {
+			MUXOP	*q;
+
+			m_opalloc = (m_opalloc < 64) ? 64 : (m_opalloc * 2);
+			q = new MUXOP[m_opalloc];
+			if (m_ops) {
+				memcpy(q, m_ops, m_nops * sizeof(MUXOP));
+				delete[] m_ops;
+			} m_ops = q;
+		}
+
+		p = &m_ops[m_nops++];
+		p->m_op    = op;
+		p->m_addr  = addr;
+		p->m_data  = data;
+		p->m_flags = flags;
+		p->m_group = m_group;
+		return p;
+	}
+
+	void	reply(const char *buf, const int ln) {
+		if (m_olen + ln > m_oalloc) {
+			char	*b;
+
+			m_oalloc = (m_oalloc < 256) ? 256 : m_oalloc;
+			while(m_olen + ln > m_oalloc)
+				m_oalloc *= 2;
+			b = new char[m_oalloc];
+			if (m_obuf) {
+				memcpy(b, m_obuf, m_olen);
+				delete[] m_obuf;
+			} m_obuf = b;
+		}
+		memcpy(&m_obuf[m_olen], buf, ln);
+		m_olen += ln;
+	}
+
+	// Encode a codeword of six characters, from two bits of header and
+	// (up to) thirty-two bits of value
+	static	void	encode(const int hb, const unsigned v, char *buf) {
+		buf[0] = charenc((hb<<2)|((v>>30)&3));
+		buf[1] = charenc(v>>24);
+		buf[2] = charenc(v>>18);
+		buf[3] = charenc(v>>12);
+		buf[4] = charenc(v>> 6);
+		buf[5] = charenc(v);
+	}
+
+	// Queue the response to a transaction, once it has completed
+	void	reply(const MUXOP *op) {
+		char	buf[12];
+
+		if (op->m_op == MX_READ) {
+			int	ln = 0;
+
+			if (op->m_flags & MXF_ADDR) {
+				encode(2, op->m_addr>>2, buf);
+				ln = 6;
+			}
+			encode(0, op->m_data, &buf[ln]);
+			buf[ln] = charenc(0x38 | (((op->m_data>>30)&3)<<1)
+					| ((op->m_flags & MXF_INC) ? 1:0));
+			reply(buf, ln+6);
+		} else if (op->m_op == MX_ERR)
+			reply("5", 1);
+		else if (op->m_flags & MXF_ACK)
+			reply("2", 1);
+	}
+
+	// Decode one complete codeword, found in m_cw
+	void	codeword(void) {
+		int		sb = chardec(m_cw[0]);
+		unsigned	v = 0;
+
+		for(int i=1; i<m_cwlen; i++)
+			v = (v<<6) | chardec(m_cw[i]);
+
+		if ((m_inwrite)&&((sb < 0x04)||(sb >= 0x20)
+					||((sb >= 0x08)&&(sb < 0x10)))) {
+			// Anything but a write, within a write burst, is an
+			// error.  The FPGA drops such codewords.
+			push(MX_ERR, m_addr, 0, 0);
+			m_inwrite = false;
+			m_group++;
+			return;
+		}
+
+		if (sb < 0x04) {
+			// Set a full 32-bit address
+			m_addr = (((sb&3)<<30)|v)<<2;
+		} else if (sb < 0x08) {
+			// A stride run: ln values, each stride more than the
+			// last value written
+			int	ln     = ((((sb&3)<<14)|((v>>16)&0x3fff))+1);
+			int	stride = (short)(v & 0x0ffff);
+
+			if (!m_inwrite) {
+				push(MX_ERR, m_addr, 0, 0);
+				m_group++;
+				return;
+			}
+
+			for(int i=0; i<ln; i++) {
+				m_lastwr += stride;
+				push(MX_WRITE, m_addr, m_lastwr,
+					(i == ln-1) ? MXF_ACK:0);
+				if (m_winc)
+					m_addr += 4;
+			}
+		} else if (sb < 0x10) {
+			// A compressed address, either absolute or relative
+			int	nb = 6*(m_cwlen-1);
+
+			if (sb & 1)
+				m_addr += ((int)(v << (32-nb)) >> (32-nb)) << 2;
+			else
+				m_addr = v << 2;
+		} else if (sb < 0x20) {
+			int	inc = sb & 1;
+
+			if (sb < 0x18) {
+				// A compressed write, from our table
+				unsigned caddr = (((sb>>1)&3)<<6) | v;
+				m_lastwr = m_wrtbl[(m_wraddr - caddr)
+						& ((1<<LGWTBL)-1)];
+			} else {
+				m_lastwr = (((sb>>1)&3)<<30) | v;
+				m_wrtbl[m_wraddr & ((1<<LGWTBL)-1)] = m_lastwr;
+				m_wraddr++;
+			}
+
+			m_inwrite = true;
+			m_winc = (inc != 0);
+			push(MX_WRITE, m_addr, m_lastwr, MXF_ACK
+				| (inc ? MXF_INC : 0));
+			if (inc)
+				m_addr += 4;
+		} else {
+			// A read command
+			int	ln, inc = sb & 1;
+
+			if (sb < 0x30)
+				ln = ((sb>>1)&7)+1;
+			else
+				ln = 9 + ((((sb>>1)&7)<<6) | v);
+
+			for(int i=0; i<ln; i++) {
+				push(MX_READ, m_addr, 0, ((i==0) ? MXF_ADDR:0)
+					| (inc ? MXF_INC : 0));
+				if (inc)
+					m_addr += 4;
+			}
+			m_group++;
+		}
+	}
+
+	// Decode a buffer of characters just read from the client
+	void	decode(const char *buf, const int len) {
+		for(int i=0; i<len; i++) {
+			if (chardec(buf[i]) < 0) {
+				// New lines, as well as anything else
+				// that isn't part of a codeword, end any
+				// write burst
+				m_cwlen = 0;
+				if (m_inwrite)
+					m_group++;
+				m_inwrite = false;
+				continue;
+			}
+
+			m_cw[m_cwlen++] = buf[i];
+			if (m_cwlen >= cwlen(chardec(m_cw[0]))) {
+				codeword();
+				m_cwlen = 0;
+			}
+		}
+	}
+
+	// Send as much of our response queue as the client will take.  Returns
+	// false if the client has gone away.
+	bool	flush(void) {
+		while(m_opos < m_olen) {
+			int nw = send(m_fd, &m_obuf[m_opos], m_olen-m_opos,
+					MSG_NOSIGNAL | MSG_DONTWAIT);
+			if ((nw < 0)&&((errno == EAGAIN)||(errno == EWOULDBLOCK)))
+				return true;
+			else if (nw <= 0)
+				return false;
+			m_opos += nw;
+		}
+
+		m_olen = m_opos = 0;
+		return true;
+	}
+};
+
+//
+// execute
+//
+// Gives one client its turn on the bus, issuing up to MAXBATCH of its
+// transactions together through our TTYBUS.  Should any of these fail, the
+// client gets a bus error in its place, and the rest of that command (read,
+// or write burst) is dropped--just as the FPGA would've done.  Everything
+// following continues on as before, save that anything sent to the FPGA
+// following the failure has already been executed, yet its results were
+// lost.  Rather than repeating these, each such command also returns a bus
+// error.  Only those never sent are issued again.
+//
+void	execute(DEVBUS *bus, BUSCLIENT *c) {
+	int	first = c->m_ohead, last, errat, resume, nq;
+	int	qidx[MAXBATCH];
+
+	last = first + MAXBATCH;
+	if (last > c->m_nops)
+		last = c->m_nops;
+
+	while(first < last) {
+		// qidx[] maps each transaction queued on the bus back to the
+		// client operation it came from
+		nq = 0;
+		for(int k=first; k<last; k++) {
+			BUSCLIENT::MUXOP *op = &c->m_ops[k];
+
+			if (op->m_group == c->m_skip)
+				continue;
+			if (op->m_op == MX_READ)
+				bus->queue_read(op->m_addr, &op->m_data);
+			else if (op->m_op == MX_WRITE)
+				bus->queue_write(op->m_addr, op->m_data);
+			else
+				continue;
+			qidx[nq++] = k;
+		}
+
+		errat = resume = last;
+		try {
+			bus->complete();
+		} catch(BUSERR b) {
+			bus->reset_err();
+			if ((b.index < 0)||(b.index >= nq))
+				// Nothing of ours was sent.  Try again.
+				continue;
+
+			// Everything before the transaction that failed
+			// has completed.  Everything after it, up until the
+			// first transaction never sent, was sent.
+			errat  = qidx[b.index];
+			resume = (b.nsent < nq) ? qidx[b.nsent] : last;
+		}
+
+		for(; first < errat; first++) {
+			if (c->m_ops[first].m_group != c->m_skip)
+				c->reply(&c->m_ops[first]);
+		}
+
+		if (first < last) {
+			c->reply("5", 1);
+			c->m_skip = c->m_ops[first].m_group;
+			first++;
+		}
+
+		// Commands sent after the failure return an error, once per
+		// command, rather than being repeated
+		for(; first < resume; first++) {
+			BUSCLIENT::MUXOP *op = &c->m_ops[first];
+
+			if (op->m_group == c->m_skip)
+				continue;
+			if (op->m_op == MX_ERR)
+				c->reply(op);
+			else {
+				c->reply("5", 1);
+				c->m_skip = op->m_group;
+			}
+		}
+	}
+
+	c->m_ohead = last;
+	if (c->m_ohead >= c->m_nops)
+		c->m_ohead = c->m_nops = 0;
+}
+
+void	epoll_watch(const int epfd, const int op, const int fd,
+		const unsigned events) {
+	struct	epoll_event	ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events  = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, op, fd, &ev) != 0) {
+		perror("EPOLL-CTL Failed!  O/S Err:");
+		exit(EXIT_FAILURE);
+	}
+}
+
 int	main(int argc, char **argv) {
 	// First, accept a network connection
 	int	skt = setup_listener(FPGAPORT),
@@ -366,144 +860,159 @@ int	main(int argc, char **argv) {
 		tcflow(tty, TCOON);
 	}
 
-	LINBUFS	lbcmd, lbcon;
-	while(!done) {
-		struct	pollfd	p[4];
-		int	pv, nfds;
+	LINBUFS		lbcon;
+	TTYBUS		*bus;
+	BUSCLIENT	*clients = NULL;
+	int		epfd, nclients = 0;
 
+	bus = new TTYBUS(new TTYMUX(tty, &lbcon), FPGABINARY);
 
-		//
-		// Set up a poll to see if we have any events to examine
-		//
-		nfds = 0;
-
-		p[nfds].fd = tty;
-		p[nfds].events = POLLIN | POLLERR;
-		nfds++;
-
-		if (lbcmd.m_connected) {
-			p[nfds].fd = lbcmd.m_fd;
-			p[nfds].events = POLLIN | POLLRDHUP | POLLERR;
-			nfds++;
-		} else {
-			p[nfds].fd = skt;
-			p[nfds].events = POLLIN | POLLERR;
-			nfds++;
-		}
-
-		if (lbcon.m_connected) {
-			p[nfds].fd = lbcon.m_fd;
-			p[nfds].events = POLLIN | POLLRDHUP | POLLERR;
-			nfds++;
-		} else {
-			p[nfds].fd = console;
-			p[nfds].events = POLLIN | POLLERR;
-			nfds++;
-		}
+	if ((epfd = epoll_create1(0)) < 0) {
+		perror("EPOLL-CREATE Failed!  O/S Err:");
+		exit(EXIT_FAILURE);
+	}
 
-		if ((pv=poll(p, nfds, FOREVER)) < 0) {
-			perror("Poll Failed!  O/S Err:");
-			exit(-1);
+	epoll_watch(epfd, EPOLL_CTL_ADD, tty, EPOLLIN);
+	epoll_watch(epfd, EPOLL_CTL_ADD, skt, EPOLLIN);
+	epoll_watch(epfd, EPOLL_CTL_ADD, console, EPOLLIN);
+
+	try { while(!done) {
+		struct	epoll_event	ev[MAXEVENTS];
+		bool	busy = false;
+		int	nev;
+
+		for(BUSCLIENT *c = clients; c; c = c->m_next)
+			busy = busy || c->pending();
+
+		// If any client still has transactions waiting, don't wait
+		// for anything new before giving it its next turn
+		nev = epoll_wait(epfd, ev, MAXEVENTS,
+					(busy) ? NO_WAITING : FOREVER);
+		if ((nev < 0)&&(errno == EINTR))
+			continue;
+		else if (nev < 0) {
+			perror("EPOLL-WAIT Failed!  O/S Err:");
+			exit(EXIT_FAILURE);
 		}
 
+		for(int i=0; i<nev; i++) {
+			int	fd = ev[i].data.fd;
 
-		//
-		//
-		// Now we evaluate what just happened
-		//
-		//
-
-		// Start by flusing everything on the TTY channel
-		if (p[0].revents & POLLIN) {
-			char	rawbuf[256];
-			int nr = read(tty, rawbuf, sizeof(rawbuf));
-			if (nr == 0) {
-				fprintf(stderr, "TTY device has closed\n");
-				exit(EXIT_SUCCESS);
-			} else if (nr < 0) {
-				fprintf(stderr, "ERR: Could not read from TTY\n");
-				perror("O/S Err:");
-				exit(EXIT_FAILURE);
-			} else while(nr > 0) {
-				int	ncmd = 0, ncon = 0;
-				for(int i=0; i<nr; i++) {
-					if (rawbuf[i] & 0x80)
-						lbcmd.m_buf[ncmd++] = rawbuf[i] & 0x07f;
-					else
-						lbcon.m_buf[ncon++] = rawbuf[i];
-				}
-				if ((lbcmd.m_fd >= 0)&&(ncmd>0)) {
-					int	nw;
-					nw = lbcmd.write(lbcmd.m_fd, ncmd);
-					if(nw != ncmd) {
-					// This fails when the other end resets
-					// the connection.  Thus, we'll just
-					// kindly close the connection and skip
-					// the assert that once was at the end.
-					lbcmd.close();
-					}
-				}
-
-				if ((lbcon.m_fd >= 0)&&(ncon>0)) {
-					int	nw;
-					nw = lbcon.write(lbcon.m_fd, ncon);
-					if(nw != ncon) {
-					// This fails when the other end resets
-					// the connection.  Thus, we'll just
-					// kindly close the connection and skip
-					// the assert that once was at the end.
-					lbcon.close();
-					}
+			if (fd == tty) {
+				if (0 == (ev[i].events & EPOLLIN)) {
+					fprintf(stderr, "ERR: UNKNOWN TTY EVENT: %d\n", ev[i].events);
+					perror("O/S Err?");
+					exit(EXIT_FAILURE);
 				}
 
-				if (ncmd > 0)
-					lbcmd.print_in(stdout, ncmd, (lbcmd.m_fd>=0)?"> ":"# ");
-				if (ncon > 0)
-					lbcon.print_in(stdout, ncon);
-				nr = read(tty, rawbuf, sizeof(rawbuf));
-			}
-		} else if (p[0].revents) {
-			fprintf(stderr, "ERR: UNKNOWN TTY EVENT: %d\n", p[0].revents);
-			perror("O/S Err?");
-			exit(EXIT_FAILURE);
-		}
-
-		if (p[1].revents & POLLIN) {
-			if (p[1].fd == skt) {
-				lbcmd.accept(skt);
-			} else { // p[1].fd == lbcmd.m_fd
-				int nr = lbcmd.read();
-				if (nr == 0) {
-					lbcmd.flush_out(stdout, "< ");
-					// printf("Disconnect\n");
-					lbcmd.close();
-				} else if (nr > 0) {
-					// printf("%d read from SKT\n", nr);
-					lbcmd.write(tty, nr, 0x80);
-					lbcmd.print_out(stdout, nr, "< ");
+				// Nothing's outstanding, so this can only be
+				// console traffic or an interrupt.  The
+				// TTYBUS will sort out which.
+				bus->usleep(0);
+			} else if (fd == skt) {
+				int	cfd = accept(skt, 0, 0);
+				BUSCLIENT	*c;
+
+				if (cfd < 0) {
+					perror("CMD Accept failed!  O/S Err:");
+					continue;
 				}
-			}
-		}
 
-		if (p[2].revents & POLLIN) {
-			if (p[2].fd == console) {
+				c = new BUSCLIENT(cfd, nclients++);
+				c->m_next = clients;
+				clients = c;
+				c->m_events = EPOLLIN;
+				epoll_watch(epfd, EPOLL_CTL_ADD, cfd, EPOLLIN);
+				printf("Accepted bus client #%d\n", c->m_id);
+			} else if (fd == console) {
 				lbcon.accept(console);
 				printf("Accepted a console connection\n");
-			} else { // p[1].fd == lbcon.m_fd
+				// Only one console at a time
+				epoll_watch(epfd, EPOLL_CTL_DEL, console, 0);
+				epoll_watch(epfd, EPOLL_CTL_ADD, lbcon.m_fd,
+					EPOLLIN | EPOLLRDHUP);
+			} else if (fd == lbcon.m_fd) {
 				int nr = lbcon.read();
-				if (nr == 0) {
+				if (nr <= 0) {
 					lbcon.flush_out(stdout);
+					epoll_watch(epfd, EPOLL_CTL_DEL,
+						lbcon.m_fd, 0);
 					lbcon.close();
-				} else if (nr > 0) {
+					epoll_watch(epfd, EPOLL_CTL_ADD,
+						console, EPOLLIN);
+				} else {
 					lbcon.write(tty, nr, 0x0);
 					lbcon.print_out(stdout, nr);
 				}
+			} else {
+				BUSCLIENT	*c;
+
+				for(c = clients; c; c = c->m_next)
+					if (c->m_fd == fd)
+						break;
+				if ((!c)||(c->m_dead))
+					continue;
+
+				if (ev[i].events & EPOLLIN) {
+					char	buf[4096];
+					int	nr = ::read(fd, buf, sizeof(buf));
+
+					if (nr > 0)
+						c->decode(buf, nr);
+					else if ((nr == 0)||(errno != EAGAIN))
+						c->m_dead = true;
+				}
+
+				if ((ev[i].events & EPOLLOUT)&&(!c->flush()))
+					c->m_dead = true;
+				if (ev[i].events & (EPOLLERR | EPOLLHUP))
+					c->m_dead = true;
 			}
 		}
+
+		// Give every client waiting on the bus its turn
+		for(BUSCLIENT *c = clients; c; c = c->m_next) {
+			if ((!c->m_dead)&&(c->pending()))
+				execute(bus, c);
+		}
+
+		// Any interrupts go to everyone
+		if (bus->poll()) {
+			for(BUSCLIENT *c = clients; c; c = c->m_next)
+				c->reply("4", 1);
+			bus->clear();
+		}
+
+		// Send what we can, and wait on the rest
+		for(BUSCLIENT **cp = &clients; *cp; ) {
+			BUSCLIENT	*c = *cp;
+			unsigned	events;
+
+			if ((!c->m_dead)&&(!c->flush()))
+				c->m_dead = true;
+
+			if (c->m_dead) {
+				printf("Bus client #%d disconnected\n", c->m_id);
+				epoll_watch(epfd, EPOLL_CTL_DEL, c->m_fd, 0);
+				*cp = c->m_next;
+				delete c;
+				continue;
+			}
+
+			events = EPOLLIN | ((c->m_olen > 0) ? EPOLLOUT : 0);
+			if (events != c->m_events) {
+				epoll_watch(epfd, EPOLL_CTL_MOD, c->m_fd, events);
+				c->m_events = events;
+			}
+			cp = &c->m_next;
+		}
+	}} catch(const char *err) {
+		fprintf(stderr, "ERR: %s, TTY device has closed\n", err);
+		exit(EXIT_FAILURE);
 	}
 
 	printf("Closing our sockets\n");
+	close(epfd);
 	close(console);
 	close(skt);
 }
-
@@ -49,10 +49,28 @@
 #define	FPGATTY		"/dev/ttyUSB1"
 #define	FPGAPORT	6780
 
+// The bus may be run using a binary, rather than ASCII, encoding.  This packs
+// seven bits into every byte when the port is shared with a console, or eight
+// on a dedicated port, rather than six.  If FPGABINARY is true, we'll ask the
+// FPGA for binary mode on connecting, and stay with ASCII if it won't.  Asking
+// costs every connection at least 120ms, so this is off unless built with
+// "make BINARY=1".
+#ifndef	FPGABINARY
+#define	FPGABINARY	false
+#endif
+
+// When running regressions against the simulation, we can skip the network
+// entirely and talk to it through shared memory.  If the FPGASHM environment
+// variable is set, it names the shared memory block the simulation (main_tb -m)
+// created, and we'll connect through that instead.
+#define	FPGASHM		"FPGASHM"
+
 #ifndef	FORCE_UART
-#define	FPGAOPEN(V) V= new FPGA(new NETCOMMS(FPGAHOST, FPGAPORT))
+#define	FPGAOPEN(V) V= new FPGA((getenv(FPGASHM))			\
+		? (LLCOMMSI *)new SHMCOMMS(getenv(FPGASHM))		\
+		: (LLCOMMSI *)new NETCOMMS(FPGAHOST, FPGAPORT), FPGABINARY)
 #else
-#define	FPGAOPEN(V) V= new FPGA(new TTYCOMMS(FPGATTY))
+#define	FPGAOPEN(V) V= new FPGA(new TTYCOMMS(FPGATTY), FPGABINARY)
 #endif
 
 #endif
@@ -48,6 +48,9 @@
 const	REGNAME	raw_bregs[] = {
 	{ R_FLASHCFG      ,	"FLASHCFG"    	},
 	{ R_FLASHCFG      ,	"QSPIC"       	},
+	{ R_FLASHCRCADDR  ,	"FLASHCRCADDR"	},
+	{ R_FLASHCRCLEN   ,	"FLASHCRCLEN" 	},
+	{ R_FLASHCRC      ,	"FLASHCRC"    	},
 	{ R_NETSCOPE      ,	"NETSCOPE"    	},
 	{ R_NETSCOPED     ,	"NETSCOPED"   	},
 	{ R_FLASHSCOPE    ,	"FLASHSCOPE"  	},
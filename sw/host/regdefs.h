@@ -57,6 +57,9 @@
 //
 // FLASH erase/program configuration registers
 #define	R_FLASHCFG      	0x00100000	// 00100000, wbregs names: FLASHCFG, QSPIC
+#define	R_FLASHCRCADDR  	0x00100004	// 00100000, wbregs names: FLASHCRCADDR
+#define	R_FLASHCRCLEN   	0x00100008	// 00100000, wbregs names: FLASHCRCLEN
+#define	R_FLASHCRC      	0x0010000c	// 00100000, wbregs names: FLASHCRC
 // enetscope scope
 #define	R_NETSCOPE      	0x00200000	// 00200000, wbregs names: NETSCOPE
 #define	R_NETSCOPED     	0x00200004	// 00200000, wbregs names: NETSCOPED
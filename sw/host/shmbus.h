@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Filename:	shmbus.h
+//
+// Project:	ZipVersa, Versa Brd implementation using ZipCPU infrastructure
+//
+// Purpose:	Describes a block of shared memory, through which the host
+//		software may talk to the Verilator simulation without going
+//	through the network.  The block holds two rings of characters, one
+//	headed to the FPGA and one headed back, each with exactly one writer
+//	and one reader.  The simulation creates the block, the host (SHMCOMMS,
+//	within llcomms.h) attaches to it.
+//
+//	Since each ring has but one reader and one writer, no locks are needed:
+//	the writer is the only one to ever adjust m_tail, and the reader the
+//	only one to ever adjust m_head.  Both are free running counters, so
+//	m_tail-m_head is the number of characters in the ring.
+//
+//	Only the bus is carried through this block.  The console remains on
+//	its network port.
+//
+// Creator:	Dan Gisselquist, Ph.D.
+//		Gisselquist Technology, LLC
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2019, Gisselquist Technology, LLC
+//
+// This program is free software (firmware): you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or (at
+// your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+// for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  (It's in the $(ROOT)/doc directory.  Run make with no
+// target there if the PDF file isn't present.)  If not, see
+// <http://www.gnu.org/licenses/> for a copy.
+//
+// License:	GPL, v3, as defined and found on www.gnu.org,
+//		http://www.gnu.org/licenses/gpl.html
+//
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+//
+#ifndef	SHMBUS_H
+#define	SHMBUS_H
+
+#include <string.h>
+
+// The size of each ring.  This must be a power of two.
+#define	SHMRINGLN	65536
+#define	SHMMAGIC	0x5a495053	// "ZIPS"
+
+typedef	struct	{
+	// Keep the reader's and writer's counters on separate cache lines
+	unsigned	m_head;
+	char		m_hpad[60];
+	unsigned	m_tail;
+	char		m_tpad[60];
+	char		m_data[SHMRINGLN];
+} SHMRING;
+
+struct	SHMBUS {
+	unsigned	m_magic;
+	char		m_pad[60];
+	SHMRING		m_tofpga, m_fromfpga;
+};
+
+// Returns the number of characters waiting to be read from the ring
+static inline	unsigned	shmring_used(SHMRING *r) {
+	return __atomic_load_n(&r->m_tail, __ATOMIC_ACQUIRE) - r->m_head;
+}
+
+// Returns the number of characters that may be written into the ring
+static inline	unsigned	shmring_free(SHMRING *r) {
+	return SHMRINGLN - (r->m_tail - __atomic_load_n(&r->m_head,
+						__ATOMIC_ACQUIRE));
+}
+
+// Writes up to len characters into the ring, returning the number written
+static inline	int	shmring_write(SHMRING *r, const char *buf, int len) {
+	unsigned	tail = r->m_tail, first, ln, avail;
+
+	// Check the free space only once, since the reader may free up more
+	// at any time
+	avail = shmring_free(r);
+	if ((unsigned)len > avail)
+		len = avail;
+
+	first = tail & (SHMRINGLN-1);
+	ln = ((unsigned)len > SHMRINGLN - first) ? SHMRINGLN - first : len;
+	memcpy(&r->m_data[first], buf, ln);
+	memcpy(r->m_data, &buf[ln], len-ln);
+
+	__atomic_store_n(&r->m_tail, tail+len, __ATOMIC_RELEASE);
+	return len;
+}
+
+// Reads up to len characters from the ring, returning the number read
+static inline	int	shmring_read(SHMRING *r, char *buf, int len) {
+	unsigned	head = r->m_head, first, ln, avail;
+
+	avail = shmring_used(r);
+	if ((unsigned)len > avail)
+		len = avail;
+
+	first = head & (SHMRINGLN-1);
+	ln = ((unsigned)len > SHMRINGLN - first) ? SHMRINGLN - first : len;
+	memcpy(buf, &r->m_data[first], ln);
+	memcpy(&buf[ln], r->m_data, len-ln);
+
+	__atomic_store_n(&r->m_head, head+len, __ATOMIC_RELEASE);
+	return len;
+}
+
+#endif
@@ -69,6 +69,12 @@
 
 const	unsigned TTYBUS::MAXRDLEN = 1024;
 const	unsigned TTYBUS::MAXWRLEN = 32;
+// The longest run a single stride command may write.  The FPGA can't take new
+// commands while running through one, so this is kept short enough that the
+// run will finish long before its input FIFO can fill.
+const	unsigned TTYBUS::MAXRUNLN = 4096;
+// The shortest run worth encoding as a stride command
+const	unsigned TTYBUS::MINRUNLN = 4;
 
 // #define	DBGPRINTF	printf
 // #define	DBGPRINTF	filedump
@@ -131,23 +137,6 @@ unsigned	TTYBUS::chardec(const char b) const {
 		return 0x0100; // ERR -- invalid code
 }
 
-int	TTYBUS::lclreadcode(char *buf, int len) {
-	char	*sp, *dp;
-	int	nr, ret;
-
-	nr = m_dev->read(buf, len);
-	m_total_nread += nr;
-	ret = nr; sp = buf; dp = buf;
-	for(int i=0; i<nr; i++) {
-		if (chardec(*sp)&(~0x3f)) {
-			ret--;	// Skip this value, not a valid codeword
-			sp++;
-		} else {
-			*sp++ = *dp++;
-		}
-	} return ret;
-}
-
 /*
  * bufalloc
  *
@@ -159,8 +148,12 @@ void	TTYBUS::bufalloc(int len) {
 		return;
 	if (m_buf)
 		delete[] m_buf;
+	if (m_bxout)
+		delete[] m_bxout;
 	m_buflen = (len&(-0x3f))+0x40;
 	m_buf = new char[m_buflen];
+	// In binary mode, each character may take as many as twelve bits
+	m_bxout = new char[2*m_buflen+2];
 }
 
 void	TTYBUS::encode(const int hb, const BUSW val, char *buf) const {
@@ -202,9 +195,11 @@ int	TTYBUS::decodehex(const char hx) const {
  * Write a single value to the debugging interface
  */
 void	TTYBUS::writeio(const BUSW a, const BUSW v) {
+	BUSTIMER	tmr(m_stats, BS_WRITEIO, 1);
 
 	writev(a, 0, 1, &v);
 	m_lastaddr = a; m_addr_set = true;
+	tmr.done();
 }
 
 /*
@@ -246,66 +241,49 @@ void	TTYBUS::writev(const BUSW a, const int p, const int len, const BUSW *buf) {
 	m_lastaddr = a; m_addr_set = true;
 
 	while(nw < len) {
-		int	ln = len-nw;
-		if ((unsigned)ln > MAXWRLEN)
-			ln = MAXWRLEN;
-
-		DBGPRINTF("WRITEV-SUB(%08x%s,#%d,&buf[%d])\n", a+nw, (p)?"++":"", ln, nw);
-		for(int i=0; i<ln; i++) {
-			BUSW	val = buf[nw+i];
-
-			int	caddr = 0;
-			// Let's try compression
-			for(int i=1; i<256; i++) {
-				unsigned	tstaddr;
-				tstaddr = (m_wraddr - i) & 0x0ff;
-				if ((!m_wrloaded)&&(tstaddr > (unsigned)m_wraddr))
-					break;
-				if (m_writetbl[tstaddr] == val) {
-					caddr = ( m_wraddr- tstaddr ) & 0x0ff;
-					break;
+		unsigned	ncw = 0;
+
+		DBGPRINTF("WRITEV-SUB(%08x%s,&buf[%d])\n", a+(nw<<2), (p)?"++":"", nw);
+		// Each codeword returns one acknowledgment, whether it writes
+		// one value or a whole run of them.  Send no more than
+		// MAXWRLEN codewords at a time.
+		for(ncw=0; (ncw < MAXWRLEN)&&(nw < len); ncw++) {
+			int	ln = 1, stride = 0;
+
+			// Can we write a run of values, each the last plus
+			// some stride, rather than one value at a time?  The
+			// first word of the burst can't be a run, since the
+			// FPGA needs a value to start from.
+			if (ncw > 0) {
+				stride = buf[nw] - buf[nw-1];
+				if ((stride >= -32768)&&(stride < 32768)) {
+					while((nw+ln < len)&&((unsigned)ln < MAXRUNLN)
+						&&(buf[nw+ln]-buf[nw+ln-1]
+							== (BUSW)stride))
+						ln++;
 				}
 			}
 
-		/*
-		if (caddr != 0)
-			DBGPRINTF("WR[%08x] = %08x (= TBL[%4x] <= %4x)\n", m_lastaddr, val, caddr, m_wraddr);
-		else
-			DBGPRINTF("WR[%08x] = %08x\n", m_lastaddr, val);
-		*/
-
-			if (caddr != 0) {
-				*ptr++ = charenc( (((caddr>>6)&0x03)<<1) + (p?1:0) + 0x010);
-				*ptr++ = charenc(    caddr    &0x3f    );
-			
-			} else {
-				// For testing, let's start just doing this the hard way
-				*ptr++ = charenc( (((val>>30)&0x03)<<1) + (p?1:0) + 0x018);
-				*ptr++ = charenc( (val>>24)&0x3f);
-				*ptr++ = charenc( (val>>18)&0x3f);
-				*ptr++ = charenc( (val>>12)&0x3f);
-				*ptr++ = charenc( (val>> 6)&0x3f);
-				*ptr++ = charenc( (val    )&0x3f);
-
-				m_writetbl[m_wraddr++] = val;
-				m_wraddr &= 0x0ff;
-				if (m_wraddr == 0) {
-					m_wrloaded = true;
-				}
+			if ((unsigned)ln >= MINRUNLN)
+				ptr = encode_stride(ln, stride, ptr);
+			else {
+				ln = 1;
+				ptr = encode_word(p, buf[nw], ptr);
 			}
 
-			if (p == 1) m_lastaddr+=4;
+			if (p == 1) m_lastaddr += ln<<2;
+			nw += ln;
 		}
-		// *ptr++ = charenc(0x2e);
-		if (ln == len-nw)
-			*ptr++ = '\n';
+		// End the burst.  We'll pick up where we left off (the FPGA
+		// keeps the address) on the next.  In binary mode, this also
+		// flushes our last byte.
+		*ptr++ = '\n';
 		*ptr = '\0';
-		m_dev->write(m_buf, ptr-m_buf);
+		send(m_buf, ptr-m_buf);
 		DBGPRINTF(">> %s\n", m_buf);
 
 		readidle();
 
-		nw += ln;
 		ptr = m_buf;
 	}
 	DBGPRINTF("WR: LAST ADDRESS LEFT AT %08x\n", m_lastaddr);
@@ -323,13 +301,87 @@ void	TTYBUS::writev(const BUSW a, const int p, const int len, const BUSW *buf) {
 	readidle();
 }
 
+/*
+ * encode_word
+ *
+ * Encodes a single write value into buf, using our write compression table
+ * if the value has been written recently.  p is one if the address should
+ * be incremented following this write, zero otherwise.  Returns a pointer
+ * to the character just past the encoded word.
+ */
+char	*TTYBUS::encode_word(const int p, const BUSW val, char *ptr) {
+	unsigned	h, caddr;
+
+	// Let's try compression.  Look up where this value was last written
+	// into our table, and check that it's still there.  Only the last
+	// (1<<LGWTBL)-1 values written may be referenced, and a reference of
+	// zero isn't valid.
+	h = wrhash(val);
+	caddr = m_wraddr - m_wrhash[h];
+	if ((caddr == 0)||(caddr >= (1u<<LGWTBL))
+		||(m_writetbl[m_wrhash[h] & ((1<<LGWTBL)-1)] != val))
+		caddr = 0;
+
+	/*
+	if (caddr != 0)
+		DBGPRINTF("WR[%08x] = %08x (= TBL[%4x] <= %4x)\n", m_lastaddr, val, caddr, m_wraddr);
+	else
+		DBGPRINTF("WR[%08x] = %08x\n", m_lastaddr, val);
+	*/
+
+	if (caddr != 0) {
+		m_stats.m_wrtbl++;
+		*ptr++ = charenc( (((caddr>>6)&0x03)<<1) + (p?1:0) + 0x010);
+		*ptr++ = charenc(    caddr    &0x3f    );
+	} else {
+		// For testing, let's start just doing this the hard way
+		*ptr++ = charenc( (((val>>30)&0x03)<<1) + (p?1:0) + 0x018);
+		*ptr++ = charenc( (val>>24)&0x3f);
+		*ptr++ = charenc( (val>>18)&0x3f);
+		*ptr++ = charenc( (val>>12)&0x3f);
+		*ptr++ = charenc( (val>> 6)&0x3f);
+		*ptr++ = charenc( (val    )&0x3f);
+
+		m_writetbl[m_wraddr & ((1<<LGWTBL)-1)] = val;
+		m_wrhash[h] = m_wraddr++;
+		m_stats.m_wrraw++;
+	}
+
+	return ptr;
+}
+
+/*
+ * encode_stride
+ *
+ * Encodes a command to write ln values, each one the last value written plus
+ * stride, into buf.  A stride of zero simply repeats the last value.  This
+ * only makes sense following a write, within the same write burst, and then
+ * the address increments (or not) as it did for that write.
+ *
+ * The command is a single six character codeword, 0001 followed by ln-1 in
+ * sixteen bits and then the stride in sixteen (signed) bits.
+ */
+char	*TTYBUS::encode_stride(const int ln, const int stride, char *ptr) {
+	assert((ln > 0)&&((unsigned)ln <= MAXRUNLN));
+	assert((stride >= -32768)&&(stride < 32768));
+
+	DBGPRINTF("WR[%08x] = ... + %d, x%d\n", m_lastaddr, stride, ln);
+	m_stats.m_wrruns++;
+	m_stats.m_wrrunwords += ln;
+	encode(1, ((ln-1)<<16)|(stride & 0x0ffff), ptr);
+	return ptr+6;
+}
+
 /*
  * writez
  *
  * Write a buffer of values to a single address.
  */
 void	TTYBUS::writez(const BUSW a, const int len, const BUSW *buf) {
+	BUSTIMER	tmr(m_stats, BS_WRITEZ, len);
+
 	writev(a, 0, len, buf);
+	tmr.done();
 }
 
 /*
@@ -339,7 +391,10 @@ void	TTYBUS::writez(const BUSW a, const int len, const BUSW *buf) {
  * increments the address pointer after every memory write.
  */
 void	TTYBUS::writei(const BUSW a, const int len, const BUSW *buf) {
+	BUSTIMER	tmr(m_stats, BS_WRITEI, len);
+
 	writev(a, 1, len, buf);
+	tmr.done();
 }
 
 /*
@@ -356,6 +411,7 @@ void	TTYBUS::writei(const BUSW a, const int len, const BUSW *buf) {
  *
  */
 TTYBUS::BUSW	TTYBUS::readio(const TTYBUS::BUSW a) {
+	BUSTIMER	tmr(m_stats, BS_READIO, 1);
 	BUSW	v;
 
 	// I/O reads are now the same as vector reads, but with a vector length
@@ -375,6 +431,7 @@ TTYBUS::BUSW	TTYBUS::readio(const TTYBUS::BUSW a) {
 		exit(-3);
 	}
 
+	tmr.done();
 	return v;
 }
 
@@ -386,8 +443,23 @@ TTYBUS::BUSW	TTYBUS::readio(const TTYBUS::BUSW a) {
  *
  */
 char	*TTYBUS::encode_address(const TTYBUS::BUSW a) {
+	char	*ptr = encode_address(a, m_buf);
+
+	if (ptr != m_buf)
+		m_rdaddr = 0;
+	return ptr;
+}
+
+/*
+ * encode_address(a, buf)
+ *
+ * Same as above, only the address command is placed into buf rather than at
+ * the beginning of m_buf.  This allows several commands to be strung together
+ * into one buffer before being sent.
+ */
+char	*TTYBUS::encode_address(const TTYBUS::BUSW a, char *buf) {
 	TTYBUS::BUSW	addr = a>>2;
-	char	*ptr = m_buf;
+	char	*ptr = buf;
 
 	// Double check that we are aligned
 	if ((a&3)!=0) {
@@ -400,7 +472,7 @@ char	*TTYBUS::encode_address(const TTYBUS::BUSW a) {
 	if (m_addr_set) {
 		// Encode a difference address
 		int	diffaddr = (a - m_lastaddr)>>2;
-		ptr = m_buf;
+		ptr = buf;
 		if ((diffaddr >= -32)&&(diffaddr < 32)) {
 			*ptr++ = charenc(0x09);
 			*ptr++ = charenc(diffaddr & 0x03f);
@@ -422,7 +494,7 @@ char	*TTYBUS::encode_address(const TTYBUS::BUSW a) {
 		}
 		*ptr = '\0';
 		DBGPRINTF("DIF-ADDR: (%ld) \'%s\' encodes last_addr(0x%08x) %c %d(0x%08x)\n",
-			ptr-m_buf, m_buf,
+			ptr-buf, buf,
 			m_lastaddr, (diffaddr<0)?'-':'+',
 			diffaddr, diffaddr&0x0ffffffff);
 	}
@@ -432,41 +504,40 @@ char	*TTYBUS::encode_address(const TTYBUS::BUSW a) {
 		// Prefer absolute address encoding over differential encoding,
 		// when both encodings encode the same address, and when both
 		// encode the address in the same number of words
-		if ((addr <= 0x03f)&&((ptr == m_buf)||(ptr >= &m_buf[2]))) {
-			ptr = m_buf;
+		if ((addr <= 0x03f)&&((ptr == buf)||(ptr >= &buf[2]))) {
+			ptr = buf;
 			*ptr++ = charenc(0x08);
 			*ptr++ = charenc(addr);
-		} else if((addr <= 0x0fff)&&((ptr == m_buf)||(ptr >= &m_buf[3]))) {
+		} else if((addr <= 0x0fff)&&((ptr == buf)||(ptr >= &buf[3]))) {
 			DBGPRINTF("Setting ADDR.3 to %08x\n", addr);
-			ptr = m_buf;
+			ptr = buf;
 			*ptr++ = charenc(0x0a);
 			*ptr++ = charenc((addr>> 6) & 0x03f);
 			*ptr++ = charenc( addr      & 0x03f);
-		} else if((addr <= 0x03ffff)&&((ptr == m_buf)||(ptr >= &m_buf[4]))) {
+		} else if((addr <= 0x03ffff)&&((ptr == buf)||(ptr >= &buf[4]))) {
 			DBGPRINTF("Setting ADDR.4 to %08x\n", addr);
-			ptr = m_buf;
+			ptr = buf;
 			*ptr++ = charenc(0x0c);
 			*ptr++ = charenc((addr>>12) & 0x03f);
 			*ptr++ = charenc((addr>> 6) & 0x03f);
 			*ptr++ = charenc( addr      & 0x03f);
-		} else if((addr <= 0x0ffffff)&&((ptr == m_buf)||(ptr >= &m_buf[5]))) {
+		} else if((addr <= 0x0ffffff)&&((ptr == buf)||(ptr >= &buf[5]))) {
 			DBGPRINTF("Setting ADDR.5 to %08x\n", addr);
-			ptr = m_buf;
+			ptr = buf;
 			*ptr++ = charenc(0x0e);
 			*ptr++ = charenc((addr>>18) & 0x03f);
 			*ptr++ = charenc((addr>>12) & 0x03f);
 			*ptr++ = charenc((addr>> 6) & 0x03f);
 			*ptr++ = charenc( addr      & 0x03f);
-		} else if (ptr == m_buf) { // Send our address prior to any read
-			// ptr = m_buf;
+		} else if (ptr == buf) { // Send our address prior to any read
+			// ptr = buf;
 			encode(0, addr, ptr);
 			ptr+=6;
 		}
 	}
 
 	*ptr = '\0';
-	DBGPRINTF("ADDR-CMD: (%ld) \'%s\'\n", ptr-m_buf, m_buf);
-	m_rdaddr = 0;
+	DBGPRINTF("ADDR-CMD: (%ld) \'%s\'\n", ptr-buf, buf);
 
 	return ptr;
 }
@@ -531,7 +602,7 @@ void	TTYBUS::readv(const TTYBUS::BUSW a, const int inc, const int len, TTYBUS::B
 		} while((cmdrd-nread < READAHEAD+READBLOCK)&&(cmdrd< len));
 
 		*ptr++ = '\n'; *ptr = '\0';
-		m_dev->write(m_buf, (ptr-m_buf));
+		send(m_buf, (ptr-m_buf));
 
 		// DBGPRINTF("Reading %d words\n", (cmdrd-nread));
 		while(nread<(cmdrd-READAHEAD)) {
@@ -567,7 +638,10 @@ void	TTYBUS::readv(const TTYBUS::BUSW a, const int inc, const int len, TTYBUS::B
  */
 
 void	TTYBUS::readi(const TTYBUS::BUSW a, const int len, TTYBUS::BUSW *buf) {
+	BUSTIMER	tmr(m_stats, BS_READI, len);
+
 	readv(a, 1, len, buf);
+	tmr.done();
 }
 
 /*
@@ -580,150 +654,444 @@ void	TTYBUS::readi(const TTYBUS::BUSW a, const int len, TTYBUS::BUSW *buf) {
  * Also calls readv to do the heavy lifting.
  */
 void	TTYBUS::readz(const TTYBUS::BUSW a, const int len, TTYBUS::BUSW *buf) {
+	BUSTIMER	tmr(m_stats, BS_READZ, len);
+
 	readv(a, 0, len, buf);
+	tmr.done();
 }
 
 /*
- * readword()
+ * The decoder
  *
- * Once the read command has been issued, readword() is called to read each
- * word's response from the bus.  This also processes any out of bounds
- * characters, such as interrupt notifications or bus error condition
- * notifications.
+ * Every codeword returned from the device starts with a character that tells
+ * us both how long the codeword is, and what to do with it once it's complete.
+ * Rather than working this out with a chain of comparisons for every
+ * character, we look it up in a table indexed by the (eight bit) character
+ * itself.  The table is built once, on first use, from the same encoding
+ * used by charenc() and chardec().
+ *
+ * For each character, the table holds:
+ *	sixbits	The six bit value of the character, when it follows the
+ *		first character of a codeword
+ *	len	The length of any codeword beginning with this character,
+ *		or zero if the character isn't part of our code at all
+ *		(newlines, for example)
+ *	type	What to do once the codeword is complete
+ *	inc	One if the address increments following this (read) codeword
+ *	head	Any value bits carried in the first character of the codeword
  */
-TTYBUS::BUSW	TTYBUS::readword(void) {
-	TTYBUS::BUSW	val = 0;
-	int		nr;
-	unsigned	sixbits;
+#define	DEC_SKIP	0	// Not a valid code character
+#define	DEC_IDLE	1	// Idle, or bus busy while otherwise idle
+#define	DEC_ACK		2	// Write acknowledgement
+#define	DEC_RESET	3	// The bus was reset
+#define	DEC_INT		4	// An interrupt has taken place
+#define	DEC_ERR		5	// Bus error
+#define	DEC_ADDR	6	// New address, full or compressed
+#define	DEC_TBL		7	// Read value, from 1-9 values ago
+#define	DEC_LTBL	8	// Read value, from 10-521 values ago
+#define	DEC_RAW		9	// Read value, uncompressed
+#define	DEC_UNKNOWN	10	// Reserved codeword
+
+typedef	struct	{
+	unsigned char	m_sixbits, m_len, m_type, m_inc;
+	unsigned	m_head;
+} DECODEENT;
+
+static	DECODEENT	s_dec[256];
+static	bool		s_dec_built = false;
+
+void	TTYBUS::builddecoder(void) {
+	if (s_dec_built)
+		return;
 
-	DBGPRINTF("READ-WORD()\n");
+	for(int ch=0; ch<256; ch++) {
+		DECODEENT	*d = &s_dec[ch];
+		unsigned	sb;
+
+		memset(d, 0, sizeof(DECODEENT));
+
+		if ((ch >= '0')&&(ch <= '9'))
+			sb = ch-'0';
+		else if ((ch >= 'A')&&(ch <= 'Z'))
+			sb = ch-'A'+10;
+		else if ((ch >= 'a')&&(ch <= 'z'))
+			sb = ch-'a'+36;
+		else if (ch == '@')
+			sb = 0x03e;
+		else if (ch == '%')
+			sb = 0x03f;
+		else {
+			d->m_type = DEC_SKIP;
+			continue;
+		}
 
-	bool	found_start = false;
-	do {
-		// Blocking read (for now)
-		do {
-			nr = lclreadcode(&m_buf[0], 1);
-		} while (nr < 1);
-		DBGPRINTF("READWORD: -- lclreadcode, nr = %d, m_buf[0] = %c\n", nr, m_buf[0]);
+		d->m_sixbits = sb;
+		d->m_len = 1;
+		d->m_inc = sb & 1;
+		if (sb < 6) {
+			// Single character, out of band, codewords
+			static const unsigned char oob[6] = {
+				DEC_IDLE, DEC_IDLE, DEC_ACK,
+				DEC_RESET, DEC_INT, DEC_ERR };
+			d->m_type = oob[sb];
+		} else if (0x06 == (sb & 0x03e)) { // Repeat the last value
+			d->m_type = DEC_TBL;
+			d->m_head = 1;
+		} else if (0x08 == (sb & 0x03c)) { // Set 32-bit address
+			d->m_type = DEC_ADDR;
+			d->m_len  = 6;
+			d->m_head = sb & 0x03;
+		} else if (0x0c == (sb & 0x03c)) { // Compressed address
+			d->m_type = DEC_ADDR;
+			d->m_len  = (sb & 0x03) + 2;
+			d->m_head = 0;
+		} else if (0x10 == (sb & 0x030)) { // Tbl read, up to 521 ago
+			d->m_type = DEC_LTBL;
+			d->m_len  = 2;
+			d->m_head = (sb>>1) & 0x07;
+		} else if (0x20 == (sb & 0x030)) { // Tbl read, 2-9 ago
+			d->m_type = DEC_TBL;
+			d->m_head = ((sb>>1) & 0x07) + 2;
+		} else if (0x38 == (sb & 0x038)) { // Raw read
+			d->m_type = DEC_RAW;
+			d->m_len  = 6;
+			d->m_head = (sb>>1) & 0x03;
+		} else
+			d->m_type = DEC_UNKNOWN;
+	}
 
-		sixbits = chardec(m_buf[0]);
+	s_dec_built = true;
+}
 
-		if (sixbits&(~0x03f)) {
+/*
+ * decode()
+ *
+ * Decodes a buffer of characters received from the device.  Values read are
+ * placed into our word queue, from whence readword() will return them.
+ * Everything else--interrupts, write acknowledgements, and new addresses--is
+ * recorded as it is found.  A codeword may be split across calls, since the
+ * decoder's state is kept between them.
+ *
+ * Decoding stops early following any bus error, so that the error may be
+ * reported in its proper place among the values read, or if the word queue
+ * fills up.  Returns the number of characters consumed.
+ */
+int	TTYBUS::decode(const char *buf, const int len) {
+	const	unsigned char	*ptr = (const unsigned char *)buf;
+	int	i;
+
+	for(i=0; i<len; i++) {
+		const	DECODEENT	*d = &s_dec[ptr[i]];
+		const	DECODEENT	*cw;
+
+		if (d->m_type == DEC_SKIP)
 			// Ignore new lines, unprintables, and characters
 			// not a part of our code
-			;
-		} else if (sixbits < 6) {
-			switch(sixbits) {
-			case 0:	break; // Idle -- ignore
-			case 1: break; // Idle, but the bus is busy
-			case 2: break; // Write acknowledgement, ignore it here
-			case 3:
-				m_bus_err = true;
-				DBGPRINTF("READWORD::BUSRESET (unknown addr)\n");
-				throw BUSERR(0);
-				break;
-			case 4:
-				m_interrupt_flag = true;
-				break;
-			case 5:
-				DBGPRINTF("READWORD::BUSERR (unknown addr)\n");
-				m_bus_err = true;
-				throw BUSERR(0);
-				break;
-			}
-		} else if (0x08 == (sixbits & 0x3c)) { // Set 32-bit address
-			do {
-				nr += lclreadcode(&m_buf[nr], 6-nr);
-			} while (nr < 6);
-
-			val = chardec(m_buf[0]) & 0x03;
-			val = (val<<6) | (chardec(m_buf[1]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[4]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[5]) & 0x03f);
+			continue;
+
+		if (m_dcount == 0) {
+			// First character of a new codeword
+			if (((m_wqtail+1)&(WORDQLN-1)) == m_wqhead)
+				break;	// No room for any more values
+			m_dfirst = ptr[i];
+			m_dval   = d->m_head;
+			m_dcount = d->m_len - 1;
+		} else {
+			m_dval = (m_dval << 6) | d->m_sixbits;
+			m_dcount--;
+		}
 
+		if (m_dcount != 0)
+			continue;
+
+		// We now have a complete codeword
+		cw = &s_dec[m_dfirst];
+		switch(cw->m_type) {
+		case DEC_IDLE:	break;
+		case DEC_ACK:	m_wracks++; break;
+		case DEC_INT:	m_interrupt_flag = true; break;
+		case DEC_RESET:
+		case DEC_ERR:
+			m_stats.m_buserrs++;
+			DBGPRINTF("DECODE::%s (unknown addr)\n",
+				(cw->m_type == DEC_RESET) ? "BUSRESET":"BUSERR");
+			m_bus_err = true;
+			m_errpending = true;
+			return i+1;
+		case DEC_ADDR:
 			m_addr_set = true;
-			m_lastaddr = val<<2;
-
-			DBGPRINTF("RCVD ADDR: 0x%08x\n", val<<2);
-		} else if (0x0c == (sixbits & 0x03c)) { // Set 32-bit address,compressed
-			int nw = (sixbits & 0x03) + 2;
-			do {
-				nr += lclreadcode(&m_buf[nr], nw-nr);
-			} while (nr < nw);
-
-			if (nw == 2) {
-				val = chardec(m_buf[1]);
-			} else if (nw == 3) {
-				val = chardec(m_buf[1]);
-				val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-			} else if (nw == 4) {
-				val = chardec(m_buf[1]);
-				val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-				val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-			} else { // if (nw == 5)
-				val = chardec(m_buf[1]);
-				val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-				val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-				val = (val<<6) | (chardec(m_buf[4]) & 0x03f);
+			m_lastaddr = m_dval<<2;
+			DBGPRINTF("RCVD ADDR: 0x%08x\n", m_lastaddr);
+			break;
+		case DEC_LTBL:
+			m_dval += 10;
+			// Fall through
+		case DEC_TBL:
+			if (cw->m_type == DEC_LTBL)
+				m_stats.m_rdltbl++;
+			else
+				m_stats.m_rdtbl++;
+			m_wordq[m_wqtail] = m_readtbl[(m_rdaddr-m_dval)&((1<<LGRTBL)-1)];
+			m_wqtail = (m_wqtail+1)&(WORDQLN-1);
+			m_lastaddr += cw->m_inc << 2;
+			break;
+		case DEC_RAW:
+			m_stats.m_rdraw++;
+			m_readtbl[m_rdaddr++] = m_dval; m_rdaddr &= (1<<LGRTBL)-1;
+			m_wordq[m_wqtail] = m_dval;
+			m_wqtail = (m_wqtail+1)&(WORDQLN-1);
+			m_lastaddr += cw->m_inc << 2;
+			break;
+		default:
+			DBGPRINTF("DECODE() -- Unknown codeword, %c\n", m_dfirst);
+			break;
+		}
+	}
+
+	return i;
+}
+
+/*
+ * readmore()
+ *
+ * Decodes whatever the device has received, blocking until at least one
+ * character is available.  The characters are decoded in place, straight out
+ * of the device's receive buffer, and only those the decoder has used are
+ * then consumed.  In binary mode, we first unpack what we've received into
+ * m_bxbuf, and decode from there instead.
+ */
+void	TTYBUS::readmore(void) {
+	const char	*ptr;
+	int		nr;
+
+	if (m_binbits) {
+		if (m_bxfirst >= m_bxlast) {
+			nr = m_dev->peek(&ptr);
+			// Each byte unpacks into (at most) two characters
+			if (nr > BXBUFLN/2)
+				nr = BXBUFLN/2;
+			m_bxfirst = 0;
+			m_bxlast  = unpack(ptr, nr);
+			m_dev->consume(nr);
+			m_total_nread += nr;
+		}
+
+		nr = decode(&m_bxbuf[m_bxfirst], m_bxlast-m_bxfirst);
+		m_bxfirst += nr;
+		m_stats.m_rxchars += nr;
+		return;
+	}
+
+	nr = m_dev->peek(&ptr);
+	nr = decode(ptr, nr);
+	m_stats.m_rxchars += nr;
+	m_dev->consume(nr);
+	m_total_nread += nr;
+}
+
+/*
+ * rxavail()
+ *
+ * Returns true if there's anything waiting to be decoded, either already
+ * unpacked or still within the device.
+ */
+bool	TTYBUS::rxavail(void) {
+	return (m_bxfirst < m_bxlast)||(m_dev->available());
+}
+
+/*
+ * unpack()
+ *
+ * Binary mode.  Unpacks len bytes of m_binbits bits each into the six-bit
+ * values they contain, and places those values into m_bxbuf as the ASCII
+ * characters they would've been sent as.  A 63 followed by a 63 is a 63,
+ * whereas a 63 followed by anything else is a newline--following which the
+ * remaining bits of the byte are padding.  Returns the number of characters
+ * placed into m_bxbuf.
+ */
+int	TTYBUS::unpack(const char *buf, const int len) {
+	int	nc = 0;
+
+	for(int i=0; i<len; i++) {
+		m_bxacc = (m_bxacc << m_binbits)
+			| (buf[i] & ((1<<m_binbits)-1));
+		m_bxnacc += m_binbits;
+
+		while(m_bxnacc >= 6) {
+			unsigned sym = (m_bxacc >> (m_bxnacc-6)) & 0x03f;
+
+			m_bxnacc -= 6;
+			if (m_bxesc) {
+				m_bxesc = false;
+				if (sym == 0x03f)
+					m_bxbuf[nc++] = charenc(sym);
+				else {
+					m_bxbuf[nc++] = '\n';
+					// Skip the rest of this byte
+					m_bxnacc = 0;
+				}
+			} else if (sym == 0x03f)
+				m_bxesc = true;
+			else
+				m_bxbuf[nc++] = charenc(sym);
+		}
+	}
+
+	return nc;
+}
+
+/*
+ * send()
+ *
+ * Sends the len characters within buf to the device.  In binary mode, these
+ * are first packed, m_binbits bits per byte, into m_bxout.  Since buf always
+ * ends with a newline, the packed result always ends on a byte boundary.
+ */
+void	TTYBUS::send(char *buf, int len) {
+	unsigned	acc = 0;
+	int		nacc = 0, nb = 0;
+
+	m_stats.m_txchars += len;
+	if (!m_binbits) {
+		m_dev->write(buf, len);
+		return;
+	}
+
+	assert((len > 0)&&(buf[len-1] == '\n'));
+	for(int i=0; i<len; i++) {
+		if (buf[i] == '\n') {
+			acc = (acc << 12) | 0x0fc0;
+			nacc += 12;
+		} else {
+			unsigned sym = chardec(buf[i]) & 0x03f;
+
+			if (sym == 0x03f) {
+				acc = (acc << 12) | 0x0fff;
+				nacc += 12;
+			} else {
+				acc = (acc << 6) | sym;
+				nacc += 6;
 			}
+		}
 
-			m_addr_set = true;
-			m_lastaddr = val<<2;
-			DBGPRINTF("RCVD ADDR: 0x%08x (%d bytes)\n", val<<2, nw+1);
+		while(nacc >= m_binbits) {
+			m_bxout[nb++] = (acc >> (nacc-m_binbits))
+					& ((1<<m_binbits)-1);
+			nacc -= m_binbits;
+		}
+
+		// Pad any newline out to the end of its byte
+		if ((buf[i] == '\n')&&(nacc > 0)) {
+			m_bxout[nb++] = (acc << (m_binbits-nacc))
+					& ((1<<m_binbits)-1);
+			nacc = 0;
+		}
+	}
+
+	m_dev->write(m_bxout, nb);
+}
+
+/*
+ * negotiate()
+ *
+ * Asks the FPGA to switch to binary mode.  First, in case some prior program
+ * left it in binary mode, we send it the sixteen zero bytes that return it to
+ * ASCII, and wait for it to go quiet.  Then we ask for binary with a 0x02.
+ * An FPGA that supports binary mode answers with 0x10 plus the number of bits
+ * per byte it'll use, and everything following is then binary.  Anything
+ * before that is left over from before, and may be ignored.  If we don't get
+ * an answer, we just continue on in ASCII.
+ */
+void	TTYBUS::negotiate(void) {
+	const	int	MAXWAIT = 4096;
+	char		req[17];
+	const char	*ptr;
+	int		nr, nskipped = 0;
+
+	memset(req, 0, 16);
+	req[16] = '\n';
+	m_dev->write(req, 17);
+
+	// Anything already on its way to us might've been sent in binary, so
+	// wait for the FPGA to go quiet before asking
+	while((nskipped < MAXWAIT)&&(m_dev->poll(20))) {
+		nr = m_dev->peek(&ptr);
+		m_dev->consume(nr);
+		nskipped += nr;
+	}
+
+	req[0] = 0x02;
+	m_dev->write(req, 1);
+
+	nskipped = 0;
+	while((nskipped < MAXWAIT)&&(m_dev->poll(100))) {
+		nr = m_dev->peek(&ptr);
+		for(int i=0; i<nr; i++) {
+			if ((ptr[i] == 0x17)||(ptr[i] == 0x18)) {
+				m_binbits = ptr[i] - 0x10;
+				m_dev->consume(i+1);
+				m_bxacc = 0; m_bxnacc = 0; m_bxesc = false;
+				if (!m_bxbuf)
+					m_bxbuf = new char[BXBUFLN];
+				DBGPRINTF("NEGOTIATE: %d-bit binary\n", m_binbits);
+				return;
+			}
+		}
+
+		m_dev->consume(nr);
+		nskipped += nr;
+	}
+
+	DBGPRINTF("NEGOTIATE: No answer, staying with ASCII\n");
+}
+
+/*
+ * close()
+ *
+ * Closes our connection.  If we're in binary mode, we first return the FPGA
+ * to ASCII, so that anything else may talk to it.
+ */
+void	TTYBUS::close(void) {
+	if (m_binbits) {
+		char	zeros[17];
+
+		memset(zeros, 0, 16);
+		zeros[16] = '\n';
+		m_binbits = 0;
+		try {
+			m_dev->write(zeros, sizeof(zeros));
+		} catch(...) {
+			// If we can't write to the device, it's already gone
+		}
+	}
+	m_dev->close();
+}
+
+/*
+ * readword()
+ *
+ * Once the read command has been issued, readword() is called to read each
+ * word's response from the bus.  Any out of bounds characters, such as
+ * interrupt notifications or bus error condition notifications, are handled
+ * by the decoder along the way.
+ */
+TTYBUS::BUSW	TTYBUS::readword(void) {
+	TTYBUS::BUSW	val;
+
+	DBGPRINTF("READ-WORD()\n");
+
+	while(m_wqhead == m_wqtail) {
+		if (m_errpending) {
+			m_errpending = false;
+			throw BUSERR(0);
 		} else
-			found_start = true;
-	} while(!found_start);
-
-	int	rdaddr;
-
-	DBGPRINTF("READ-WORD() -- sixbits = %02x\n", sixbits);
-	if (0x06 == (sixbits & 0x03e)) { // Tbl read, last value
-		rdaddr = (m_rdaddr-1)&0x03ff;
-		val = m_readtbl[rdaddr];
-		m_lastaddr += (sixbits&1)?4:0;
-		DBGPRINTF("READ-WORD() -- repeat last value, %08x, A= %08x\n", val, m_lastaddr);
-	} else if (0x10 == (sixbits & 0x030)) { // Tbl read, up to 521 into past
-		int	idx;
-		do {
-			nr += lclreadcode(&m_buf[nr], 2-nr);
-		} while (nr < 2);
-
-		idx = (chardec(m_buf[0])>>1) & 0x07;
-		idx = ((idx<<6) | (chardec(m_buf[1]) & 0x03f)) + 2 + 8;
-		rdaddr = (m_rdaddr-idx)&0x03ff;
-		val = m_readtbl[rdaddr];
-		m_lastaddr += (sixbits&1)?4:0;
-		DBGPRINTF("READ-WORD() -- long table value[%3d], %08x, A=%08x\n", idx, val, m_lastaddr);
-	} else if (0x20 == (sixbits & 0x030)) { // Tbl read, 2-9 into past
-		int	idx;
-		idx = (((sixbits>>1)&0x07)+2);
-		rdaddr = (m_rdaddr - idx) & 0x03ff;
-		val = m_readtbl[rdaddr];
-		m_lastaddr += (sixbits&1)?4:0;
-		DBGPRINTF("READ-WORD() -- short table value[%3d], %08x, A=%08x\n", idx, val, m_lastaddr);
-	} else if (0x38 == (sixbits & 0x038)) { // Raw read
-		// DBGPRINTF("READ-WORD() -- RAW-READ, nr = %d\n", nr);
-		do {
-			nr += lclreadcode(&m_buf[nr], 6-nr);
-		} while (nr < 6);
-
-		val = (chardec(m_buf[0])>>1) & 0x03;
-		val = (val<<6) | (chardec(m_buf[1]) & 0x03f);
-		val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-		val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-		val = (val<<6) | (chardec(m_buf[4]) & 0x03f);
-		val = (val<<6) | (chardec(m_buf[5]) & 0x03f);
-
-		m_readtbl[m_rdaddr++] = val; m_rdaddr &= 0x03ff;
-		m_lastaddr += (sixbits&1)?4:0;
-		DBGPRINTF("READ-WORD() -- RAW-READ %02x:%02x:%02x:%02x:%02x:%02x -- %08x, A=%08x\n",
-			m_buf[0], m_buf[1], m_buf[2], m_buf[3],
-			m_buf[4], m_buf[5], val, m_lastaddr);
-	} else 
-		DBGPRINTF("READ-WORD() -- Unknown character, %02x\n", sixbits);
+			readmore();
+	}
+
+	val = m_wordq[m_wqhead];
+	m_wqhead = (m_wqhead+1)&(WORDQLN-1);
 
+	DBGPRINTF("READ-WORD() -- %08x, A=%08x\n", val, m_lastaddr);
 	return val;
 }
 
@@ -735,143 +1103,333 @@ TTYBUS::BUSW	TTYBUS::readword(void) {
  * case anything else is in the stream ... we mostly ignore that here too.
  */
 void	TTYBUS::readidle(void) {
-	TTYBUS::BUSW	val = 0;
-	int		nr;
-	unsigned	sixbits;
-	bool		found_start = false;
-
 	DBGPRINTF("READ-IDLE()\n");
 
-	while((!found_start)&&(m_dev->available())
-			&&((nr=lclreadcode(&m_buf[0], 1))>0)) {
-		nr = lclreadcode(&m_buf[0], 1);
-		sixbits = chardec(m_buf[0]);
+	while((!m_errpending)&&(rxavail())) {
+		readmore();
 
-		if (sixbits&(~0x03f)) {
-			// Ignore new lines, unprintables, and characters
-			// not a part of our code
-			;
-		} else if (sixbits < 6) {
-			switch(sixbits) {
-			case 0:	break; // Idle -- ignore
-			case 1: break; // Idle, but the bus is busy
-			case 2:
-				// Write acknowledgement, ignore it here
-				// This is one of the big reasons why we are
-				// doing this.
-				break;
-			case 3:
-				m_bus_err = true;
-				DBGPRINTF("READ-IDLE() - BUSERR\n");
-				throw BUSERR(0);
-				break;
-			case 4:
-				m_interrupt_flag = true;
-				break;
-			case 5:
-				m_bus_err = true;
-				DBGPRINTF("READ-IDLE() - BUS RESET\n");
-				throw BUSERR(0);
+		if (m_wqhead != m_wqtail) {
+			// We're in readidle().  We don't expect to find any
+			// data.  But ... we did.  The decoder has already
+			// kept our table up to date, so just ignore it.
+			DBGPRINTF("READ-IDLE()  PANIC! -- unexpected values\n");
+			m_wqhead = m_wqtail;
+		}
+	}
+
+	if (m_errpending) {
+		m_errpending = false;
+		DBGPRINTF("READ-IDLE() - BUSERR\n");
+		throw BUSERR(0);
+	}
+}
+
+/*
+ * readacks()
+ *
+ * Reads from the bus until n write acknowledgements have been received since
+ * m_wracks was last cleared.  Unlike readidle(), this blocks until the
+ * acknowledgements arrive.  Any values read along the way are left in the
+ * word queue for readword() to pick up later.
+ */
+void	TTYBUS::readacks(const unsigned n) {
+	DBGPRINTF("READ-ACKS(%d of %d)\n", m_wracks, n);
+	while(m_wracks < n) {
+		if (m_errpending) {
+			m_errpending = false;
+			throw BUSERR(0);
+		} else
+			readmore();
+	}
+}
+
+/*
+ * qalloc
+ *
+ * Returns a pointer to a new (uninitialized) entry at the end of our queue of
+ * pending transactions, growing the queue as necessary.
+ */
+TTYBUS::BUSOP	*TTYBUS::qalloc(void) {
+	if (m_qlen >= m_qalloc) {
+		BUSOP	*q;
+
+		m_qalloc = (m_qalloc < 64) ? 64 : (m_qalloc * 2);
+		q = new BUSOP[m_qalloc];
+		if (m_queue) {
+			memcpy(q, m_queue, m_qlen * sizeof(BUSOP));
+			delete[] m_queue;
+		} m_queue = q;
+	}
+
+	return &m_queue[m_qlen++];
+}
+
+/*
+ * queue_write
+ *
+ * Queue a write to be issued by complete().
+ */
+void	TTYBUS::queue_write(const BUSW a, const BUSW v) {
+	BUSOP	*op = qalloc();
+
+	op->m_addr = a;
+	op->m_data = v;
+	op->m_rdp  = NULL;
+}
+
+/*
+ * queue_read
+ *
+ * Queue a read to be issued by complete().  The result will be placed into
+ * *v once complete() returns.
+ */
+void	TTYBUS::queue_read(const BUSW a, BUSW *v) {
+	BUSOP	*op = qalloc();
+
+	assert(v != NULL);
+	op->m_addr = a;
+	op->m_data = 0;
+	op->m_rdp  = v;
+}
+
+/*
+ * qrunlen
+ *
+ * Queued transactions are sent as runs: a group of either reads or writes,
+ * all to the same address or all to incrementing addresses.  Each run costs
+ * one address command (if that), and can then be encoded as a single vector
+ * read or a single multi-word write.  This returns the length of the run
+ * starting at queue index k.  Runs are limited in length so that no run
+ * produces more than MAXRDLEN/2 return codewords.
+ */
+int	TTYBUS::qrunlen(const int k) const {
+	const	int	MAXRUN = MAXRDLEN/2-1;
+	const	BUSOP	*op = &m_queue[k];
+	bool	rd = (op->m_rdp != NULL);
+	BUSW	inc;
+	int	ln = 1;
+
+	if (k+1 >= m_qlen)
+		return 1;
+
+	inc = (op[1].m_addr == op[0].m_addr+4) ? 4 : 0;
+	while((k+ln < m_qlen)&&(ln < MAXRUN)
+			&&((op[ln].m_rdp != NULL) == rd)
+			&&(op[ln].m_addr == op[ln-1].m_addr + inc))
+		ln++;
+
+	return ln;
+}
+
+/*
+ * encode_run
+ *
+ * Encodes the run of ln queued transactions, starting at queue index k, into
+ * buf.  Keeps m_lastaddr tracking the address the bus will be left at once
+ * this run has been processed.
+ */
+char	*TTYBUS::encode_run(const int k, const int ln, char *ptr) {
+	const	BUSOP	*op = &m_queue[k];
+	int	inc = ((ln > 1)&&(op[1].m_addr != op[0].m_addr)) ? 1:0;
+
+	ptr = encode_address(op->m_addr, ptr);
+	m_lastaddr = op->m_addr; m_addr_set = true;
+
+	if (op->m_rdp) {
+		ptr = readcmd(inc, ln, ptr);
+		if (inc)
+			m_lastaddr += ln<<2;
+	} else {
+		for(int i=0; i<ln; i++)
+			ptr = encode_word(inc, op[i].m_data, ptr);
+		if (inc)
+			m_lastaddr += ln<<2;
+		// End the write burst
+		*ptr++ = '\n';
+	}
+
+	return ptr;
+}
+
+/*
+ * complete
+ *
+ * Sends all of our queued reads and writes to the device, and waits for them
+ * to complete.  Rather than waiting on a round trip per transaction, as many
+ * transactions as will fit within the device's return FIFO are packed into
+ * a single write to the device.  Once more than half of the FIFO's worth of
+ * responses are outstanding, we stop and read responses back--in order--until
+ * there's room to send more.  This follows the same read ahead scheme used
+ * by readv() above.
+ *
+ * Should any transaction fail, the device drops the rest of its run, but
+ * carries on with every run following.  We then read back (and ignore) the
+ * responses to every run we've already sent, so that none of them get
+ * mistaken for responses to whatever comes next, before throwing a BUSERR
+ * giving the queue index of the failed transaction and the number of
+ * transactions sent.
+ */
+void	TTYBUS::complete(void) {
+	const	unsigned	READAHEAD = MAXRDLEN/2;
+	int		nsent = 0, ndone = 0, errat = -1;
+	unsigned	outstanding = 0, nacks = 0;
+	BUSW		lastaddr;
+	char		*ptr;
+
+	if (m_qlen <= 0)
+		return;
+
+	BUSTIMER	tmr(m_stats, BS_COMPLETE, m_qlen);
+	DBGPRINTF("COMPLETE(#%d)\n", m_qlen);
+
+	// No run may cost more than READAHEAD return codewords, and each
+	// transaction costs at least one.  Hence, we'll never have more than
+	// MAXRDLEN transactions within any one write.  Allocate enough buffer
+	// space for all of these, at their worst case encoding: six characters
+	// of address, six of data, and a new line.
+	bufalloc(14*MAXRDLEN+16);
+
+	// Clear any write acknowledgements left over from prior writes.  Any
+	// error found here belongs to something before us, so nothing of ours
+	// has been sent.
+	try {
+		readidle();
+	} catch(BUSERR b) {
+		m_qlen = 0;
+		throw BUSERR(b.addr, -1, 0);
+	}
+	m_wracks = 0;
+
+	while(ndone < m_qlen) {
+		ptr = m_buf;
+		while(nsent < m_qlen) {
+			int		ln = qrunlen(nsent);
+			unsigned	cost;
+
+			// Reads return an address codeword, then a codeword
+			// per value.  Writes return an acknowledgment per
+			// value.
+			cost = (m_queue[nsent].m_rdp) ? ln+1 : ln;
+			if (outstanding + cost > MAXRDLEN)
 				break;
-			}
-		} else if (0x08 == (sixbits & 0x3c)) { // Set 32-bit address
-			do {
-				nr += lclreadcode(&m_buf[nr], 6-nr);
-			} while (nr < 6);
-
-			val = chardec(m_buf[0]) & 0x03;
-			val = (val<<6) | (chardec(m_buf[1]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[4]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[5]) & 0x03f);
-
-			/* Ignore the address, as we are in readidle();
-			m_addr_set = true;
-			m_lastaddr = val;
-			*/
-
-			DBGPRINTF("RCVD IDLE-ADDR: 0x%08x\n", val);
-		} else if (0x0c == (sixbits & 0x03c)) { // Set 32-bit address,compressed
-			int nw = (sixbits & 0x03) + 2;
-			do {
-				nr += lclreadcode(&m_buf[nr], nw-nr);
-			} while (nr < nw);
-
-			if (nw == 2) {
-				val = chardec(m_buf[1]);
-			} else if (nw == 3) {
-				val = chardec(m_buf[1]);
-				val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-			} else if (nw == 4) {
-				val = chardec(m_buf[1]);
-				val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-				val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-			} else { // if (nw == 5)
-				val = chardec(m_buf[1]);
-				val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-				val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-				val = (val<<6) | (chardec(m_buf[4]) & 0x03f);
+			ptr = encode_run(nsent, ln, ptr);
+			outstanding += cost;
+			nsent += ln;
+		}
+
+		if (ptr != m_buf) {
+			*ptr++ = '\n'; *ptr = '\0';
+			send(m_buf, ptr-m_buf);
+			DBGPRINTF(">> %s\n", m_buf);
+		}
+
+		// readword() will adjust m_lastaddr as it reads.  Keep track
+		// of where we left it after encoding.
+		lastaddr = m_lastaddr;
+		while((ndone < nsent)&&((errat >= 0)||(nsent >= m_qlen)
+				||(outstanding > READAHEAD))) {
+			int	ln = qrunlen(ndone), i = 0;
+			BUSOP	*op = &m_queue[ndone];
+
+			if (op->m_rdp) {
+				// Reads return their values in order, with
+				// any error token in place of the value that
+				// failed.  The decoder stops at an error, so
+				// any values it's queued come before it.
+				try {
+					for(i=0; i<ln; i++) {
+						BUSW	v = readword();
+						if (errat < 0)
+							*op[i].m_rdp = v;
+					}
+				} catch(BUSERR b) {
+					if (errat < 0)
+						errat = ndone + i;
+				}
+				outstanding -= ln+1;
+			} else {
+				// Each write returns an acknowledgment, until
+				// one fails.  The device then returns an error
+				// token, and drops the rest of the burst.
+				unsigned	base = nacks;
+
+				nacks += ln;
+				while(m_wracks < nacks) {
+					if (m_errpending) {
+						m_errpending = false;
+						if (errat < 0)
+							errat = ndone
+							+ (m_wracks - base);
+						nacks = m_wracks;
+						break;
+					} readmore();
+				}
+				outstanding -= ln;
 			}
 
-			/* Ignore address, we are in readidle();
-			m_addr_set = true;
-			m_lastaddr = val;
-			*/
-			DBGPRINTF("RCVD IDLE-ADDR: 0x%08x (%d bytes)\n", val, nw+1);
-		} else
-			found_start = true;
+			ndone += ln;
+		}
+		m_lastaddr = lastaddr;
+
+		// Once something has failed, we send nothing more.  We just
+		// drain what we've already sent.
+		if (errat >= 0)
+			break;
 	}
 
-	if (found_start) {
-		// We're in readidle().  We don't expect to find any data.
-		// But ... we did.  So, just read it off and ignore it.
-		int	rdaddr;
-
-		DBGPRINTF("READ-IDLE()  PANIC! -- sixbits = %02x\n", sixbits);
-		if (0x06 == (sixbits & 0x03e)) { // Tbl read, last value
-			rdaddr = (m_rdaddr-1)&0x03ff;
-			val = m_readtbl[rdaddr];
-			m_lastaddr += (sixbits&1)?4:0;
-			DBGPRINTF("READ-IDLE() -- repeat last value, %08x\n", val);
-		} else if (0x10 == (sixbits & 0x030)) { // Tbl read, up to 521 into past
-			int	idx;
-			do {
-				nr += lclreadcode(&m_buf[nr], 2-nr);
-			} while (nr < 2);
-
-			idx = (chardec(m_buf[0])>>1) & 0x07;
-			idx = ((idx<<6) | (chardec(m_buf[1]) & 0x03f)) + 2 + 8;
-			rdaddr = (m_rdaddr-idx)&0x03ff;
-			val = m_readtbl[rdaddr];
-			m_lastaddr += (sixbits&1)?4:0;
-			DBGPRINTF("READ-IDLE() -- long table value[%3d], %08x\n", idx, val);
-		} else if (0x20 == (sixbits & 0x030)) { // Tbl read, 2-9 into past
-			rdaddr = (m_rdaddr - (((sixbits>>1)&0x07)+2)) & 0x03ff;
-			val = m_readtbl[rdaddr];
-			m_lastaddr += (sixbits&1)?4:0;
-			DBGPRINTF("READ-IDLE() -- short table value[%3d], %08x\n", rdaddr, val);
-		} else if (0x38 == (sixbits & 0x038)) { // Raw read
-			do {
-				nr += lclreadcode(&m_buf[nr], 6-nr);
-			} while (nr < 6);
-	
-			val = (chardec(m_buf[0])>>1) & 0x03;
-			val = (val<<6) | (chardec(m_buf[1]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[2]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[3]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[4]) & 0x03f);
-			val = (val<<6) | (chardec(m_buf[5]) & 0x03f);
-
-			m_readtbl[m_rdaddr++] = val; m_rdaddr &= 0x03ff;
-			m_lastaddr += (sixbits&1)?4:0;
-			DBGPRINTF("READ-IDLE() -- RAW-READ %02x:%02x:%02x:%02x:%02x:%02x -- %08x\n",
-				m_buf[0], m_buf[1], m_buf[2], m_buf[3],
-				m_buf[4], m_buf[5], val);
-		} else 
-			DBGPRINTF("READ-IDLE() -- Unknown character, %02x\n", sixbits);
+	if (errat >= 0) {
+		BUSW	a;
+
+		// A second error token may follow, should the device have
+		// been flushing a failed write burst when it found something
+		// other than a write.  Read (and ignore) anything else still
+		// coming our way.
+		while(rxavail()) {
+			readmore();
+			m_wqhead = m_wqtail;
+			m_errpending = false;
+		}
 
+		a = m_queue[errat].m_addr;
+		DBGPRINTF("COMPLETE::BUSERR, transaction %d of %d sent, %08x\n",
+			errat, nsent, a);
+		m_qlen = 0;
+		m_addr_set = false;
+		throw BUSERR(a, errat, nsent);
 	}
+
+	m_qlen = 0;
+	tmr.done();
+	DBGPRINTF("COMPLETE::DONE\n");
+}
+
+/*
+ * readv_scatter
+ *
+ * Reads n values from n arbitrary addresses.  These are queued and sent as
+ * one command burst, so that the whole set costs a single round trip.  Any
+ * addresses between reads are sent as differences from the last address
+ * whenever that's shorter, and any runs of incrementing addresses become
+ * vector reads.  Any transactions already queued will be completed first.
+ */
+void	TTYBUS::readv_scatter(const BUSW *addrs, const int n, BUSW *out) {
+	DBGPRINTF("READV-SCATTER(#%d)\n", n);
+	for(int i=0; i<n; i++)
+		queue_read(addrs[i], &out[i]);
+	complete();
+}
+
+/*
+ * writev_scatter
+ *
+ * The write counterpart to readv_scatter above.
+ */
+void	TTYBUS::writev_scatter(const BUSW *addrs, const int n,
+		const BUSW *vals) {
+	DBGPRINTF("WRITEV-SCATTER(#%d)\n", n);
+	for(int i=0; i<n; i++)
+		queue_write(addrs[i], vals[i]);
+	complete();
 }
 
 /*
@@ -881,32 +1439,16 @@ void	TTYBUS::readidle(void) {
  * bus.
  */
 void	TTYBUS::usleep(unsigned ms) {
-	if (m_dev->poll(ms)) {
-		int	nr;
-		nr = m_dev->read(m_buf, 16);
-		if (nr == 0) {
-			// Connection closed, let it drop
-			DBGPRINTF("Connection closed!!\n");
-			m_dev->close();
-			exit(-1);
-		} for(int i=0; i<nr; i++) {
-			if (m_buf[i] == TTYC_INT) {
-				m_interrupt_flag = true;
-				DBGPRINTF("!!!!!!!!!!!!!!!!! ----- INTERRUPT!\n");
-			} else if (m_buf[i] == TTYC_IDLE) {
-				DBGPRINTF("Interface is now idle\n");
-			} else if (m_buf[i] == TTYC_WRITE) {
-			} else if (m_buf[i] == TTYC_RESET) {
-				DBGPRINTF("Bus was RESET!\n");
-			} else if (m_buf[i] == TTYC_ERR) {
-				DBGPRINTF("Bus error\n");
-			} else if (m_buf[i] == TTYC_BUSY) {
-				DBGPRINTF("Interface is ... busy ??\n");
-			}
-			// else if (m_buf[nr] == 'Q')
-			// else if (m_buf[nr] == 'W')
-			// else if (m_buf[nr] == '\n')
-		}
+	if ((m_bxfirst < m_bxlast)||(m_dev->poll(ms))) {
+		// Any interrupt will be noticed by the decoder
+		readmore();
+
+		// We aren't expecting anything else, so ignore any values
+		// (or errors) that might have arrived
+		m_wqhead = m_wqtail;
+		m_errpending = false;
+		if (m_interrupt_flag)
+			DBGPRINTF("!!!!!!!!!!!!!!!!! ----- INTERRUPT!\n");
 	}
 }
 
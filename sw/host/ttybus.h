@@ -52,40 +52,107 @@
 
 #include "llcomms.h"
 #include "devbus.h"
+#include "busstats.h"
 
-#define	RDBUFLN	2048
+#define	WORDQLN	2048
+// The size of the buffer holding binary mode input, once converted to ASCII
+#define	BXBUFLN	8192
+
+// The sizes of our compression tables, log base two.  LGWTBL must match the
+// LGWTBL parameter given to wbubus within the FPGA, and can be no more than
+// eight.  The read table must be able to hold every value the FPGA might
+// reference (up to 521 back), so LGRTBL can be no less than ten--no matter
+// how deep the FPGA's own (LGRTBL) table is.
+#define	LGWTBL	8
+#define	LGRTBL	10
+// Values written are found within the write table via a hash of LGWRHASH bits
+#define	LGWRHASH	(LGWTBL+4)
+
+#if	(LGWTBL > 8)||(LGRTBL < 10)
+#error	"Unsupported compression table size"
+#endif
 
 class	TTYBUS : public DEVBUS {
 public:
 	unsigned long	m_total_nread;
 private:
 	LLCOMMSI	*m_dev;
-	static	const	unsigned MAXRDLEN, MAXWRLEN;
+	static	const	unsigned MAXRDLEN, MAXWRLEN, MAXRUNLN, MINRUNLN;
 
-	bool	m_interrupt_flag, m_decode_err, m_addr_set, m_bus_err;
+	bool	m_interrupt_flag, m_decode_err, m_addr_set, m_bus_err,
+		m_errpending;
 	unsigned int	m_lastaddr;
 
-	int	m_buflen, m_rdfirst, m_rdlast;
-	char	*m_buf, *m_rdbuf;
+	int	m_buflen;
+	char	*m_buf;
+
+	int		m_rdaddr;
+	BUSW		m_readtbl[1<<LGRTBL];
+
+	// m_wraddr counts every value ever written into m_writetbl, and
+	// m_wrhash records the count when a value with that hash was last
+	// written.
+	unsigned	m_wraddr;
+	BUSW		m_writetbl[1<<LGWTBL];
+	unsigned	m_wrhash[1<<LGWRHASH];
+
+	// Decoder state, and the queue of values decoded but not yet read
+	int		m_dcount;
+	unsigned	m_dfirst;
+	BUSW		m_dval;
+	unsigned	m_wqhead, m_wqtail;
+	BUSW		m_wordq[WORDQLN];
+
+	// Transactions queued by queue_read()/queue_write(), waiting on
+	// complete().  Reads have a non-NULL m_rdp, writes have m_rdp==NULL.
+	typedef	struct	{
+		BUSW	m_addr, m_data, *m_rdp;
+	} BUSOP;
+	int	m_qlen, m_qalloc;
+	BUSOP	*m_queue;
+	unsigned	m_wracks;
 
-	bool	m_wrloaded;
-	int	m_rdaddr, m_wraddr;
-	BUSW	m_readtbl[1024], m_writetbl[512];
+	// Binary mode.  m_binbits is the number of bits per byte, or zero
+	// while we're still using printable ASCII.  Input is unpacked
+	// (m_bxacc holds m_bxnacc bits not yet unpacked) into ASCII within
+	// m_bxbuf, from where the decoder then reads it.
+	int		m_binbits;
+	unsigned	m_bxacc;
+	int		m_bxnacc;
+	bool		m_bxesc;
+	int		m_bxfirst, m_bxlast;
+	char		*m_bxbuf, *m_bxout;
+
+	// Performance statistics, reported on exit if FPGASTATS is set
+	BUSSTATS	m_stats;
 
 	void	init(void) {
 		m_total_nread = 0;
 		m_interrupt_flag = false;
 		m_buflen = 0; m_buf = NULL;
+		m_bxbuf = NULL; m_bxout = NULL;
 		m_addr_set = false;
 		bufalloc(64);
 		m_bus_err = false;
 		m_decode_err = false;
-		m_wrloaded = false;
+		m_errpending = false;
+
+		m_rdaddr = 0;
+		m_wraddr = 0;
+		for(int k=0; k<(1<<LGWRHASH); k++)
+			m_wrhash[k] = 0;
+
+		m_dcount = 0; m_dfirst = 0; m_dval = 0;
+		m_wqhead = m_wqtail = 0;
+		builddecoder();
 
-		m_rdfirst = m_rdlast = 0;
-		m_rdbuf = new char[RDBUFLN];
+		m_qlen = m_qalloc = 0;
+		m_queue = NULL;
+		m_wracks = 0;
 
-		m_rdaddr = m_wraddr = 0;
+		m_binbits = 0;
+		m_bxacc = 0; m_bxnacc = 0; m_bxesc = false;
+		m_bxfirst = m_bxlast = 0;
 	}
 
 	char	charenc(const int sixbitval) const;
@@ -98,34 +165,68 @@ private:
 	void	readv(const BUSW a, const int inc, const int len, BUSW *buf);
 	void	writev(const BUSW a, const int p, const int len, const BUSW *buf);
 	void	readidle(void);
+	void	readacks(const unsigned n);
 
-	int	lclread(char *buf, int len);
-	int	lclreadcode(char *buf, int len);
+	static	void	builddecoder(void);
+	int	decode(const char *buf, const int len);
+	void	readmore(void);
+	bool	rxavail(void);
+	void	send(char *buf, int len);
+	void	negotiate(void);
+	int	unpack(const char *buf, const int len);
 	char	*encode_address(const BUSW a);
+	char	*encode_address(const BUSW a, char *buf);
+	char	*encode_word(const int p, const BUSW v, char *buf);
+	char	*encode_stride(const int ln, const int stride, char *buf);
+	static	unsigned wrhash(const BUSW v) {
+		return (v * 0x9e3779b1u) >> (32-LGWRHASH); }
 	char	*readcmd(const int inc, const int len, char *buf);
+
+	BUSOP	*qalloc(void);
+	int	qrunlen(const int k) const;
+	char	*encode_run(const int k, const int ln, char *buf);
 public:
-	TTYBUS(LLCOMMSI *comms) : m_dev(comms) { init(); }
+	// If binary is true, we'll ask the FPGA to use a binary (rather than
+	// ASCII) encoding.  We'll continue in ASCII if it doesn't answer.
+	TTYBUS(LLCOMMSI *comms, const bool binary = false) : m_dev(comms) {
+		init();
+		if (binary)
+			negotiate();
+	}
 	virtual	~TTYBUS(void) {
-		m_dev->close();
+		close();
+		m_stats.report(m_dev->m_total_nread, m_dev->m_total_nwrit);
 		if (m_buf) { delete[] m_buf; m_buf = NULL; };
-		delete m_rdbuf; m_rdbuf = NULL;
+		if (m_queue) { delete[] m_queue; m_queue = NULL; }
+		if (m_bxbuf) { delete[] m_bxbuf; m_bxbuf = NULL; }
+		if (m_bxout) { delete[] m_bxout; m_bxout = NULL; }
 		delete	m_dev;
 	}
 
 	void	kill(void) { m_dev->close(); }
-	void	close(void) {	m_dev->close(); }
+	void	close(void);
 	void	writeio(const BUSW a, const BUSW v);
 	BUSW	readio(const BUSW a);
 	void	readi( const BUSW a, const int len, BUSW *buf);
 	void	readz( const BUSW a, const int len, BUSW *buf);
 	void	writei(const BUSW a, const int len, const BUSW *buf);
 	void	writez(const BUSW a, const int len, const BUSW *buf);
+	void	readv_scatter(const BUSW *addrs, const int n, BUSW *out);
+	void	writev_scatter(const BUSW *addrs, const int n,
+			const BUSW *vals);
+	void	queue_write(const BUSW a, const BUSW v);
+	void	queue_read(const BUSW a, BUSW *v);
+	void	complete(void);
 	bool	poll(void) { return m_interrupt_flag; };
 	void	usleep(unsigned msec); // Sleep until interrupt
 	void	wait(void); // Sleep until interrupt
 	bool	bus_err(void) const { return m_bus_err; };
 	void	reset_err(void) { m_bus_err = false; }
 	void	clear(void) { m_interrupt_flag = false; }
+
+	// Latency, throughput, and compression statistics, for any program
+	// that wishes to report on them itself
+	const BUSSTATS	&stats(void) const { return m_stats; }
 };
 
 typedef	TTYBUS	FPGA;
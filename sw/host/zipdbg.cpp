@@ -110,12 +110,30 @@ public:
 
 	void	read_raw_state(void) {
 		m_state.m_valid = false;
-		for(int i=0; i<16; i++)
-			m_state.m_sR[i] = cmd_read(i);
-		for(int i=0; i<16; i++)
-			m_state.m_uR[i] = cmd_read(i+16);
-		for(int i=0; i<20; i++)
-			m_state.m_p[i]  = cmd_read(i+32);
+		if ((readio(R_ZIPCTRL) & CPU_STALL)!=0) {
+			// If the CPU is already halted, there's no need to
+			// wait on it between register reads.  Queue all
+			// 52 register reads at once, so they cost one
+			// round trip rather than 104 or more.
+			for(int i=0; i<16; i++) {
+				queue_write(R_ZIPCTRL, CMD_HALT|i);
+				queue_read(R_ZIPDATA, &m_state.m_sR[i]);
+			} for(int i=0; i<16; i++) {
+				queue_write(R_ZIPCTRL, CMD_HALT|(i+16));
+				queue_read(R_ZIPDATA, &m_state.m_uR[i]);
+			} for(int i=0; i<20; i++) {
+				queue_write(R_ZIPCTRL, CMD_HALT|(i+32));
+				queue_read(R_ZIPDATA, &m_state.m_p[i]);
+			}
+			complete();
+		} else {
+			for(int i=0; i<16; i++)
+				m_state.m_sR[i] = cmd_read(i);
+			for(int i=0; i<16; i++)
+				m_state.m_uR[i] = cmd_read(i+16);
+			for(int i=0; i<20; i++)
+				m_state.m_p[i]  = cmd_read(i+32);
+		}
 
 		m_state.m_gie = (m_state.m_sR[14] & 0x020);
 		m_state.m_pc  = (m_state.m_gie) ? (m_state.m_uR[15]):(m_state.m_sR[15]);
@@ -159,6 +177,24 @@ public:
 		m_state.m_smem[0].m_a = m_state.m_sp;
 		for(int i=1; i<5; i++)
 			m_state.m_smem[i].m_a = m_state.m_smem[i-1].m_a+4;
+
+		// Try reading the whole stack window at once.  Only if that
+		// fails do we go back and find which words are valid.
+		try {
+			BUSW	sa[5], sv[5];
+			for(int i=0; i<5; i++)
+				sa[i] = m_state.m_smem[i].m_a;
+			readv_scatter(sa, 5, sv);
+			for(int i=0; i<5; i++) {
+				m_state.m_smem[i].m_d = sv[i];
+				m_state.m_smem[i].m_valid = true;
+			}
+			m_state.m_valid = true;
+			return;
+		} catch(BUSERR be) {
+			// Fall through and read them one at a time
+		}
+
 		for(int i=0; i<5; i++) {
 			m_state.m_smem[i].m_valid = true;
 			if (m_state.m_smem[i].m_valid)
@@ -184,6 +220,15 @@ public:
 		return m_fpga->writei(a, len, buf); }
 	void	writez(const BUSW a, const int len, const BUSW *buf) {
 		return m_fpga->writez(a, len, buf); }
+	void	readv_scatter(const BUSW *addrs, const int n, BUSW *out) {
+		m_fpga->readv_scatter(addrs, n, out); }
+	void	writev_scatter(const BUSW *addrs, const int n,
+			const BUSW *vals) {
+		m_fpga->writev_scatter(addrs, n, vals); }
+	void	queue_write(const BUSW a, const BUSW v) {
+		m_fpga->queue_write(a, v); }
+	void	queue_read(const BUSW a, BUSW *v) { m_fpga->queue_read(a, v); }
+	void	complete(void) { m_fpga->complete(); }
 	bool	poll(void) { return m_fpga->poll(); }
 	void	usleep(unsigned ms) { m_fpga->usleep(ms); }
 	void	wait(void) { m_fpga->wait(); }